@@ -3,17 +3,39 @@
 #include <string>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <list>
 #include <pthread.h>
 #include <iostream>
 #include "sql_connection_pool.h"
+#include "../metrics/metrics.h"
+#include "../log/log.h"
 
 using namespace std;
 
+thread_local int connection_pool::t_last = -1;
+
+//绝对时间，给cond::timewait用
+static struct timespec deadline_after(uint64_t ns)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ns += ts.tv_nsec;
+	ts.tv_sec += ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	return ts;
+}
+
 connection_pool::connection_pool()
 {
-	this->CurConn = 
-	this->FreeConn = 0;
+	this->MinConn =
+	this->MaxConn = 0;
+	m_slots = NULL;
+	m_waiters = 0;
+	m_ping_ns = 0;
+	m_wait_ms = 0;
+	m_stop = false;
+	m_started = false;
 }
 
 connection_pool *connection_pool::GetInstance()
@@ -23,63 +45,123 @@ connection_pool *connection_pool::GetInstance()
 }
 
 //构造初始化
-void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, unsigned int MaxConn)
+bool connection_pool::init(string url, string User, string PassWord, string DBName, int Port, unsigned int MinConn,
+						   unsigned int MaxConn, int ping_interval, int wait_ms)
 {
 	this->url = url;
 	this->Port = Port;
 	this->User = User;
 	this->PassWord = PassWord;
 	this->DatabaseName = DBName;
+	this->MinConn = MinConn;
+	this->MaxConn = MaxConn > MinConn ? MaxConn : MinConn;
+	m_ping_ns = (uint64_t)ping_interval * 1000000000ULL;
+	m_wait_ms = wait_ms;
 
-	lock.lock();
-	for (int i = 0; i < MaxConn; i++)
+	m_slots = new slot[this->MaxConn];
+	for (unsigned int i = 0; i < this->MaxConn; i++)
 	{
-		MYSQL *con = NULL;
-		con = mysql_init(con);
-
-		if (con == NULL)
-		{
-			cout << "Error:" << mysql_error(con);
-			exit(1);
-		}
-		con = mysql_real_connect(con, url.c_str(), User.c_str(), PassWord.c_str(), DBName.c_str(), Port, NULL, 0);
-
-		if (con == NULL)
-		{
-			cout << "Error: " << mysql_error(con);
-			exit(1);
-		}
-		connList.push_back(con);
-		++FreeConn;
+		m_slots[i].state = EMPTY;
+		m_slots[i].idle_ns = 0;
+		m_slots[i].alive_ns = 0;
 	}
 
-	reserve = sem(FreeConn);
+	for (unsigned int i = 0; i < MinConn; i++)
+	{
+		slot *s = reserve();
+		if (!open(s))
+			return false;
+		s->state.store(FREE);
+	}
 
-	this->MaxConn = FreeConn;
-	
-	lock.unlock();
+	if (pthread_create(&m_tid, NULL, worker, this) != 0)
+		return false;
+	m_started = true;
+	return true;
 }
 
-
-//当有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
+//当有请求时，从数据库连接池中返回一个可用连接
+//先试本线程上次还回的连接，再扫一遍所有槽，都不空闲时才拿锁等待
 MYSQL *connection_pool::GetConnection()
 {
-	MYSQL *con = NULL;
-
-	if (0 == connList.size())
+	if (!m_slots)
 		return NULL;
 
-	reserve.wait();
-	
-	lock.lock();
+	//等空闲连接的时间记入db_wait阶段
+	uint64_t start = metrics::now_ns();
+	MYSQL *con = NULL;
+	int last = t_last;
+	int expected = FREE;
+	if (last >= 0 && m_slots[last].state.compare_exchange_strong(expected, BUSY))
+		con = &m_slots[last].conn;
+	else
+		con = take();
+	if (!con)
+		con = wait(start);
+	metrics::observe(metrics::STAGE_DB_WAIT, metrics::now_ns() - start);
+	return con;
+}
 
-	con = connList.front();
-	connList.pop_front();
+//扫描所有槽，CAS抢到第一个空闲的；从0号开始扫，负载低时使用集中在前面的槽，后面的空闲下来可以关闭
+MYSQL *connection_pool::take()
+{
+	for (unsigned int i = 0; i < MaxConn; i++)
+	{
+		int expected = FREE;
+		if (m_slots[i].state.load(std::memory_order_relaxed) == FREE &&
+			m_slots[i].state.compare_exchange_strong(expected, BUSY))
+			return &m_slots[i].conn;
+	}
+	return NULL;
+}
 
-	--FreeConn;
-	++CurConn;
+//没有空闲连接：等GROW_WAIT_MS还没人归还就新开一个，连接数已到上限或者连不上就一直等到m_wait_ms
+//m_waiters先加再扫描，ReleaseConnection先置FREE再读m_waiters，两边至少有一个看到对方
+MYSQL *connection_pool::wait(uint64_t start)
+{
+	uint64_t deadline = start + (uint64_t)m_wait_ms * 1000000ULL;
+	uint64_t grow_at = start + (uint64_t)GROW_WAIT_MS * 1000000ULL;
+	bool grown = false;
+	MYSQL *con = NULL;
 
+	lock.lock();
+	m_waiters++;
+	while (!(con = take()))
+	{
+		uint64_t now = metrics::now_ns();
+		if (!grown && now >= grow_at)
+		{
+			grown = true;
+			slot *s = reserve();
+			if (s)
+			{
+				//建连接要一次网络往返，不拿着锁
+				lock.unlock();
+				bool ok = open(s);
+				lock.lock();
+				if (ok)
+				{
+					s->state.store(BUSY);
+					metrics::add(metrics::DB_OPENED);
+					con = &s->conn;
+					break;
+				}
+				continue;
+			}
+		}
+		if (now >= deadline)
+			break;
+		uint64_t until = grown || grow_at > deadline ? deadline : grow_at;
+		m_cond.timewait(lock.get(), deadline_after(until - now));
+	}
+	m_waiters--;
 	lock.unlock();
+
+	if (!con)
+	{
+		metrics::add(metrics::DB_TIMEOUTS);
+		LOG_WARN("no mysql connection after %d ms", m_wait_ms);
+	}
 	return con;
 }
 
@@ -89,45 +171,211 @@ bool connection_pool::ReleaseConnection(MYSQL *con)
 	if (NULL == con)
 		return false;
 
-	lock.lock();
+	slot *s = reinterpret_cast<slot *>(con);
+	if (s < m_slots || s >= m_slots + MaxConn)
+		return false;
+
+	uint64_t now = metrics::now_ns();
+	s->idle_ns.store(now, std::memory_order_relaxed);
+	s->alive_ns.store(now, std::memory_order_relaxed);
+	s->state.store(FREE);
+	t_last = s - m_slots;
+	notify();
+	return true;
+}
 
-	connList.push_back(con);
-	++FreeConn;
-	--CurConn;
+//有线程在等时才拿锁唤醒一个
+void connection_pool::notify()
+{
+	if (m_waiters.load() > 0)
+	{
+		lock.lock();
+		m_cond.signal();
+		lock.unlock();
+	}
+}
 
-	lock.unlock();
+//占一个没有连接的槽，满了返回NULL
+connection_pool::slot *connection_pool::reserve()
+{
+	for (unsigned int i = 0; i < MaxConn; i++)
+	{
+		int expected = EMPTY;
+		if (m_slots[i].state.load(std::memory_order_relaxed) == EMPTY &&
+			m_slots[i].state.compare_exchange_strong(expected, OPENING))
+			return &m_slots[i];
+	}
+	return NULL;
+}
 
-	reserve.post();
+//在reserve到的槽上建连接，失败时槽还回EMPTY
+bool connection_pool::open(slot *s)
+{
+	if (!s)
+		return false;
+	if (connect(s))
+		return true;
+	mysql_close(&s->conn);
+	s->state.store(EMPTY);
+	return false;
+}
+
+//mysql_init在槽里的MYSQL上初始化，失败时留着初始化过的句柄，由调用者mysql_close
+//连接超时设成取连接的等待时间，数据库不可达时建连接不会卡住调用者太久
+bool connection_pool::connect(slot *s)
+{
+	MYSQL *con = mysql_init(&s->conn);
+	if (con == NULL)
+		return false;
+	unsigned int timeout = (m_wait_ms + 999) / 1000;
+	mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+	if (!mysql_real_connect(con, url.c_str(), User.c_str(), PassWord.c_str(), DatabaseName.c_str(), Port, NULL, 0))
+	{
+		LOG_ERROR("mysql connect error:%s", mysql_error(con));
+		return false;
+	}
+	uint64_t now = metrics::now_ns();
+	s->idle_ns.store(now, std::memory_order_relaxed);
+	s->alive_ns.store(now, std::memory_order_relaxed);
 	return true;
 }
 
-//销毁数据库连接池
-void connection_pool::DestroyPool()
+//持有者执行语句失败后调用；连接还活着说明是语句本身的错误，返回false
+bool connection_pool::Revive(MYSQL *con)
+{
+	if (NULL == con || mysql_ping(con) == 0)
+		return false;
+
+	LOG_WARN("mysql connection lost:%s, reconnecting", mysql_error(con));
+	slot *s = reinterpret_cast<slot *>(con);
+	mysql_close(con);
+	if (!connect(s))
+		return false;
+	metrics::add(metrics::DB_RECONNECTS);
+	return true;
+}
+
+void *connection_pool::worker(void *arg)
 {
+	connection_pool *pool = (connection_pool *)arg;
+	pool->run();
+	return pool;
+}
 
+//后台线程：每TICK_MS检查一遍空闲的连接，补足MinConn个
+void connection_pool::run()
+{
 	lock.lock();
-	if (connList.size() > 0)
+	while (!m_stop)
 	{
-		list<MYSQL *>::iterator it;
-		for (it = connList.begin(); it != connList.end(); ++it)
+		m_tick.timewait(lock.get(), deadline_after((uint64_t)TICK_MS * 1000000ULL));
+		if (m_stop)
+			break;
+		lock.unlock();
+
+		uint64_t now = metrics::now_ns();
+		unsigned int open_count = GetOpenConn();
+		for (unsigned int i = 0; i < MaxConn; i++)
 		{
-			MYSQL *con = *it;
-			mysql_close(con);
+			slot *s = &m_slots[i];
+			if (s->state.load(std::memory_order_relaxed) != FREE)
+				continue;
+			//读now之后才归还的槽，时间戳可能比now新
+			uint64_t idle = s->idle_ns.load(std::memory_order_relaxed);
+			uint64_t alive = s->alive_ns.load(std::memory_order_relaxed);
+			idle = now > idle ? now - idle : 0;
+			alive = now > alive ? now - alive : 0;
+			bool shrink = open_count > MinConn && idle >= (uint64_t)IDLE_CLOSE_MS * 1000000ULL;
+			if (!shrink && alive < m_ping_ns)
+				continue;
+			int expected = FREE;
+			if (!s->state.compare_exchange_strong(expected, CHECKING))
+				continue;
+			if (!check(s, now, shrink))
+				open_count--;
 		}
-		CurConn = 0;
-		FreeConn = 0;
-		connList.clear();
 
-		lock.unlock();
+		while (open_count < MinConn)
+		{
+			slot *s = reserve();
+			if (!open(s))
+				break;
+			s->state.store(FREE);
+			metrics::add(metrics::DB_OPENED);
+			notify();
+			open_count++;
+		}
+
+		lock.lock();
+	}
+	lock.unlock();
+}
+
+//调用时槽处于CHECKING：空闲太久的多余连接关闭，很久没用过的ping一次，ping不通的重连，连不上的关闭；关闭了返回false
+bool connection_pool::check(slot *s, uint64_t now, bool shrink)
+{
+	if (shrink)
+	{
+		mysql_close(&s->conn);
+		s->state.store(EMPTY);
+		return false;
 	}
+	if (mysql_ping(&s->conn) != 0)
+	{
+		LOG_WARN("mysql ping failed:%s, reconnecting", mysql_error(&s->conn));
+		mysql_close(&s->conn);
+		if (!connect(s))
+		{
+			mysql_close(&s->conn);
+			s->state.store(EMPTY);
+			return false;
+		}
+		metrics::add(metrics::DB_RECONNECTS);
+	}
+	s->alive_ns.store(now, std::memory_order_relaxed);
+	s->state.store(FREE);
+	notify();
+	return true;
+}
 
+//销毁数据库连接池
+//先停后台线程，再关闭空闲的连接；数据库线程一直占着的连接不关，槽数组也不释放
+void connection_pool::DestroyPool()
+{
+	lock.lock();
+	m_stop = true;
+	m_tick.signal();
 	lock.unlock();
+	if (m_started)
+	{
+		pthread_join(m_tid, NULL);
+		m_started = false;
+	}
+
+	for (unsigned int i = 0; i < MaxConn; i++)
+	{
+		int expected = FREE;
+		if (m_slots[i].state.compare_exchange_strong(expected, EMPTY))
+			mysql_close(&m_slots[i].conn);
+	}
 }
 
 //当前空闲的连接数
+//GET /metrics在reactor线程上读，和取还连接的线程并发
 int connection_pool::GetFreeConn()
 {
-	return this->FreeConn;
+	int free = 0;
+	for (unsigned int i = 0; i < MaxConn; i++)
+		free += m_slots[i].state.load(std::memory_order_relaxed) == FREE;
+	return free;
+}
+
+int connection_pool::GetOpenConn()
+{
+	int open = 0;
+	for (unsigned int i = 0; i < MaxConn; i++)
+		open += m_slots[i].state.load(std::memory_order_relaxed) != EMPTY;
+	return open;
 }
 
 connection_pool::~connection_pool()
@@ -137,11 +385,11 @@ connection_pool::~connection_pool()
 
 connectionRAII::connectionRAII(MYSQL **SQL, connection_pool *connPool){
 	*SQL = connPool->GetConnection();
-	
+
 	conRAII = *SQL;
 	poolRAII = connPool;
 }
 
 connectionRAII::~connectionRAII(){
 	poolRAII->ReleaseConnection(conRAII);
-}
\ No newline at end of file
+}
@@ -2,7 +2,10 @@
 #define _CONNECTION_POOL_
 
 #include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <list>
+#include <atomic>
 #include <mysql/mysql.h>
 #include <error.h>
 #include <string.h>
@@ -12,35 +15,84 @@
 
 using namespace std;
 
+// 数据库连接池，单例
+// 连接数在MinConn和MaxConn之间伸缩：取连接等了GROW_WAIT_MS还没有空闲的就新开一个，多出MinConn的连接空闲IDLE_CLOSE_MS后关闭
+// 每个连接一个槽，槽的状态是原子变量，取还连接用CAS，不拿全局锁；每个线程记住上次还回的槽，下次先试它，命中时只有一次CAS
+// 后台线程定时ping空闲的连接，ping不通的原地重连，连接数低于MinConn时补上；MYSQL结构放在槽里，重连后地址不变
+// 全局锁只在没有空闲连接、需要等待时用
 class connection_pool
 {
 public:
-	MYSQL *GetConnection();				 //获取数据库连接
+	MYSQL *GetConnection();				 //获取数据库连接，最多等wait_ms毫秒，超时返回NULL
 	bool ReleaseConnection(MYSQL *conn); //释放连接
+	bool Revive(MYSQL *conn);			 //语句执行失败后由持有者调用：ping不通就原地重连，重连成功返回true，之前预处理的语句都已失效
 	int GetFreeConn();					 //获取连接
+	int GetOpenConn();					 //当前打开的连接数，包括正在使用的
 	void DestroyPool();					 //销毁所有连接
 
 	//单例模式
 	static connection_pool *GetInstance();
 
-	void init(string url, string User, string PassWord, string DataBaseName, int Port, unsigned int MaxConn); 
-	
+	//打开MinConn个连接，有一个打不开就返回false；ping_interval秒没用过的空闲连接会被ping一次
+	bool init(string url, string User, string PassWord, string DataBaseName, int Port, unsigned int MinConn,
+			  unsigned int MaxConn, int ping_interval, int wait_ms);
+
 	connection_pool();
 	~connection_pool();
 
+public:
+	static const int GROW_WAIT_MS = 2;		//没有空闲连接时先等这么久，还没有人归还才新开连接
+	static const int IDLE_CLOSE_MS = 60000; //多出MinConn的连接空闲超过该时间后关闭
+	static const int TICK_MS = 1000;		//后台线程检查的周期
+
 private:
+	enum STATE
+	{
+		EMPTY = 0, //没有连接
+		FREE,	   //空闲
+		BUSY,	   //已借出
+		OPENING,   //正在建立连接
+		CHECKING   //后台线程正在ping或者关闭
+	};
+	// MYSQL放在第一个成员，借出的MYSQL*就是槽的地址
+	struct slot
+	{
+		MYSQL conn;
+		std::atomic<int> state;
+		std::atomic<uint64_t> idle_ns;	//上次归还的时间，空闲超时从这里算
+		std::atomic<uint64_t> alive_ns; //上次确认连接可用的时间：连上、归还或者ping成功；后台线程不占用槽先读这两个，relaxed即可
+	};
+
+	static void *worker(void *arg);
+	void run();
+	MYSQL *take();
+	MYSQL *wait(uint64_t start);
+	slot *reserve();
+	bool open(slot *s);
+	bool connect(slot *s);
+	bool check(slot *s, uint64_t now, bool shrink);
+	void notify();
+
+private:
+	unsigned int MinConn;  //最少保持的连接数
 	unsigned int MaxConn;  //最大连接数
-	unsigned int CurConn;  //当前已使用的连接数
-	unsigned int FreeConn; //当前空闲的连接数
+	slot *m_slots;
+	std::atomic<int> m_waiters; //等在m_cond上的线程数
+	uint64_t m_ping_ns;
+	int m_wait_ms;
+	bool m_stop;
+	pthread_t m_tid;
+	bool m_started;
+	static thread_local int t_last; //本线程上次归还的槽
 
 private:
 	locker lock;
-	list<MYSQL *> connList; //连接池
-	sem reserve;
+	cond m_cond; //归还连接时唤醒等待者
+	cond m_tick; //唤醒后台线程退出
 
 private:
 	string url;			 //主机地址
-	string Port;		 //数据库端口号
+	int Port;			 //数据库端口号
 	string User;		 //登陆数据库用户名
 	string PassWord;	 //登陆数据库密码
 	string DatabaseName; //使用数据库名
@@ -51,7 +103,7 @@ class connectionRAII{
 public:
 	connectionRAII(MYSQL **con, connection_pool *connPool);
 	~connectionRAII();
-	
+
 private:
 	MYSQL *conRAII;
 	connection_pool *poolRAII;
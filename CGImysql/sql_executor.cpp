@@ -0,0 +1,244 @@
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include "sql_executor.h"
+#include "user_table.h"
+#include "../log/log.h"
+
+sql_executor::sql_executor() : m_waiting(0), m_running(0), m_connPool(NULL), m_thread_number(0)
+{
+}
+
+sql_executor::~sql_executor()
+{
+}
+
+//数据库线程是detach的，进程退出时还睡在m_jobcond上；静态对象析构时pthread_cond_destroy会一直等这些线程，所以单例不析构
+sql_executor *sql_executor::GetInstance()
+{
+    static sql_executor *executor = new sql_executor;
+    return executor;
+}
+
+bool sql_executor::init(connection_pool *connPool, int thread_number)
+{
+    m_connPool = connPool;
+    for (int i = 0; i < thread_number; ++i)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker, this) != 0)
+            return false;
+        pthread_detach(tid);
+        m_thread_number++;
+    }
+    return m_thread_number > 0;
+}
+
+//任务链表不限长度，提交永远不会失败，也不会阻塞工作线程；链表节点和任务都复用，稳定后不再分配内存
+//只在链表由空变非空(唤醒空闲线程)和凑满一批(提前结束等待)时signal
+void sql_executor::enqueue(sql_job *job)
+{
+    m_lock.lock();
+    if (m_freenodes.empty())
+        m_jobs.push_back(job);
+    else
+    {
+        m_freenodes.front() = job;
+        m_jobs.splice(m_jobs.end(), m_freenodes, m_freenodes.begin());
+    }
+    size_t n = m_jobs.size();
+    bool wake = m_waiting > 0 && (n == 1 || n >= (size_t)BATCH_ROWS);
+    m_lock.unlock();
+    if (wake)
+        m_jobcond.signal();
+}
+
+sql_job *sql_executor::alloc()
+{
+    sql_job *job = NULL;
+    m_lock.lock();
+    if (!m_spare.empty())
+    {
+        job = m_spare.back();
+        m_spare.pop_back();
+    }
+    m_lock.unlock();
+    return job ? job : new sql_job;
+}
+
+void sql_executor::submit(sql_job *job)
+{
+    enqueue(job);
+}
+
+void sql_executor::post(const sql_job &job)
+{
+    sql_job *copy = alloc();
+    *copy = job;
+    copy->done = NULL;
+    enqueue(copy);
+}
+
+void *sql_executor::worker(void *arg)
+{
+    sql_executor *executor = (sql_executor *)arg;
+    executor->run();
+    return executor;
+}
+
+void sql_executor::run()
+{
+    MYSQL *conn = NULL;
+    MYSQL_STMT *stmts[BATCH_ROWS + 1] = {NULL}; //stmts[k]是k行的INSERT
+    vector<sql_job *> batch;
+    batch.reserve(BATCH_ROWS);
+    m_lock.lock();
+    while (true)
+    {
+        while (m_jobs.empty())
+        {
+            m_waiting++;
+            m_jobcond.wait(m_lock.get());
+            m_waiting--;
+        }
+        //第一行到了之后最多再等FLUSH_MS毫秒凑一批
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += FLUSH_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!m_jobs.empty() && m_jobs.size() < (size_t)BATCH_ROWS)
+        {
+            m_waiting++;
+            bool signaled = m_jobcond.timewait(m_lock.get(), deadline);
+            m_waiting--;
+            if (!signaled)
+                break;
+        }
+        while (!m_jobs.empty() && batch.size() < (size_t)BATCH_ROWS)
+        {
+            batch.push_back(m_jobs.front());
+            m_freenodes.splice(m_freenodes.begin(), m_jobs, m_jobs.begin());
+        }
+        if (batch.empty())
+            continue;
+        m_running++;
+        m_lock.unlock();
+
+        //连接在第一批任务到来时才取，取不到(池满或者数据库不可达，等了db_wait_timeout)这批失败，下一批再取
+        if (!conn)
+            conn = m_connPool->GetConnection();
+        flush(conn, stmts, batch);
+        m_lock.lock();
+        recycle(batch);
+        m_running--;
+    }
+}
+
+//数据库线程不会停，这里只是等它们把手上的任务做完
+bool sql_executor::drain(int timeout_ms)
+{
+    for (int waited = 0;; ++waited)
+    {
+        m_lock.lock();
+        bool idle = m_jobs.empty() && m_running == 0;
+        m_lock.unlock();
+        if (idle)
+            return true;
+        if (waited >= timeout_ms)
+            break;
+        usleep(1000);
+    }
+    LOG_WARN("%s", "sql executor drain timeout");
+    return false;
+}
+
+//多行INSERT是一条语句，有一行失败(例如主键冲突)整批都不会写入，这时逐行重试，每个任务得到自己的结果
+//整批失败时先看是不是连接断了：断了就原地重连，原来预处理的语句都作废，整批再执行一次
+void sql_executor::flush(MYSQL *conn, MYSQL_STMT **stmts, vector<sql_job *> &batch)
+{
+    int rows = batch.size();
+    bool ok = conn && insert_users(conn, stmts, &batch[0], rows);
+    if (!ok && m_connPool->Revive(conn))
+    {
+        for (int i = 0; i <= BATCH_ROWS; ++i)
+        {
+            if (stmts[i])
+                mysql_stmt_close(stmts[i]);
+            stmts[i] = NULL;
+        }
+        ok = insert_users(conn, stmts, &batch[0], rows);
+    }
+    for (int i = 0; i < rows; ++i)
+    {
+        sql_job *job = batch[i];
+        job->ok = ok || (rows > 1 && conn && insert_users(conn, stmts, &job, 1));
+        //用户名在提交前就进了用户表，没落库就撤销，否则能用数据库里没有的密码登录，同名也再注册不了
+        if (!job->ok)
+        {
+            user_table::GetInstance()->erase(job->name);
+            LOG_ERROR("register insert failed:%s", job->name);
+            Log::get_instance()->flush();
+        }
+        if (job->done)
+            job->done(job);
+    }
+}
+
+//调用时持有m_lock；done回调已经返回，任务都留着给下次alloc复用
+void sql_executor::recycle(vector<sql_job *> &batch)
+{
+    m_spare.insert(m_spare.end(), batch.begin(), batch.end());
+    batch.clear();
+}
+
+//语句第一次用到时预处理；执行失败时关掉语句，下次重新预处理，连接重连后旧语句已经失效
+bool sql_executor::insert_users(MYSQL *conn, MYSQL_STMT **stmts, sql_job **jobs, int rows)
+{
+    MYSQL_STMT *&stmt = stmts[rows];
+    if (!stmt)
+    {
+        string sql = "INSERT INTO user(username, passwd) VALUES(?, ?)";
+        for (int i = 1; i < rows; ++i)
+            sql += ",(?, ?)";
+        stmt = mysql_stmt_init(conn);
+        if (!stmt)
+            return false;
+        if (mysql_stmt_prepare(stmt, sql.c_str(), sql.size()))
+        {
+            LOG_ERROR("prepare error:%s", mysql_stmt_error(stmt));
+            mysql_stmt_close(stmt);
+            stmt = NULL;
+            return false;
+        }
+    }
+
+    MYSQL_BIND bind[BATCH_ROWS * 2];
+    unsigned long lengths[BATCH_ROWS * 2];
+    memset(bind, 0, sizeof(MYSQL_BIND) * rows * 2);
+    for (int i = 0; i < rows; ++i)
+    {
+        char *fields[2] = {jobs[i]->name, jobs[i]->password};
+        for (int j = 0; j < 2; ++j)
+        {
+            int k = i * 2 + j;
+            lengths[k] = strlen(fields[j]);
+            bind[k].buffer_type = MYSQL_TYPE_STRING;
+            bind[k].buffer = fields[j];
+            bind[k].buffer_length = lengths[k];
+            bind[k].length = &lengths[k];
+        }
+    }
+    if (mysql_stmt_bind_param(stmt, bind) || mysql_stmt_execute(stmt))
+    {
+        LOG_ERROR("execute error:%s", mysql_stmt_error(stmt));
+        mysql_stmt_close(stmt);
+        stmt = NULL;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,77 @@
+#ifndef SQL_EXECUTOR_H
+#define SQL_EXECUTOR_H
+
+#include <pthread.h>
+#include <list>
+#include <vector>
+#include <mysql/mysql.h>
+#include "../lock/locker.h"
+#include "sql_connection_pool.h"
+
+using namespace std;
+
+// 一个交给数据库线程执行的任务
+// 任务的内存都归执行器：post复制一份，或者alloc取一个填好后submit；执行完(done回调之后)留着给下次复用
+struct sql_job
+{
+    enum KIND
+    {
+        INSERT_USER = 0,
+        KIND_COUNT
+    };
+    int kind;
+    char name[100];
+    char password[100];
+    bool ok;                      //执行结果，done回调时有效
+    void (*done)(sql_job *job);   //在数据库线程上调用，post提交的为NULL；回调返回后任务被回收，结果要在回调里取走
+    void *arg;
+    unsigned generation;          //提交者用来判断结果是否过期
+};
+
+// 专用的数据库线程，工作线程提交任务后立即返回，不在数据库往返上阻塞
+// 每个线程第一次执行任务时从连接池取一个连接一直占用，语句按需预处理后复用，参数绑定代替拼接SQL
+// 连接断了在执行失败时发现，原地重连后重新预处理
+// 注册的INSERT写后批量落库：凑满BATCH_ROWS行或者第一行等了FLUSH_MS毫秒，合成一条多行INSERT执行
+class sql_executor
+{
+public:
+    static sql_executor *GetInstance();
+
+    //启动thread_number个数据库线程，各自在第一批任务到来时从connPool取连接
+    bool init(connection_pool *connPool, int thread_number = 1);
+    //取一个任务，优先复用执行完回收的；填好后必须submit
+    sql_job *alloc();
+    //需要落库确认：job来自alloc，所在的批执行完后回调job->done，提交后不能再访问
+    void submit(sql_job *job);
+    //写后不管：复制一份排队，调用者立即可以重用job，失败只记日志
+    void post(const sql_job &job);
+    //退出前调用：等已提交的任务都执行完，最多timeout_ms毫秒；done回调会重新投递线程池，要在停线程池之前
+    bool drain(int timeout_ms);
+
+public:
+    static const int BATCH_ROWS = 64;
+    static const int FLUSH_MS = 5;
+
+private:
+    sql_executor();
+    ~sql_executor();
+    static void *worker(void *arg);
+    void run();
+    void flush(MYSQL *conn, MYSQL_STMT **stmts, vector<sql_job *> &batch);
+    bool insert_users(MYSQL *conn, MYSQL_STMT **stmts, sql_job **jobs, int rows);
+    void enqueue(sql_job *job);
+    void recycle(vector<sql_job *> &batch);
+
+private:
+    list<sql_job *> m_jobs;
+    list<sql_job *> m_freenodes; //取走任务后留下的链表节点，enqueue时复用
+    vector<sql_job *> m_spare;   //执行完的任务，下次alloc复用
+    locker m_lock;
+    cond m_jobcond;
+    int m_waiting;   //睡在m_jobcond上的线程数
+    int m_running;   //已经取走、还没执行完的批数
+    connection_pool *m_connPool;
+    int m_thread_number;
+};
+
+#endif
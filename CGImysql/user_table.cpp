@@ -0,0 +1,268 @@
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "user_table.h"
+
+user_table::user_table()
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        m_shards[i].table.store(new_slots(INITIAL_SLOTS));
+        m_shards[i].count = 0;
+    }
+}
+
+user_table::~user_table()
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        shard &s = m_shards[i];
+        user_slots *t = s.table.load();
+        for (size_t j = 0; j <= t->mask; ++j)
+            delete t->slots[j].load();
+        free_slots(t);
+        for (size_t j = 0; j < s.retired.size(); ++j)
+            free_slots(s.retired[j]);
+        for (size_t j = 0; j < s.replaced.size(); ++j)
+            delete s.replaced[j];
+    }
+}
+
+user_table *user_table::GetInstance()
+{
+    static user_table table;
+    return &table;
+}
+
+//FNV-1a再做一次murmur3的混合，高位选分片、低位选槽都要分布均匀
+uint64_t user_table::hash(const char *name, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+user_slots *user_table::new_slots(size_t size)
+{
+    user_slots *t = new user_slots;
+    t->mask = size - 1;
+    t->slots = new atomic<user_record *>[size];
+    for (size_t i = 0; i < size; ++i)
+        t->slots[i].store(NULL, memory_order_relaxed);
+    return t;
+}
+
+void user_table::free_slots(user_slots *t)
+{
+    delete[] t->slots;
+    delete t;
+}
+
+//装载不超过一半，探测序列上一定有空槽，碰到空槽就说明没有；撤销了的记录也当作没有
+const user_record *user_table::find(const char *name) const
+{
+    size_t len = strlen(name);
+    uint64_t h = hash(name, len);
+    const user_slots *t = shard_of(h).table.load(memory_order_acquire);
+    for (size_t i = h & t->mask;; i = (i + 1) & t->mask)
+    {
+        const user_record *r = t->slots[i].load(memory_order_acquire);
+        if (!r)
+            return NULL;
+        if (r->hash == h && r->name.size() == len && memcmp(r->name.data(), name, len) == 0)
+            return r->erased ? NULL : r;
+    }
+}
+
+bool user_table::check(const char *name, const char *password) const
+{
+    const user_record *r = find(name);
+    return r && r->password == password;
+}
+
+bool user_table::contains(const char *name) const
+{
+    return find(name) != NULL;
+}
+
+//调用时持有s.lock；新数组发布之前没有读者，直接搬指针
+void user_table::grow(shard &s, size_t size)
+{
+    user_slots *old = s.table.load(memory_order_relaxed);
+    if (size <= old->mask + 1)
+        return;
+    user_slots *t = new_slots(size);
+    for (size_t i = 0; i <= old->mask; ++i)
+    {
+        user_record *r = old->slots[i].load(memory_order_relaxed);
+        if (!r)
+            continue;
+        size_t j = r->hash & t->mask;
+        while (t->slots[j].load(memory_order_relaxed))
+            j = (j + 1) & t->mask;
+        t->slots[j].store(r, memory_order_relaxed);
+    }
+    s.table.store(t, memory_order_release);
+    s.retired.push_back(old);
+}
+
+//调用时持有s.lock；返回同名记录所在的槽，没有时返回探测序列上的第一个空槽
+atomic<user_record *> *user_table::probe(user_slots *t, uint64_t h, const char *name, size_t len)
+{
+    for (size_t i = h & t->mask;; i = (i + 1) & t->mask)
+    {
+        const user_record *r = t->slots[i].load(memory_order_relaxed);
+        if (!r || (r->hash == h && r->name.size() == len && memcmp(r->name.data(), name, len) == 0))
+            return &t->slots[i];
+    }
+}
+
+//调用时持有s.lock；新记录发布到同一个槽，旧记录可能还有读者，留到析构时释放
+void user_table::replace(shard &s, atomic<user_record *> *slot, user_record *r)
+{
+    s.replaced.push_back(slot->load(memory_order_relaxed));
+    slot->store(r, memory_order_release);
+}
+
+//调用时持有s.lock；撤销过的用户名重新注册时替换那条erased的记录，不占新槽
+bool user_table::insert_locked(shard &s, uint64_t h, const char *name, size_t len, const char *password)
+{
+    user_slots *t = s.table.load(memory_order_relaxed);
+    atomic<user_record *> *slot = probe(t, h, name, len);
+    const user_record *old = slot->load(memory_order_relaxed);
+    if (old && !old->erased)
+        return false;
+    if (!old && (s.count + 1) * 2 > t->mask + 1)
+    {
+        grow(s, (t->mask + 1) * 2);
+        slot = probe(s.table.load(memory_order_relaxed), h, name, len);
+    }
+    user_record *r = new user_record;
+    r->hash = h;
+    r->name.assign(name, len);
+    r->password = password;
+    r->erased = false;
+    if (old)
+    {
+        replace(s, slot, r);
+        return true;
+    }
+    slot->store(r, memory_order_release);
+    s.count++;
+    return true;
+}
+
+bool user_table::insert(const char *name, const char *password)
+{
+    size_t len = strlen(name);
+    uint64_t h = hash(name, len);
+    shard &s = shard_of(h);
+    s.lock.lock();
+    bool ok = insert_locked(s, h, name, len, password);
+    s.lock.unlock();
+    return ok;
+}
+
+bool user_table::erase(const char *name)
+{
+    size_t len = strlen(name);
+    uint64_t h = hash(name, len);
+    shard &s = shard_of(h);
+    s.lock.lock();
+    atomic<user_record *> *slot = probe(s.table.load(memory_order_relaxed), h, name, len);
+    const user_record *old = slot->load(memory_order_relaxed);
+    bool ok = old && !old->erased;
+    if (ok)
+    {
+        user_record *r = new user_record;
+        r->hash = h;
+        r->name = old->name;
+        r->erased = true;
+        replace(s, slot, r);
+    }
+    s.lock.unlock();
+    return ok;
+}
+
+size_t user_table::size() const
+{
+    size_t n = 0;
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        shard &s = const_cast<shard &>(m_shards[i]);
+        s.lock.lock();
+        n += s.count;
+        s.lock.unlock();
+    }
+    return n;
+}
+
+struct user_load_task
+{
+    user_table *table;
+    const vector<pair<const char *, const char *> > *rows;
+    size_t begin;
+    size_t end;
+};
+
+void *user_table::load_worker(void *arg)
+{
+    user_load_task *task = (user_load_task *)arg;
+    for (size_t i = task->begin; i < task->end; ++i)
+        task->table->insert((*task->rows)[i].first, (*task->rows)[i].second);
+    return NULL;
+}
+
+void user_table::load(const vector<pair<const char *, const char *> > &rows)
+{
+    size_t n = rows.size();
+    //按均匀分布估计每个分片的行数，留些余量，载入过程中基本不用再扩
+    size_t per_shard = n / SHARDS + n / SHARDS / 4 + 16;
+    size_t size = INITIAL_SLOTS;
+    while (size < per_shard * 2)
+        size *= 2;
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        m_shards[i].lock.lock();
+        grow(m_shards[i], size);
+        m_shards[i].lock.unlock();
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = n / PARALLEL_ROWS;
+    if (threads > MAX_LOAD_THREADS)
+        threads = MAX_LOAD_THREADS;
+    if (threads > cpus)
+        threads = cpus;
+    if (threads <= 1)
+    {
+        user_load_task task = {this, &rows, 0, n};
+        load_worker(&task);
+        return;
+    }
+
+    //各线程分到连续的一段行，落到哪个分片就锁哪个分片，64个分片上基本不冲突
+    pthread_t tids[MAX_LOAD_THREADS];
+    user_load_task tasks[MAX_LOAD_THREADS];
+    int started = 0;
+    for (int i = 0; i < threads; ++i)
+    {
+        user_load_task task = {this, &rows, n * i / threads, n * (i + 1) / threads};
+        tasks[i] = task;
+        if (pthread_create(&tids[started], NULL, load_worker, &tasks[i]) == 0)
+            started++;
+        else
+            load_worker(&tasks[i]);
+    }
+    for (int i = 0; i < started; ++i)
+        pthread_join(tids[i], NULL);
+}
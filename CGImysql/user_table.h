@@ -0,0 +1,86 @@
+#ifndef USER_TABLE_H
+#define USER_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../lock/locker.h"
+
+using namespace std;
+
+// 一个用户，插入后不再修改，被替换后也留到析构时才释放，读者拿到指针后随时可以读
+struct user_record
+{
+    uint64_t hash;
+    string name;
+    string password;
+    bool erased; //注册没能落库被撤销，槽仍然占着，查找时当作不存在
+};
+
+// 开放寻址(线性探测)的槽数组，槽中是原子指针，只会由NULL变成非NULL
+struct user_slots
+{
+    size_t mask;
+    atomic<user_record *> *slots;
+};
+
+// 内存中的用户表，代替原来一把锁保护的map<string, string>
+// 按哈希高位分成SHARDS个分片，每个分片一个开放寻址表：
+// > 登录查找不加锁，acquire读出当前槽数组，沿探测序列比较哈希和用户名
+// > 注册只锁所在分片，写好记录后release发布到空槽；装载超过一半时在锁内建两倍大的槽数组再整体发布
+// > 旧槽数组可能还有读者在用，挂在分片上到析构时才释放，总量不超过当前数组大小
+// > 撤销注册不清空槽(探测序列不能断)，而是发布一条标记为erased的记录，被替换的记录同样挂到析构时释放
+class user_table
+{
+public:
+    static user_table *GetInstance();
+
+    //用户名存在且密码相同，无锁
+    bool check(const char *name, const char *password) const;
+    bool contains(const char *name) const;
+    //用户名已存在时返回false，不覆盖
+    bool insert(const char *name, const char *password);
+    //撤销注册：INSERT没能落库时调用，之后同名可以重新注册；不存在时返回false
+    bool erase(const char *name);
+    //启动时批量载入：按总数一次把各分片扩到位，数据多时分给多个线程并行插入
+    void load(const vector<pair<const char *, const char *> > &rows);
+    size_t size() const;
+
+public:
+    static const int SHARDS = 64;
+    static const size_t INITIAL_SLOTS = 64;
+    static const size_t PARALLEL_ROWS = 100000; //超过这么多行才开线程并行载入
+    static const int MAX_LOAD_THREADS = 8;
+
+private:
+    struct alignas(64) shard
+    {
+        locker lock;
+        atomic<user_slots *> table;
+        size_t count; //lock保护，包括erased的记录
+        vector<user_slots *> retired;
+        vector<user_record *> replaced; //被erase或重新注册替换下来的记录
+    };
+
+    user_table();
+    ~user_table();
+    static uint64_t hash(const char *name, size_t len);
+    static user_slots *new_slots(size_t size);
+    static void free_slots(user_slots *t);
+    const user_record *find(const char *name) const;
+    shard &shard_of(uint64_t h) { return m_shards[h >> 58]; }
+    const shard &shard_of(uint64_t h) const { return m_shards[h >> 58]; }
+    void grow(shard &s, size_t size);
+    static atomic<user_record *> *probe(user_slots *t, uint64_t h, const char *name, size_t len);
+    void replace(shard &s, atomic<user_record *> *slot, user_record *r);
+    bool insert_locked(shard &s, uint64_t h, const char *name, size_t len, const char *password);
+    static void *load_worker(void *arg);
+
+private:
+    shard m_shards[SHARDS];
+};
+
+#endif
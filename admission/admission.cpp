@@ -0,0 +1,114 @@
+#include <time.h>
+#include "admission.h"
+
+admission::admission() : m_max_conn(0), m_rate(0), m_burst(0), m_next_sweep(0)
+{
+}
+
+admission::~admission()
+{
+}
+
+admission *admission::GetInstance()
+{
+    static admission instance;
+    return &instance;
+}
+
+void admission::init(int max_conn, int rate, int burst)
+{
+    m_max_conn = max_conn;
+    m_rate = rate;
+    m_burst = burst > 0 ? burst : rate;
+}
+
+int64_t admission::now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void admission::refill(client &c, int64_t now) const
+{
+    c.tokens += (now - c.last_ms) * m_rate / 1000.0;
+    if (c.tokens > m_burst)
+        c.tokens = m_burst;
+    c.last_ms = now;
+}
+
+bool admission::connect(uint32_t ip)
+{
+    if (m_max_conn <= 0 && m_rate <= 0)
+        return true;
+    shard &s = shard_of(ip);
+    s.lock.lock();
+    unordered_map<uint32_t, client>::iterator it = s.clients.find(ip);
+    if (it == s.clients.end())
+    {
+        client c = {0, (double)m_burst, now_ms()};
+        it = s.clients.insert(make_pair(ip, c)).first;
+    }
+    bool ok = m_max_conn <= 0 || it->second.conns < m_max_conn;
+    if (ok)
+        it->second.conns++;
+    s.lock.unlock();
+    return ok;
+}
+
+void admission::disconnect(uint32_t ip)
+{
+    if (m_max_conn <= 0 && m_rate <= 0)
+        return;
+    shard &s = shard_of(ip);
+    s.lock.lock();
+    unordered_map<uint32_t, client>::iterator it = s.clients.find(ip);
+    if (it != s.clients.end() && it->second.conns > 0)
+        it->second.conns--;
+    s.lock.unlock();
+}
+
+bool admission::request(uint32_t ip)
+{
+    if (m_rate <= 0)
+        return true;
+    shard &s = shard_of(ip);
+    s.lock.lock();
+    //连接建立时一定登记过；启动前就存在的连接不会有，按新IP处理
+    client &c = s.clients[ip];
+    if (c.last_ms == 0)
+    {
+        c.tokens = m_burst;
+        c.last_ms = now_ms();
+    }
+    else
+        refill(c, now_ms());
+    bool ok = c.tokens >= 1;
+    if (ok)
+        c.tokens -= 1;
+    s.lock.unlock();
+    return ok;
+}
+
+void admission::sweep()
+{
+    if (m_max_conn <= 0 && m_rate <= 0)
+        return;
+    shard &s = m_shards[m_next_sweep.fetch_add(1) % SHARDS];
+    int64_t now = now_ms();
+    s.lock.lock();
+    for (unordered_map<uint32_t, client>::iterator it = s.clients.begin(); it != s.clients.end();)
+    {
+        if (it->second.conns == 0)
+        {
+            refill(it->second, now);
+            if (it->second.tokens >= m_burst)
+            {
+                it = s.clients.erase(it);
+                continue;
+            }
+        }
+        ++it;
+    }
+    s.lock.unlock();
+}
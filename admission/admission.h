@@ -0,0 +1,66 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+#include <atomic>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+using namespace std;
+
+// 按客户端IP的准入控制，单例，在reactor线程上调用；TLS握手失败时握手线程调用disconnect
+// 每个IP记录当前连接数和一个令牌桶：连接数超过上限时拒绝新连接，令牌用完时拒绝请求，两种都返回429
+// 按IP分成SHARDS个分片，各自一把锁，多reactor时不同IP基本不会争同一把锁
+// 没有连接、令牌已经补满的IP由sweep定期删掉，表的大小只和最近活跃的IP数有关
+class admission
+{
+public:
+    static admission *GetInstance();
+
+    // max_conn为每个IP的连接数上限，rate为每秒补充的令牌数，burst为桶的容量；为0表示不限制
+    void init(int max_conn, int rate, int burst);
+
+    // 新连接：连接数没到上限时计入并返回true
+    bool connect(uint32_t ip);
+    // 连接关闭，和connect成功一一对应
+    void disconnect(uint32_t ip);
+    // 连接上读到一批请求，取一个令牌；取不到返回false
+    bool request(uint32_t ip);
+    // 清理一个分片中空闲的IP，reactor每个定时周期调用一次，轮流清理各分片
+    void sweep();
+
+public:
+    static const int SHARDS = 64;
+
+private:
+    struct client
+    {
+        int conns;
+        double tokens;
+        int64_t last_ms; //上次补充令牌的时间
+    };
+    struct shard
+    {
+        locker lock;
+        unordered_map<uint32_t, client> clients;
+    } __attribute__((aligned(64)));
+
+    admission();
+    ~admission();
+    //乘法散列取高6位，同一网段的IP也能分散开
+    shard &shard_of(uint32_t ip)
+    {
+        return m_shards[(ip * 2654435761u) >> 26];
+    }
+    void refill(client &c, int64_t now) const;
+    static int64_t now_ms();
+
+private:
+    shard m_shards[SHARDS];
+    int m_max_conn;
+    int m_rate;
+    int m_burst;
+    std::atomic<unsigned> m_next_sweep;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <atomic>
+#include "bench.h"
+#include "../log/log.h"
+
+//替换malloc统计分配次数，实际分配仍由glibc完成；free不计数
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t n, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void __libc_free(void *ptr);
+}
+
+static std::atomic<uint64_t> g_allocs(0);
+
+extern "C" void *malloc(size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+uint64_t bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t bench_allocs()
+{
+    return g_allocs.load(std::memory_order_relaxed);
+}
+
+bench_runner::bench_runner(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+        m_filters.push_back(argv[i]);
+}
+
+bool bench_runner::enabled(const string &name) const
+{
+    if (m_filters.empty())
+        return true;
+    for (size_t i = 0; i < m_filters.size(); ++i)
+    {
+        if (name.find(m_filters[i]) != string::npos)
+            return true;
+    }
+    return false;
+}
+
+void bench_runner::report(const string &name, uint64_t ops, uint64_t ns, uint64_t allocs)
+{
+    printf("%-44s %12llu ops %12.1f ns/op %10.3f allocs/op\n", name.c_str(), (unsigned long long)ops,
+           ops ? (double)ns / ops : 0.0, ops ? (double)allocs / ops : 0.0);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    //日志用例在子进程里各自初始化日志；其余用例关掉日志，不让LOG_*影响计时
+    Log::get_instance()->set_level(4);
+
+    bench_runner runner(argc, argv);
+    bench_http(runner);
+    bench_timer(runner);
+    bench_queue(runner);
+    bench_log(runner);
+    return 0;
+}
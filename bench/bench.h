@@ -0,0 +1,57 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// 组件级别的微基准：单独测解析、定时器、队列和日志，不经过整个服务器
+// 每个用例报告ns/op和allocs/op，allocs是整个进程的malloc/calloc/realloc次数(bench.cpp中替换了malloc)
+// 多线程用例的ns/op是墙钟时间除以所有线程的总操作数，即吞吐量的倒数
+
+uint64_t bench_now_ns();
+uint64_t bench_allocs();
+
+class bench_runner
+{
+public:
+    //参数是用例名的子串，只运行名字包含其中之一的用例；没有参数时全部运行
+    bench_runner(int argc, char *argv[]);
+
+    bool enabled(const string &name) const;
+    void report(const string &name, uint64_t ops, uint64_t ns, uint64_t allocs);
+
+    //单线程用例：body(n)执行n次操作，先用十分之一的次数预热(触发懒初始化、填满缓存)再计时
+    //body必须可以重复执行
+    template <typename F>
+    void run(const string &name, uint64_t ops, F body)
+    {
+        if (!enabled(name))
+            return;
+        body(ops / 10 + 1);
+        uint64_t allocs = bench_allocs();
+        uint64_t start = bench_now_ns();
+        body(ops);
+        uint64_t ns = bench_now_ns() - start;
+        report(name, ops, ns, bench_allocs() - allocs);
+    }
+
+private:
+    vector<string> m_filters;
+};
+
+//阻止编译器把没有用到的结果优化掉
+template <typename T>
+inline void bench_keep(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+void bench_http(bench_runner &runner);
+void bench_timer(bench_runner &runner);
+void bench_queue(bench_runner &runner);
+void bench_log(bench_runner &runner);
+
+#endif
@@ -0,0 +1,140 @@
+#include <string.h>
+#include <string>
+#include "bench.h"
+#include "../http/http_conn.h"
+#include "../CGImysql/user_table.h"
+
+// 请求解析和响应生成：走io_uring后端用的接口，数据由append_read放进读缓冲区，process解析并生成响应，
+// 再用sent、finish_write模拟发送完成，整个过程没有系统调用，测到的是工作线程上处理一个请求的开销
+
+//浏览器抓到的请求，头部数量和长度接近真实流量
+static const char browser_get[] =
+    "GET %s HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "\r\n";
+
+static const char login_post[] =
+    "POST /2CGISQL.cgi HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Length: 25\r\n"
+    "Origin: http://127.0.0.1:9006\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Referer: http://127.0.0.1:9006/1\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9\r\n"
+    "\r\n"
+    "user=name&password=passwd";
+
+//只记录连接想等的事件，不做任何I/O
+class bench_notifier : public conn_notifier
+{
+public:
+    bench_notifier() : last(-1) {}
+    void notify(int sockfd, int ev)
+    {
+        last = ev;
+    }
+    int last;
+};
+
+static string make_get(const char *url)
+{
+    char buf[sizeof(browser_get) + 256];
+    snprintf(buf, sizeof(buf), browser_get, url);
+    return buf;
+}
+
+//一次append_read读入data(可能包含多个流水线请求)，处理并"发送"完所有响应
+static void serve(http_conn &conn, bench_notifier &notifier, const string &data)
+{
+    conn.append_read(data.data(), data.size());
+    while (true)
+    {
+        conn.process();
+        if (notifier.last != EPOLLOUT)
+            break;
+        conn.sent(conn.bytes_left());
+        notifier.last = -1;
+        if (!conn.finish_write() || !conn.pipelined())
+            break;
+    }
+}
+
+static void bench_requests(bench_runner &runner, const string &name, const string &data, uint64_t ops)
+{
+    runner.run(name, ops, [&](uint64_t n) {
+        bench_notifier notifier;
+        http_conn *conn = new http_conn;
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        conn->init(100, addr, -1, &notifier);
+        for (uint64_t i = 0; i < n; ++i)
+            serve(*conn, notifier, data);
+        conn->close_conn();
+        delete conn;
+    });
+}
+
+void bench_http(bench_runner &runner)
+{
+    user_table::GetInstance()->insert("name", "passwd");
+
+    string header = make_get("/");
+    runner.run("http/find_byte_header_lf", 2000000, [&](uint64_t n) {
+        size_t total = 0;
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            //逐行找'\n'，和parse_line一样
+            const char *p = header.data();
+            size_t left = header.size();
+            while (left > 0)
+            {
+                size_t pos = http_find_byte(p, left, '\n');
+                if (pos == left)
+                    break;
+                p += pos + 1;
+                left -= pos + 1;
+                total++;
+            }
+        }
+        bench_keep(total);
+    });
+
+    //不存在的URL只有解析、路由和预先生成的404，最接近单纯的解析开销
+    bench_requests(runner, "http/process_get_404", make_get("/nope.html"), 500000);
+    bench_requests(runner, "http/process_get_cached_page", make_get("/"), 500000);
+    bench_requests(runner, "http/process_get_file", make_get("/xxx.jpg"), 200000);
+    bench_requests(runner, "http/process_post_login", login_post, 500000);
+
+    string pipeline;
+    for (int i = 0; i < 8; ++i)
+        pipeline += make_get("/");
+    runner.run("http/process_pipeline_8_per_read", 200000, [&](uint64_t n) {
+        bench_notifier notifier;
+        http_conn *conn = new http_conn;
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        conn->init(100, addr, -1, &notifier);
+        for (uint64_t i = 0; i < n / 8; ++i)
+            serve(*conn, notifier, pipeline);
+        conn->close_conn();
+        delete conn;
+    });
+}
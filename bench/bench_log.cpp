@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <atomic>
+#include "bench.h"
+#include "../log/log.h"
+
+// 日志：同步、异步、异步二进制三种模式下LOG_INFO的开销，参数和main.c中的配置一致
+// Log是单例，只能初始化一次，每种模式在一个子进程里跑，日志写到临时目录，跑完删掉
+
+struct log_arg
+{
+    uint64_t ops;
+    std::atomic<bool> *go;
+};
+
+static void *log_writer(void *arg)
+{
+    log_arg *a = (log_arg *)arg;
+    while (!a->go->load(std::memory_order_acquire))
+        sched_yield();
+    for (uint64_t i = 0; i < a->ops; ++i)
+        LOG_INFO("%s %s %d %lld", "GET", "/index.html", 200, (long long)i);
+    return NULL;
+}
+
+static void run_mode(bench_runner &runner, const char *dir, const char *mode, int queue, bool binary, int threads, uint64_t ops)
+{
+    char name[128];
+    snprintf(name, sizeof(name), "log/write_%s_t=%d", mode, threads);
+    if (!runner.enabled(name))
+        return;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+        return;
+    if (pid > 0)
+    {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    char file[256];
+    snprintf(file, sizeof(file), "%s/%s_t%d", dir, mode, threads);
+    if (!Log::get_instance()->init(file, 2000, 800000, queue, 100, binary))
+        _exit(1);
+    Log::get_instance()->set_level(0);
+
+    //每个线程先各写一行，创建好各自的缓冲区，格式串也在这里登记
+    std::atomic<bool> go(true);
+    log_arg warm = {1, &go};
+    log_writer(&warm);
+
+    go.store(false);
+    pthread_t tids[64];
+    log_arg arg = {ops / threads, &go};
+    for (int i = 0; i < threads; ++i)
+        pthread_create(&tids[i], NULL, log_writer, &arg);
+    uint64_t allocs = bench_allocs();
+    uint64_t start = bench_now_ns();
+    go.store(true, std::memory_order_release);
+    for (int i = 0; i < threads; ++i)
+        pthread_join(tids[i], NULL);
+    uint64_t ns = bench_now_ns() - start;
+    runner.report(name, arg.ops * threads, ns, bench_allocs() - allocs);
+    //exit让Log析构，异步模式下等后台线程刷完
+    exit(0);
+}
+
+static void remove_dir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+        return;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL)
+    {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            continue;
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        unlink(path);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+void bench_log(bench_runner &runner)
+{
+    char dir[] = "/tmp/microbench_log.XXXXXX";
+    if (!mkdtemp(dir))
+        return;
+    static const int threads[] = {1, 4};
+    for (int i = 0; i < 2; ++i)
+    {
+        run_mode(runner, dir, "sync", 0, false, threads[i], 1000000);
+        run_mode(runner, dir, "async", 8, false, threads[i], 1000000);
+        run_mode(runner, dir, "async_binary", 8, true, threads[i], 1000000);
+    }
+    remove_dir(dir);
+}
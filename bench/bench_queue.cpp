@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <sched.h>
+#include <pthread.h>
+#include <atomic>
+#include "bench.h"
+#include "../threadpool/threadpool.h"
+#include "../threadpool/mpmc_queue.h"
+#include "../log/block_queue.h"
+
+// 队列：线程池的三种请求队列在多个投递线程下的append吞吐，以及日志原来用的block_queue和无锁mpmc_queue的对比
+// 所有线程在同一个起跑标志上等，计时从放行开始，到最后一个元素被取走为止
+
+static const int POOL_THREADS = 4;
+
+static std::atomic<bool> g_go(false);
+static std::atomic<uint64_t> g_done(0);
+
+struct bench_task
+{
+    void process()
+    {
+        g_done.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+static void wait_go()
+{
+    while (!g_go.load(std::memory_order_acquire))
+        sched_yield();
+}
+
+struct producer_arg
+{
+    threadpool<bench_task> *pool;
+    bench_task *task;
+    int id;
+    uint64_t ops;
+};
+
+//队列满时让出CPU再试，和reactor在append失败时的处理不同，这里不能丢任务
+static void *pool_producer(void *arg)
+{
+    producer_arg *p = (producer_arg *)arg;
+    wait_go();
+    for (uint64_t i = 0; i < p->ops; ++i)
+    {
+        while (!p->pool->append(p->task, p->id + (int)i))
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void run_pool(threadpool<bench_task> *pool, bench_task *task, int producers, uint64_t ops)
+{
+    pthread_t tids[64];
+    producer_arg args[64];
+    g_go.store(false);
+    g_done.store(0);
+    for (int i = 0; i < producers; ++i)
+    {
+        producer_arg a = {pool, task, i, ops / producers};
+        args[i] = a;
+        pthread_create(&tids[i], NULL, pool_producer, &args[i]);
+    }
+    g_go.store(true, std::memory_order_release);
+    for (int i = 0; i < producers; ++i)
+        pthread_join(tids[i], NULL);
+    uint64_t total = ops / producers * producers;
+    while (g_done.load(std::memory_order_relaxed) < total)
+        sched_yield();
+}
+
+static void bench_pool(bench_runner &runner, const char *mode_name, int mode, int producers, uint64_t ops)
+{
+    char name[128];
+    snprintf(name, sizeof(name), "threadpool/append_%s_p=%d_w=%d", mode_name, producers, POOL_THREADS);
+    if (!runner.enabled(name))
+        return;
+    //工作线程不会退出，线程池析构后它们还会访问队列，所以不析构，留到进程退出
+    threadpool<bench_task> *pool = new threadpool<bench_task>(POOL_THREADS, 10000, mode);
+    bench_task task;
+    //预热：链表队列的空闲节点、工作线程第一次睡眠
+    run_pool(pool, &task, producers, ops / 10);
+    uint64_t allocs = bench_allocs();
+    uint64_t start = bench_now_ns();
+    run_pool(pool, &task, producers, ops);
+    uint64_t total = ops / producers * producers;
+    runner.report(name, total, bench_now_ns() - start, bench_allocs() - allocs);
+}
+
+struct queue_arg
+{
+    void *queue;
+    uint64_t ops;
+};
+
+static void *block_producer(void *arg)
+{
+    queue_arg *a = (queue_arg *)arg;
+    block_queue<long> *q = (block_queue<long> *)a->queue;
+    wait_go();
+    for (uint64_t i = 0; i < a->ops; ++i)
+    {
+        while (!q->push((long)i))
+            sched_yield();
+    }
+    return NULL;
+}
+
+//收到-1退出
+static void *block_consumer(void *arg)
+{
+    queue_arg *a = (queue_arg *)arg;
+    block_queue<long> *q = (block_queue<long> *)a->queue;
+    wait_go();
+    long item;
+    while (q->pop(item) && item >= 0)
+        g_done.fetch_add(1, std::memory_order_relaxed);
+    return NULL;
+}
+
+static void *mpmc_producer(void *arg)
+{
+    queue_arg *a = (queue_arg *)arg;
+    mpmc_queue<long> *q = (mpmc_queue<long> *)a->queue;
+    wait_go();
+    for (uint64_t i = 0; i < a->ops; ++i)
+    {
+        while (!q->push((long)i))
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void *mpmc_consumer(void *arg)
+{
+    queue_arg *a = (queue_arg *)arg;
+    mpmc_queue<long> *q = (mpmc_queue<long> *)a->queue;
+    wait_go();
+    long item;
+    while (true)
+    {
+        if (!q->pop(item))
+        {
+            sched_yield();
+            continue;
+        }
+        if (item < 0)
+            break;
+        g_done.fetch_add(1, std::memory_order_relaxed);
+    }
+    return NULL;
+}
+
+//生产者都结束后每个消费者一个-1
+template <typename Q>
+static void bench_pair(bench_runner &runner, const char *kind, Q *queue, void *(*producer)(void *), void *(*consumer)(void *),
+                       int producers, int consumers, uint64_t ops)
+{
+    char name[128];
+    snprintf(name, sizeof(name), "queue/%s_push_pop_p=%d_c=%d", kind, producers, consumers);
+    if (!runner.enabled(name))
+        return;
+    pthread_t ptids[64], ctids[64];
+    queue_arg arg = {queue, ops / producers};
+    g_go.store(false);
+    g_done.store(0);
+    for (int i = 0; i < producers; ++i)
+        pthread_create(&ptids[i], NULL, producer, &arg);
+    for (int i = 0; i < consumers; ++i)
+        pthread_create(&ctids[i], NULL, consumer, &arg);
+    uint64_t allocs = bench_allocs();
+    uint64_t start = bench_now_ns();
+    g_go.store(true, std::memory_order_release);
+    for (int i = 0; i < producers; ++i)
+        pthread_join(ptids[i], NULL);
+    for (int i = 0; i < consumers; ++i)
+    {
+        while (!queue->push(-1L))
+            sched_yield();
+    }
+    for (int i = 0; i < consumers; ++i)
+        pthread_join(ctids[i], NULL);
+    uint64_t ns = bench_now_ns() - start;
+    runner.report(name, arg.ops * producers, ns, bench_allocs() - allocs);
+}
+
+void bench_queue(bench_runner &runner)
+{
+    static const int producers[] = {1, 4};
+    for (int i = 0; i < 2; ++i)
+    {
+        bench_pool(runner, "list", threadpool<bench_task>::LIST_QUEUE, producers[i], 1000000);
+        bench_pool(runner, "lockfree", threadpool<bench_task>::LOCKFREE_QUEUE, producers[i], 1000000);
+        bench_pool(runner, "worksteal", threadpool<bench_task>::WORKSTEAL_QUEUE, producers[i], 1000000);
+    }
+
+    static const int pairs[][2] = {{1, 1}, {4, 4}};
+    for (int i = 0; i < 2; ++i)
+    {
+        block_queue<long> bq(1024);
+        bench_pair(runner, "block_queue", &bq, block_producer, block_consumer, pairs[i][0], pairs[i][1], 1000000);
+        mpmc_queue<long> mq(1024);
+        bench_pair(runner, "mpmc_queue", &mq, mpmc_producer, mpmc_consumer, pairs[i][0], pairs[i][1], 1000000);
+    }
+}
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <vector>
+#include "bench.h"
+#include "../timer/lst_timer.h"
+#include "../timer/time_wheel.h"
+
+// 定时器：升序链表和时间轮在1万到100万个定时器下的添加、调整和到期处理
+// 调整模拟活跃连接：随机挑一个定时器把到期时间推到最后，这是服务器上最频繁的操作
+
+static uint64_t g_expired = 0;
+
+static void count_expired(client_data *)
+{
+    g_expired++;
+}
+
+static string case_name(const char *kind, const char *op, size_t n)
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf), "timer/%s_%s_n=%zu", kind, op, n);
+    return buf;
+}
+
+//简单的xorshift，每次运行得到相同的序列
+static uint64_t next_random(uint64_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+//链表的节点由链表delete，每个用例重新new
+//按到期时间从大到小插入，每次都插在表头，建表是O(n)；测的add是追加到表尾，也是新连接的情形
+static void bench_list(bench_runner &runner, size_t n, uint64_t adjust_ops)
+{
+    time_t base = time(NULL) + 1000;
+    string add_name = case_name("list", "add", n);
+    if (runner.enabled(add_name))
+    {
+        sort_timer_lst lst;
+        for (size_t i = n; i > 0; --i)
+        {
+            util_timer *t = new util_timer;
+            t->expire = base + i;
+            t->cb_func = count_expired;
+            lst.add_timer(t);
+        }
+        //每个新定时器都比表中所有的晚，从表头走到表尾
+        uint64_t ops = adjust_ops;
+        vector<util_timer *> timers(ops);
+        for (uint64_t i = 0; i < ops; ++i)
+        {
+            timers[i] = new util_timer;
+            timers[i]->expire = base + n + 1 + i;
+            timers[i]->cb_func = count_expired;
+        }
+        uint64_t allocs = bench_allocs();
+        uint64_t start = bench_now_ns();
+        for (uint64_t i = 0; i < ops; ++i)
+            lst.add_timer(timers[i]);
+        runner.report(add_name, ops, bench_now_ns() - start, bench_allocs() - allocs);
+    }
+
+    string adjust_name = case_name("list", "adjust", n);
+    if (runner.enabled(adjust_name))
+    {
+        sort_timer_lst lst;
+        vector<util_timer *> timers(n);
+        for (size_t i = n; i > 0; --i)
+        {
+            util_timer *t = new util_timer;
+            t->expire = base + i;
+            t->cb_func = count_expired;
+            lst.add_timer(t);
+            timers[i - 1] = t;
+        }
+        time_t latest = base + n;
+        uint64_t state = 88172645463325252ULL;
+        uint64_t allocs = bench_allocs();
+        uint64_t start = bench_now_ns();
+        for (uint64_t i = 0; i < adjust_ops; ++i)
+        {
+            util_timer *t = timers[next_random(state) % n];
+            t->expire = ++latest;
+            lst.adjust_timer(t);
+        }
+        runner.report(adjust_name, adjust_ops, bench_now_ns() - start, bench_allocs() - allocs);
+    }
+
+    string tick_name = case_name("list", "tick_expire_all", n);
+    if (runner.enabled(tick_name))
+    {
+        sort_timer_lst lst;
+        //到期时间从大到小，每次插在表头
+        time_t past = time(NULL) - 1;
+        for (size_t i = 0; i < n; ++i)
+        {
+            util_timer *t = new util_timer;
+            t->expire = past - i;
+            t->cb_func = count_expired;
+            lst.add_timer(t);
+        }
+        uint64_t allocs = bench_allocs();
+        uint64_t start = bench_now_ns();
+        lst.tick();
+        runner.report(tick_name, n, bench_now_ns() - start, bench_allocs() - allocs);
+    }
+}
+
+//时间轮的节点嵌在client_data中，和服务器一样预先分配一整块
+static void bench_wheel(bench_runner &runner, size_t n, uint64_t ops)
+{
+    vector<client_data> users(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        users[i].timer.cb_func = count_expired;
+        users[i].timer.user_data = &users[i];
+    }
+
+    string add_name = case_name("wheel", "add_del", n);
+    if (runner.enabled(add_name))
+    {
+        time_wheel wheel;
+        time_t now = time_wheel::now_ms();
+        for (size_t i = 0; i < n; ++i)
+        {
+            users[i].timer.expire = now + 15000 + i % 1000;
+            wheel.add_timer(&users[i].timer);
+        }
+        //新连接：摘下一个旧的、挂上一个新的，表中始终有n个定时器
+        uint64_t state = 88172645463325252ULL;
+        uint64_t allocs = bench_allocs();
+        uint64_t start = bench_now_ns();
+        for (uint64_t i = 0; i < ops; ++i)
+        {
+            util_timer *t = &users[next_random(state) % n].timer;
+            wheel.del_timer(t);
+            t->expire = now + 15000 + i % 1000;
+            wheel.add_timer(t);
+        }
+        runner.report(add_name, ops, bench_now_ns() - start, bench_allocs() - allocs);
+        for (size_t i = 0; i < n; ++i)
+            wheel.del_timer(&users[i].timer);
+    }
+
+    string adjust_name = case_name("wheel", "adjust", n);
+    if (runner.enabled(adjust_name))
+    {
+        time_wheel wheel;
+        time_t now = time_wheel::now_ms();
+        for (size_t i = 0; i < n; ++i)
+        {
+            users[i].timer.expire = now + 15000 + i % 1000;
+            wheel.add_timer(&users[i].timer);
+        }
+        uint64_t state = 88172645463325252ULL;
+        uint64_t allocs = bench_allocs();
+        uint64_t start = bench_now_ns();
+        for (uint64_t i = 0; i < ops; ++i)
+        {
+            util_timer *t = &users[next_random(state) % n].timer;
+            t->expire = now + 15000 + (i & 8191);
+            wheel.adjust_timer(t);
+        }
+        runner.report(adjust_name, ops, bench_now_ns() - start, bench_allocs() - allocs);
+        for (size_t i = 0; i < n; ++i)
+            wheel.del_timer(&users[i].timer);
+    }
+
+    //1ms一个槽，所有定时器都挂在当前槽上，等过了一个槽再tick，一次处理完
+    string tick_name = case_name("wheel", "tick_expire_all", n);
+    if (runner.enabled(tick_name))
+    {
+        time_wheel wheel(1);
+        time_t now = time_wheel::now_ms();
+        for (size_t i = 0; i < n; ++i)
+        {
+            users[i].timer.expire = now;
+            wheel.add_timer(&users[i].timer);
+        }
+        usleep(3000);
+        uint64_t allocs = bench_allocs();
+        uint64_t start = bench_now_ns();
+        wheel.tick();
+        runner.report(tick_name, n, bench_now_ns() - start, bench_allocs() - allocs);
+    }
+}
+
+void bench_timer(bench_runner &runner)
+{
+    //链表的调整是O(n)，10万个定时器时只测少量操作
+    bench_list(runner, 10000, 20000);
+    bench_list(runner, 100000, 2000);
+    bench_wheel(runner, 10000, 2000000);
+    bench_wheel(runner, 100000, 2000000);
+    bench_wheel(runner, 1000000, 2000000);
+    bench_keep(g_expired);
+}
@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include "buffer_pool.h"
+
+buffer_pool::buffer_pool()
+{
+    for (int i = 0; i < NUM_CLASSES; ++i)
+    {
+        m_classes[i].head = NULL;
+        m_classes[i].count = 0;
+    }
+}
+
+buffer_pool::~buffer_pool()
+{
+    for (int i = 0; i < NUM_CLASSES; ++i)
+    {
+        free_node *node = m_classes[i].head;
+        while (node)
+        {
+            free_node *next = node->next;
+            free(node);
+            node = next;
+        }
+    }
+}
+
+buffer_pool *buffer_pool::GetInstance()
+{
+    static buffer_pool pool;
+    return &pool;
+}
+
+//size所在的档位，超过MAX_SIZE返回-1
+int buffer_pool::class_of(int size)
+{
+    int idx = 0;
+    int cap = MIN_SIZE;
+    while (cap < size)
+    {
+        cap <<= 1;
+        if (++idx >= NUM_CLASSES)
+            return -1;
+    }
+    return idx;
+}
+
+char *buffer_pool::acquire(int size, int &cap)
+{
+    int idx = class_of(size);
+    if (idx < 0)
+        return NULL;
+    cap = MIN_SIZE << idx;
+
+    size_class &sc = m_classes[idx];
+    sc.lock.lock();
+    free_node *node = sc.head;
+    if (node)
+    {
+        sc.head = node->next;
+        sc.count--;
+    }
+    sc.lock.unlock();
+
+    if (node)
+        return (char *)node;
+    return (char *)malloc(cap);
+}
+
+void buffer_pool::release(char *buf, int cap)
+{
+    if (!buf)
+        return;
+    int idx = class_of(cap);
+    size_class &sc = m_classes[idx];
+    sc.lock.lock();
+    if (sc.count < MAX_FREE)
+    {
+        free_node *node = (free_node *)buf;
+        node->next = sc.head;
+        sc.head = node;
+        sc.count++;
+        buf = NULL;
+    }
+    sc.lock.unlock();
+    free(buf);
+}
@@ -0,0 +1,44 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include "../lock/locker.h"
+
+// 按大小分档的缓冲区池，单例
+// 档位从MIN_SIZE开始逐档翻倍，到MAX_SIZE为止；每档一条空闲链表，链表节点就放在空闲缓冲区本身的开头
+// 连接只在活跃时从这里租用读写缓冲区，空闲(长连接等待下一个请求)时归还，常驻内存随活跃连接数而不是max_fd增长
+class buffer_pool
+{
+public:
+    static buffer_pool *GetInstance();
+
+    //租用一块不小于size的缓冲区，cap返回实际容量(所在档位的大小)，size超过MAX_SIZE时返回NULL
+    char *acquire(int size, int &cap);
+    //归还缓冲区，cap是acquire返回的容量，或者acquire时的size(按它找到的是同一档)
+    void release(char *buf, int cap);
+
+public:
+    static const int MIN_SIZE = 1024;
+    static const int NUM_CLASSES = 7;                            //1KB 2KB 4KB ... 64KB
+    static const int MAX_SIZE = MIN_SIZE << (NUM_CLASSES - 1);
+    static const int MAX_FREE = 1024;                            //每档最多缓存的空闲缓冲区，超过的直接free
+
+private:
+    buffer_pool();
+    ~buffer_pool();
+    static int class_of(int size);
+
+private:
+    struct free_node
+    {
+        free_node *next;
+    };
+    struct size_class
+    {
+        locker lock;
+        free_node *head;
+        int count;
+    };
+    size_class m_classes[NUM_CLASSES];
+};
+
+#endif
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+#include "content_cache.h"
+#ifdef CACHE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+static const char *encoding_name[content_entry::ENCODING_COUNT] = {NULL, "gzip", "br"};
+
+//Accept-Encoding中有没有接受token(或者*)，q=0表示明确拒绝
+static bool accepts(const char *value, const char *token)
+{
+    size_t tlen = strlen(token);
+    const char *p = value;
+    while (*p)
+    {
+        p += strspn(p, " \t,");
+        const char *name = p;
+        size_t n = strcspn(p, ";, \t");
+        const char *end = p + strcspn(p, ",");
+        bool exact = n == tlen && strncasecmp(name, token, tlen) == 0;
+        if (exact || (n == 1 && *name == '*'))
+        {
+            bool zero = false;
+            const char *semi = (const char *)memchr(name, ';', end - name);
+            if (semi)
+            {
+                const char *q = semi + 1;
+                q += strspn(q, " \t");
+                if ((q[0] == 'q' || q[0] == 'Q') && q[1] == '=')
+                    zero = strtod(q + 2, NULL) == 0;
+            }
+            if (exact)
+                return !zero;
+            if (!zero)
+                return true;
+        }
+        p = end;
+    }
+    return false;
+}
+
+const content_variant &content_entry::choose(const char *accept_encoding) const
+{
+    if (accept_encoding)
+    {
+        for (int i = BROTLI; i > IDENTITY; --i)
+        {
+            if (variants[i].data && accepts(accept_encoding, encoding_name[i]))
+                return variants[i];
+        }
+    }
+    return variants[IDENTITY];
+}
+
+content_cache::content_cache() : m_bytes(0)
+{
+}
+
+content_cache::~content_cache()
+{
+    m_lock.lock();
+    for (list<content_entry *>::iterator it = m_lru.begin(); it != m_lru.end(); ++it)
+        release(*it);
+    m_lru.clear();
+    m_entries.clear();
+    m_lock.unlock();
+}
+
+content_cache *content_cache::GetInstance()
+{
+    static content_cache cache;
+    return &cache;
+}
+
+time_t content_cache::now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//固定的响应头加正文拼成一块；encoding为NULL时是原文
+static bool make_variant(content_variant &v, const char *encoding, const char *body, size_t len, const content_entry *entry, const char *etag)
+{
+    //压缩版本的ETag："mtime-size-ino-gzip"
+    size_t elen = strlen(etag);
+    if (encoding)
+        snprintf(v.etag, sizeof(v.etag), "%.*s-%s\"", (int)elen - 1, etag, encoding);
+    else
+        snprintf(v.etag, sizeof(v.etag), "%s", etag);
+    char head[512];
+    int n = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\n%sContent-Length:%zu\r\n%s%s%s%sETag:%s\r\nLast-Modified:%s\r\nCache-Control:max-age=%d\r\n",
+                     encoding ? "" : "Accept-Ranges:bytes\r\n", len,
+                     encoding ? "Content-Encoding:" : "", encoding ? encoding : "", encoding ? "\r\n" : "",
+                     entry->vary ? "Vary:Accept-Encoding\r\n" : "", v.etag, entry->last_modified, file_cache::MAX_AGE);
+    v.data = (char *)malloc(n + len);
+    if (!v.data)
+        return false;
+    memcpy(v.data, head, n);
+    memcpy(v.data + n, body, len);
+    v.header_len = n;
+    v.len = n + len;
+    return true;
+}
+
+//gzip压缩，输出没有比原文小时返回0
+static size_t gzip_compress(const char *in, size_t len, char *out, size_t cap)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return 0;
+    zs.next_in = (Bytef *)in;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = cap;
+    int ret = deflate(&zs, Z_FINISH);
+    size_t n = zs.total_out;
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END && n < len ? n : 0;
+}
+
+//在锁外建好，原文和压缩版本各一块连续内存
+content_entry *content_cache::build(const char *url, const char *path, const file_entry *file)
+{
+    if (!file->address || file->st.st_size <= 0 || file->st.st_size > MAX_FILE)
+        return NULL;
+    const char *body = file->address;
+    size_t len = file->st.st_size;
+
+    content_entry *entry = new content_entry;
+    entry->url = url;
+    entry->path = path;
+    entry->st = file->st;
+    entry->checked = now_ms();
+    entry->ref.store(1);
+    memset(entry->variants, 0, sizeof(entry->variants));
+
+    size_t cap = compressBound(len) + 64;
+    char *packed = (char *)malloc(cap);
+    size_t sizes[content_entry::ENCODING_COUNT] = {len, 0, 0};
+    char *bodies[content_entry::ENCODING_COUNT] = {(char *)body, NULL, NULL};
+    if (packed)
+    {
+        sizes[content_entry::GZIP] = gzip_compress(body, len, packed, cap);
+        if (sizes[content_entry::GZIP])
+        {
+            bodies[content_entry::GZIP] = (char *)malloc(sizes[content_entry::GZIP]);
+            if (bodies[content_entry::GZIP])
+                memcpy(bodies[content_entry::GZIP], packed, sizes[content_entry::GZIP]);
+        }
+#ifdef CACHE_BROTLI
+        size_t out = cap;
+        if (BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len, (const uint8_t *)body, &out, (uint8_t *)packed) && out < len)
+        {
+            bodies[content_entry::BROTLI] = (char *)malloc(out);
+            if (bodies[content_entry::BROTLI])
+            {
+                memcpy(bodies[content_entry::BROTLI], packed, out);
+                sizes[content_entry::BROTLI] = out;
+            }
+        }
+#endif
+        free(packed);
+    }
+
+    entry->vary = bodies[content_entry::GZIP] || bodies[content_entry::BROTLI];
+    memcpy(entry->last_modified, file->last_modified, sizeof(entry->last_modified));
+    entry->bytes = sizeof(content_entry) + entry->url.size() + entry->path.size();
+    for (int i = 0; i < content_entry::ENCODING_COUNT; ++i)
+    {
+        if (!bodies[i])
+            continue;
+        if (make_variant(entry->variants[i], encoding_name[i], bodies[i], sizes[i], entry, file->etag))
+            entry->bytes += entry->variants[i].len;
+        if (i != content_entry::IDENTITY)
+            free(bodies[i]);
+    }
+    if (!entry->variants[content_entry::IDENTITY].data)
+    {
+        destroy(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+void content_cache::destroy(content_entry *entry)
+{
+    for (int i = 0; i < content_entry::ENCODING_COUNT; ++i)
+        free(entry->variants[i].data);
+    delete entry;
+}
+
+void content_cache::release(content_entry *entry)
+{
+    if (entry && entry->ref.fetch_sub(1) == 1)
+        destroy(entry);
+}
+
+//调用时持有m_lock
+void content_cache::evict(content_entry *entry)
+{
+    m_entries.erase(entry->url);
+    m_lru.erase(entry->lru);
+    m_bytes -= entry->bytes;
+    release(entry);
+}
+
+content_entry *content_cache::acquire(const char *url)
+{
+    static thread_local string key;
+    key.assign(url);
+
+    time_t now = now_ms();
+    bool need_check = false;
+
+    m_lock.lock();
+    unordered_map<string, content_entry *>::iterator it = m_entries.find(key);
+    if (it == m_entries.end())
+    {
+        m_lock.unlock();
+        return NULL;
+    }
+    content_entry *entry = it->second;
+    entry->ref.fetch_add(1);
+    m_lru.splice(m_lru.begin(), m_lru, entry->lru);
+    if (now - entry->checked >= REVALIDATE_MS)
+    {
+        entry->checked = now;
+        need_check = true;
+    }
+    m_lock.unlock();
+
+    if (!need_check)
+        return entry;
+    struct stat st;
+    if (stat(entry->path.c_str(), &st) == 0 && st.st_mtime == entry->st.st_mtime && st.st_size == entry->st.st_size && st.st_ino == entry->st.st_ino)
+        return entry;
+
+    //文件已经改变，摘掉旧条目，由调用者走完整流程重新建立
+    m_lock.lock();
+    it = m_entries.find(key);
+    if (it != m_entries.end() && it->second == entry)
+        evict(entry);
+    m_lock.unlock();
+    release(entry);
+    return NULL;
+}
+
+content_entry *content_cache::insert(const char *url, const char *path, const file_entry *file)
+{
+    content_entry *entry = build(url, path, file);
+    if (!entry || entry->bytes > MAX_BYTES)
+    {
+        if (entry)
+            destroy(entry);
+        return NULL;
+    }
+
+    m_lock.lock();
+    unordered_map<string, content_entry *>::iterator it = m_entries.find(entry->url);
+    if (it != m_entries.end())
+    {
+        //其他线程抢先建好了，用它的
+        content_entry *other = it->second;
+        other->ref.fetch_add(1);
+        m_lock.unlock();
+        destroy(entry);
+        return other;
+    }
+    while (m_bytes + entry->bytes > MAX_BYTES && !m_lru.empty())
+        evict(m_lru.back());
+    entry->ref.fetch_add(1);
+    m_lru.push_front(entry);
+    entry->lru = m_lru.begin();
+    m_entries[entry->url] = entry;
+    m_bytes += entry->bytes;
+    m_lock.unlock();
+    return entry;
+}
@@ -0,0 +1,87 @@
+#ifndef CONTENT_CACHE_H
+#define CONTENT_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include "../lock/locker.h"
+#include "file_cache.h"
+
+using namespace std;
+
+//#define CACHE_BROTLI //同时预压缩brotli版本，需要libbrotlienc，makefile里加上-lbrotlienc
+
+// 一个编码版本：data中先是固定的响应头(状态行、Content-Length、Content-Encoding等)，紧接着是正文
+// 发送时在两者之间插入每个响应自己的Date和Connection，三段一次sendmsg
+struct content_variant
+{
+    char *data;
+    int header_len;
+    int len;
+    char etag[56]; //每个编码版本的ETag不同，压缩版本在文件的ETag后加上编码名
+};
+
+// 一个被缓存的小文件的完整响应，建好后只读，多个连接共享
+// 引用计数：缓存本身持有一个引用，每个正在发送它的连接各持有一个
+struct content_entry
+{
+    enum
+    {
+        IDENTITY = 0,
+        GZIP,
+        BROTLI,
+        ENCODING_COUNT
+    };
+    string url;
+    string path;
+    struct stat st;
+    time_t checked;
+    content_variant variants[ENCODING_COUNT]; //压缩后没有变小的版本data为NULL
+    char last_modified[32];
+    bool vary;             //有压缩版本，响应(包括304)都要带Vary
+    size_t bytes;
+    atomic<int> ref;
+    list<content_entry *>::iterator lru;
+
+    //按Accept-Encoding选一个有的版本，没有可接受的压缩版本时用原文
+    const content_variant &choose(const char *accept_encoding) const;
+};
+
+// 按URL索引的热点内容缓存，单例，LRU淘汰，总内存不超过MAX_BYTES
+// 命中时不再拼接doc_root、查文件缓存、生成响应头；和文件缓存一样每REVALIDATE_MS毫秒stat一次
+class content_cache
+{
+public:
+    static content_cache *GetInstance();
+
+    //命中时增加引用并移到LRU头部，没有或者文件已经变化时返回NULL
+    content_entry *acquire(const char *url);
+    //用刚从文件缓存取到的小文件建立条目，返回增加了引用的条目；文件太大或者没有映射时返回NULL
+    content_entry *insert(const char *url, const char *path, const file_entry *file);
+    void release(content_entry *entry);
+
+public:
+    static const off_t MAX_FILE = 64 * 1024;              //超过该大小的文件不进缓存
+    static const size_t MAX_BYTES = 32 * 1024 * 1024;     //所有条目占用内存的上限
+    static const int REVALIDATE_MS = file_cache::REVALIDATE_MS;
+
+private:
+    content_cache();
+    ~content_cache();
+    void evict(content_entry *entry);
+    static content_entry *build(const char *url, const char *path, const file_entry *file);
+    static void destroy(content_entry *entry);
+    static time_t now_ms();
+
+private:
+    unordered_map<string, content_entry *> m_entries;
+    list<content_entry *> m_lru; //头部最近使用
+    size_t m_bytes;
+    locker m_lock;
+};
+
+#endif
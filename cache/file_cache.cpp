@@ -0,0 +1,145 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include "file_cache.h"
+
+file_cache::file_cache()
+{
+}
+
+file_cache::~file_cache()
+{
+    m_lock.lock();
+    for (unordered_map<string, file_entry *>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+        release(it->second);
+    m_entries.clear();
+    m_lock.unlock();
+}
+
+file_cache *file_cache::GetInstance()
+{
+    static file_cache cache;
+    return &cache;
+}
+
+time_t file_cache::now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//打开文件，小文件做只读映射，引用计数为1(调用者持有)
+file_entry *file_cache::load(const char *path, const struct stat &st)
+{
+    file_entry *entry = new file_entry;
+    entry->path = path;
+    entry->st = st;
+    entry->fd = -1;
+    entry->address = NULL;
+    entry->ref.store(1);
+    entry->checked = now_ms();
+    //条件GET用的校验值在加载时生成一次，之后的请求不必stat
+    snprintf(entry->etag, sizeof(entry->etag), "\"%lx-%llx-%lx\"", (unsigned long)st.st_mtime, (unsigned long long)st.st_size, (unsigned long)st.st_ino);
+    struct tm tm;
+    gmtime_r(&st.st_mtime, &tm);
+    strftime(entry->last_modified, sizeof(entry->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    if ((st.st_mode & S_IROTH) && !S_ISDIR(st.st_mode))
+    {
+        entry->fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (entry->fd != -1 && st.st_size > 0 && st.st_size <= MMAP_LIMIT)
+        {
+            void *addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, entry->fd, 0);
+            if (addr != MAP_FAILED)
+                entry->address = (char *)addr;
+        }
+    }
+    return entry;
+}
+
+void file_cache::destroy(file_entry *entry)
+{
+    if (entry->address)
+        munmap(entry->address, entry->st.st_size);
+    if (entry->fd != -1)
+        close(entry->fd);
+    delete entry;
+}
+
+void file_cache::release(file_entry *entry)
+{
+    if (entry && entry->ref.fetch_sub(1) == 1)
+        destroy(entry);
+}
+
+file_entry *file_cache::acquire(const char *path)
+{
+    //每个线程复用一个key，查找时不必每次为路径分配std::string
+    static thread_local string key;
+    key.assign(path);
+
+    time_t now = now_ms();
+    file_entry *entry = NULL;
+    bool need_check = false;
+
+    m_lock.lock();
+    unordered_map<string, file_entry *>::iterator it = m_entries.find(key);
+    if (it != m_entries.end())
+    {
+        entry = it->second;
+        entry->ref.fetch_add(1);
+        //到了校验时间，由本线程负责stat，其他线程继续使用现有条目
+        if (now - entry->checked >= REVALIDATE_MS)
+        {
+            entry->checked = now;
+            need_check = true;
+        }
+    }
+    m_lock.unlock();
+
+    struct stat st;
+    if (entry)
+    {
+        if (!need_check)
+            return entry;
+        if (stat(path, &st) == 0 && st.st_mtime == entry->st.st_mtime && st.st_size == entry->st.st_size && st.st_ino == entry->st.st_ino)
+            return entry;
+
+        //文件已经改变或者被删除，从缓存中摘掉旧条目，正在发送它的连接不受影响
+        m_lock.lock();
+        it = m_entries.find(key);
+        if (it != m_entries.end() && it->second == entry)
+        {
+            m_entries.erase(it);
+            release(entry);
+        }
+        m_lock.unlock();
+        release(entry);
+    }
+
+    if (stat(path, &st) < 0)
+        return NULL;
+
+    entry = load(path, st);
+
+    m_lock.lock();
+    it = m_entries.find(key);
+    if (it != m_entries.end())
+    {
+        //其他线程抢先加载了，用它的
+        file_entry *other = it->second;
+        other->ref.fetch_add(1);
+        m_lock.unlock();
+        destroy(entry);
+        return other;
+    }
+    if (m_entries.size() < MAX_ENTRIES)
+    {
+        entry->ref.fetch_add(1);
+        m_entries[key] = entry;
+    }
+    m_lock.unlock();
+    return entry;
+}
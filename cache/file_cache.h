@@ -0,0 +1,60 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+using namespace std;
+
+// 一个被缓存的静态文件
+// fd一直保持打开，大文件用sendfile直接从fd发送；小文件额外保留一份只读映射，用writev发送
+// 引用计数：缓存本身持有一个引用，每个正在发送该文件的连接各持有一个，减到0时关闭fd并解除映射
+struct file_entry
+{
+    string path;
+    struct stat st;
+    int fd;                //只读打开的文件，-1表示无法打开或是目录
+    char *address;         //小文件的只读映射，大文件为NULL
+    atomic<int> ref;
+    time_t checked;        //上次用stat校验的时间，毫秒
+    char etag[48];         //由mtime、大小和inode生成的强校验值，带引号
+    char last_modified[32]; //mtime的HTTP日期
+};
+
+// 按真实路径索引的共享文件缓存，单例
+// 命中时不再stat、open、mmap、close，响应发完也不再munmap
+// 每个条目最多每REVALIDATE_MS毫秒stat一次，发现mtime、大小或inode变化就换成新条目
+class file_cache
+{
+public:
+    static file_cache *GetInstance();
+
+    //获取path对应的条目并增加引用，文件不存在时返回NULL
+    file_entry *acquire(const char *path);
+    //连接发送完毕后释放引用
+    void release(file_entry *entry);
+
+public:
+    static const off_t MMAP_LIMIT = 256 * 1024; //不超过该大小的文件做映射，超过的用sendfile
+    static const int REVALIDATE_MS = 1000;      //条目校验间隔
+    static const size_t MAX_ENTRIES = 4096;     //缓存的条目上限，超过后的文件不进缓存，用完即关
+    static const int MAX_AGE = 3600;            //响应中Cache-Control的max-age，秒
+
+private:
+    file_cache();
+    ~file_cache();
+    file_entry *load(const char *path, const struct stat &st);
+    static void destroy(file_entry *entry);
+    static time_t now_ms();
+
+private:
+    unordered_map<string, file_entry *> m_entries;
+    locker m_lock;
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "config.h"
+#include "../log/log.h"
+
+static int cpu_count()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+//默认的连接表大小：当前的软限制，最多DEFAULT_MAX_FD；http_conn和client_data都按它预先分配，不跟着硬限制涨到上百万
+static int default_max_fd()
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur > (rlim_t)config::DEFAULT_MAX_FD)
+        return config::DEFAULT_MAX_FD;
+    return (int)rl.rlim_cur;
+}
+
+//显式配置的max_fd超过软限制时，把软限制提到max_fd，不超过硬限制
+static void raise_file_limit(int want)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur >= (rlim_t)want)
+        return;
+    struct rlimit raised = rl;
+    raised.rlim_cur = rl.rlim_max < (rlim_t)want ? rl.rlim_max : (rlim_t)want;
+    if (raised.rlim_cur > rl.rlim_cur && setrlimit(RLIMIT_NOFILE, &raised) == 0)
+        rl = raised;
+    if (rl.rlim_cur < (rlim_t)want)
+        fprintf(stderr, "max_fd %d exceeds RLIMIT_NOFILE %llu, connections beyond it will fail to accept\n", want, (unsigned long long)rl.rlim_cur);
+}
+
+config::config()
+{
+    //单核机器上也留两个工作线程，一个线程阻塞在发送大文件时另一个还能处理请求
+    int cores = cpu_count();
+    if (cores < 2)
+        cores = 2;
+    port = 9006;
+    reactors = 1;
+    uring = false;
+    listen_et = false;
+    conn_et = false;
+    log_mode = "sync";
+    log_file = "ServerLog";
+    log_level = 0;
+    queue = "list";
+    affinity = "auto";
+    threads = cores;
+    threads_max = 0;
+    max_requests = 10000;
+    write_mode = "worker";
+    register_mode = "writebehind";
+    shed_queue_ms = 200;
+    max_fd = default_max_fd();
+    idle_timeout = 15;
+    drain_timeout = 10;
+    db_host = "localhost";
+    db_user = "root";
+    db_password = "root";
+    db_name = "qgydb";
+    db_port = 3306;
+    db_conns = cores < 8 ? cores : 8;
+    db_conns_max = 0;
+    db_ping_interval = 30;
+    db_wait_timeout = 1000;
+    db_threads = 1;
+    client_max_conn = 1024;
+    client_rate = 20000;
+    client_burst = 20000;
+    tls_port = 0;
+    tls_cert = "server.crt";
+    tls_key = "server.key";
+    //每4个核一个握手线程：完整握手的开销主要是一次签名，ticket恢复的握手更轻
+    tls_threads = cores / 4 > 0 ? cores / 4 : 1;
+}
+
+void config::options(vector<option> &out)
+{
+    option table[] = {
+        {"port", &port, NULL, NULL, NULL, "监听端口"},
+        {"reactors", &reactors, NULL, NULL, NULL, "事件循环数，0为每个CPU核一个"},
+        {"uring", NULL, &uring, NULL, NULL, "事件循环使用io_uring"},
+        {"listen_et", NULL, &listen_et, NULL, NULL, "监听socket边缘触发"},
+        {"conn_et", NULL, &conn_et, NULL, NULL, "连接socket边缘触发"},
+        {"log", NULL, NULL, &log_mode, "sync|async|binary", "日志写入方式"},
+        {"log_file", NULL, NULL, &log_file, NULL, "日志文件名"},
+        {"log_level", &log_level, NULL, NULL, NULL, "最低日志级别，0为DEBUG、3为ERROR"},
+        {"queue", NULL, NULL, &queue, "list|lockfree|worksteal", "线程池请求队列"},
+        {"affinity", NULL, NULL, &affinity, "auto|none|cpu|numa", "工作线程绑核"},
+        {"threads", &threads, NULL, NULL, NULL, "工作线程数，默认为CPU核数，至少2"},
+        {"threads_max", &threads_max, NULL, NULL, NULL, "大于threads时自适应增减工作线程"},
+        {"max_requests", &max_requests, NULL, NULL, NULL, "线程池队列长度"},
+        {"write_mode", NULL, NULL, &write_mode, "worker|reactor", "响应由工作线程直接发送还是交给reactor"},
+        {"register_mode", NULL, NULL, &register_mode, "writebehind|durable", "注册写后批量落库，或者等落库后再返回"},
+        {"shed_queue_ms", &shed_queue_ms, NULL, NULL, NULL, "请求排队超过该时间直接回503(毫秒)，0为不丢"},
+        {"max_fd", &max_fd, NULL, NULL, NULL, "连接表大小，默认为RLIMIT_NOFILE软限制，最多65536"},
+        {"idle_timeout", &idle_timeout, NULL, NULL, NULL, "空闲连接超时(秒)"},
+        {"drain_timeout", &drain_timeout, NULL, NULL, NULL, "SIGTERM后等在途请求完成的时间(秒)，0为立即退出"},
+        {"db_host", NULL, NULL, &db_host, NULL, "MySQL地址"},
+        {"db_port", &db_port, NULL, NULL, NULL, "MySQL端口"},
+        {"db_user", NULL, NULL, &db_user, NULL, "MySQL用户名"},
+        {"db_password", NULL, NULL, &db_password, NULL, "MySQL密码"},
+        {"db_name", NULL, NULL, &db_name, NULL, "数据库名"},
+        {"db_conns", &db_conns, NULL, NULL, NULL, "数据库连接池最少保持的连接数"},
+        {"db_conns_max", &db_conns_max, NULL, NULL, NULL, "等待连接时最多扩到的连接数，0为db_conns的2倍"},
+        {"db_ping_interval", &db_ping_interval, NULL, NULL, NULL, "空闲连接多久没用就ping一次(秒)"},
+        {"db_wait_timeout", &db_wait_timeout, NULL, NULL, NULL, "取数据库连接最多等待的时间(毫秒)"},
+        {"db_threads", &db_threads, NULL, NULL, NULL, "数据库线程数"},
+        {"client_max_conn", &client_max_conn, NULL, NULL, NULL, "每个客户端IP的连接数上限，0为不限"},
+        {"client_rate", &client_rate, NULL, NULL, NULL, "每个客户端IP每秒的请求数，0为不限"},
+        {"client_burst", &client_burst, NULL, NULL, NULL, "每个客户端IP的突发请求数"},
+        {"tls_port", &tls_port, NULL, NULL, NULL, "TLS监听端口，0为不开"},
+        {"tls_cert", NULL, NULL, &tls_cert, NULL, "TLS证书链(PEM)"},
+        {"tls_key", NULL, NULL, &tls_key, NULL, "TLS私钥(PEM)"},
+        {"tls_threads", &tls_threads, NULL, NULL, NULL, "TLS握手线程数"},
+    };
+    out.assign(table, table + sizeof(table) / sizeof(table[0]));
+}
+
+bool config::parse_int(const string &value, int &out)
+{
+    char *end = NULL;
+    errno = 0;
+    long v = strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || errno != 0 || v < 0 || v > 0x7fffffff)
+        return false;
+    out = v;
+    return true;
+}
+
+bool config::parse_bool(const string &value, bool &out)
+{
+    if (value == "1" || value == "true" || value == "on" || value == "yes")
+        out = true;
+    else if (value == "0" || value == "false" || value == "off" || value == "no")
+        out = false;
+    else
+        return false;
+    return true;
+}
+
+bool config::in_choices(const string &value, const char *choices)
+{
+    const char *p = choices;
+    while (*p)
+    {
+        const char *end = strchr(p, '|');
+        size_t len = end ? end - p : strlen(p);
+        if (value.size() == len && value.compare(0, len, p, len) == 0)
+            return true;
+        if (!end)
+            break;
+        p = end + 1;
+    }
+    return false;
+}
+
+bool config::set(const string &key, const string &value)
+{
+    vector<option> table;
+    options(table);
+    for (size_t i = 0; i < table.size(); ++i)
+    {
+        const option &o = table[i];
+        if (key != o.name)
+            continue;
+        if (o.int_value)
+            return parse_int(value, *o.int_value);
+        if (o.bool_value)
+            return parse_bool(value, *o.bool_value);
+        if (o.choices && !in_choices(value, o.choices))
+            return false;
+        *o.string_value = value;
+        return true;
+    }
+    return false;
+}
+
+static string trim(const string &s)
+{
+    size_t begin = s.find_first_not_of(" \t\r\n");
+    if (begin == string::npos)
+        return "";
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return s.substr(begin, end - begin + 1);
+}
+
+bool config::load(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "cannot open config file %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    char buf[1024];
+    int lineno = 0;
+    bool ok = true;
+    while (fgets(buf, sizeof(buf), fp))
+    {
+        ++lineno;
+        string line = buf;
+        size_t hash = line.find('#');
+        if (hash != string::npos)
+            line.erase(hash);
+        line = trim(line);
+        if (line.empty())
+            continue;
+        size_t eq = line.find('=');
+        if (eq == string::npos || !set(trim(line.substr(0, eq)), trim(line.substr(eq + 1))))
+        {
+            fprintf(stderr, "%s:%d: invalid setting: %s\n", path, lineno, line.c_str());
+            ok = false;
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+// 兼容原来的用法：第一个不以-开头的参数是端口
+bool config::parse(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+        {
+            usage(argv[0]);
+            return false;
+        }
+        if (arg == "-f" || arg == "-p")
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "option %s needs a value\n", arg.c_str());
+                usage(argv[0]);
+                return false;
+            }
+            bool ok = arg == "-f" ? load(argv[++i]) : set("port", argv[++i]);
+            if (!ok)
+            {
+                if (arg == "-p")
+                    fprintf(stderr, "invalid port: %s\n", argv[i]);
+                return false;
+            }
+            continue;
+        }
+        if (arg.compare(0, 2, "--") == 0)
+        {
+            string key = arg.substr(2), value;
+            size_t eq = key.find('=');
+            if (eq != string::npos)
+            {
+                value = key.substr(eq + 1);
+                key.erase(eq);
+            }
+            else if (i + 1 < argc && argv[i + 1][0] != '-')
+                value = argv[++i];
+            else
+                value = "true"; //不带值的--uring等同于--uring=true
+            if (!set(key, value))
+            {
+                fprintf(stderr, "invalid option: --%s %s\n", key.c_str(), value.c_str());
+                usage(argv[0]);
+                return false;
+            }
+            continue;
+        }
+        if (arg[0] != '-' && set("port", arg))
+            continue;
+        fprintf(stderr, "unknown argument: %s\n", arg.c_str());
+        usage(argv[0]);
+        return false;
+    }
+
+    if (port <= 0 || port > 65535 || threads <= 0 || max_requests <= 0 || db_conns <= 0 || db_threads <= 0 ||
+        db_ping_interval <= 0 || db_wait_timeout <= 0 || idle_timeout <= 0 || max_fd < 64 || max_fd > MAX_FD_LIMIT)
+    {
+        fprintf(stderr, "%s\n", "port, threads, max_requests, db_conns, db_threads, db_ping_interval, db_wait_timeout, idle_timeout must be positive, max_fd in [64, 1048576]");
+        return false;
+    }
+    //默认值不超过软限制，只有显式配置得更大时才需要提升
+    raise_file_limit(max_fd);
+    if (db_conns_max == 0)
+        db_conns_max = db_conns * 2;
+    //数据库线程各自长期占用一个连接，上限至少还要留一个给其他地方用
+    if (db_conns_max < db_conns || db_conns_max <= db_threads)
+    {
+        fprintf(stderr, "%s\n", "db_conns_max must be at least db_conns and greater than db_threads");
+        return false;
+    }
+    if (tls_port > 65535 || tls_port == port || (tls_port > 0 && tls_threads <= 0))
+    {
+        fprintf(stderr, "%s\n", "tls_port must differ from port and be at most 65535, tls_threads must be positive");
+        return false;
+    }
+    return true;
+}
+
+void config::usage(const char *prog) const
+{
+    fprintf(stderr, "usage: %s [port] [-p port] [-f config_file] [--key=value]...\n", prog);
+    vector<option> table;
+    const_cast<config *>(this)->options(table);
+    for (size_t i = 0; i < table.size(); ++i)
+    {
+        const option &o = table[i];
+        string value;
+        if (o.int_value)
+            value = to_string(*o.int_value);
+        else if (o.bool_value)
+            value = *o.bool_value ? "true" : "false";
+        else
+            value = o.choices ? string(o.choices) + ", " + *o.string_value : *o.string_value;
+        if (o.string_value == &db_password)
+            value = "***";
+        fprintf(stderr, "  --%-16s %s (%s)\n", o.name, o.help, value.c_str());
+    }
+}
+
+void config::log() const
+{
+    vector<option> table;
+    const_cast<config *>(this)->options(table);
+    for (size_t i = 0; i < table.size(); ++i)
+    {
+        const option &o = table[i];
+        if (o.int_value)
+            LOG_INFO("config %s = %d", o.name, *o.int_value);
+        else if (o.bool_value)
+            LOG_INFO("config %s = %s", o.name, *o.bool_value ? "true" : "false");
+        else if (o.string_value != &db_password)
+            LOG_INFO("config %s = %s", o.name, o.string_value->c_str());
+    }
+}
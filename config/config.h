@@ -0,0 +1,85 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// 运行时配置，代替原来散在main.c、http_conn.cpp、reactor.cpp中的#define
+// 取值顺序：默认值 < -f指定的配置文件 < 命令行，按出现的先后解析，后面的覆盖前面的
+// 默认值按机器计算：工作线程数取CPU核数，max_fd取RLIMIT_NOFILE的软限制，最多DEFAULT_MAX_FD；显式配置更大的max_fd时把软限制提上去
+// 配置文件每行一个key = value，#开头的是注释；命令行写成--key=value或--key value
+class config
+{
+public:
+    config();
+
+    // 解析命令行，出错时打印原因和用法，返回false
+    bool parse(int argc, char *argv[]);
+    // 读入一个配置文件
+    bool load(const char *path);
+    // 设置一项，key不存在或取值不合法时返回false
+    bool set(const string &key, const string &value);
+    void usage(const char *prog) const;
+    // 把生效的配置写进日志
+    void log() const;
+
+public:
+    int port;
+    int reactors;         //事件循环数，0表示每个CPU核一个
+    bool uring;           //事件循环使用io_uring，内核不支持时退回epoll
+    bool listen_et;       //监听socket边缘触发，一次accept到没有新连接为止
+    bool conn_et;         //连接socket边缘触发，一次读到EAGAIN为止
+    string log_mode;      //sync、async或binary
+    string log_file;
+    int log_level;        //低于该级别的日志不写，0为DEBUG
+    string queue;         //线程池请求队列：list、lockfree或worksteal
+    string affinity;      //工作线程绑核：none、cpu或numa，auto表示worksteal时绑CPU否则不绑
+    int threads;          //工作线程数
+    int threads_max;      //大于threads时按队列深度在两者之间自动增减线程，list和lockfree队列有效
+    int max_requests;     //线程池队列最多等待的请求数
+    string write_mode;    //响应由谁发送：worker(工作线程直接发)或reactor
+    string register_mode; //注册什么时候返回：writebehind(进了内存用户表)或durable(落库之后)
+    int shed_queue_ms;    //请求在线程池队列中等待超过该毫秒数时直接回503，0为不丢
+    int max_fd;           //连接表的大小，fd不小于它的连接直接拒绝
+    int idle_timeout;     //连接空闲多少秒后关闭
+    int drain_timeout;    //SIGTERM后最多等多少秒让在途请求完成
+    string db_host;
+    string db_user;
+    string db_password;
+    string db_name;
+    int db_port;
+    int db_conns;         //数据库连接池最少保持的连接数
+    int db_conns_max;     //等待连接时最多扩到的连接数，0为db_conns的2倍
+    int db_ping_interval; //空闲连接多少秒没用过就ping一次，ping不通的重连
+    int db_wait_timeout;  //取连接最多等待的毫秒数，超时时这次数据库操作失败
+    int db_threads;       //执行注册INSERT的数据库线程数
+    int client_max_conn;  //每个客户端IP的连接数上限，0为不限
+    int client_rate;      //每个客户端IP每秒的请求令牌数，0为不限
+    int client_burst;     //令牌桶容量
+    int tls_port;         //TLS监听端口，0为不开
+    string tls_cert;      //PEM格式的证书链
+    string tls_key;       //PEM格式的私钥
+    int tls_threads;      //TLS握手线程数
+
+    static const int MAX_FD_LIMIT = 1 << 20; //http_conn数组按max_fd预先分配，避免误配成几GB
+    static const int DEFAULT_MAX_FD = 65536; //没有配置max_fd时的上限，硬限制可能高达1<<20
+
+private:
+    struct option
+    {
+        const char *name;
+        int *int_value;
+        bool *bool_value;
+        string *string_value;
+        const char *choices; //字符串取值的可选项，用'|'分隔，NULL为任意
+        const char *help;
+    };
+    void options(vector<option> &out);
+    static bool parse_int(const string &value, int &out);
+    static bool parse_bool(const string &value, bool &out);
+    static bool in_choices(const string &value, const char *choices);
+};
+
+#endif
@@ -1,8 +1,11 @@
 #include "http_conn.h"
 #include "../log/log.h"
-#include <map>
+#include "../CGImysql/user_table.h"
+#include "../threadpool/threadpool.h"
+#include "http_router.h"
 #include <mysql/mysql.h>
 #include <fstream>
+#include <sys/sendfile.h>
 
 // 两种epoll_wait的触发模式
 // LT：对于监测的EPOLLIN事件：只要监测的socket上有未读完的数据，EPOLLIN就会一直触发
@@ -16,14 +19,21 @@
 //      写监听事件或者写缓冲区从满到不满就会触发一次）
 //     
 // 
-//#define connfdET //边缘触发非阻塞
-#define connfdLT //水平触发阻塞
+// 连接socket用哪种由配置项conn_et决定，见http_conn::m_conn_et；监听socket由listen_et决定，见reactor::m_listen_et
 
-//#define listenfdET //边缘触发非阻塞
-#define listenfdLT //水平触发阻塞
+// 响应由谁发送，配置项write_mode，见http_conn::m_worker_write：
+// worker：工作线程生成响应后直接write，发不完(EAGAIN或发满SEND_WINDOW)才注册EPOLLOUT交给reactor，
+//         小响应省掉一次epoll_ctl和一次epoll_wait唤醒；流水线上还有请求时在工作线程上接着处理
+// reactor：工作线程只注册EPOLLOUT，由reactor在下一次epoll_wait返回后发送
+// io_uring后端的socket是阻塞的，总是交给事件循环发送
+
+// 注册的INSERT什么时候算完成，配置项register_mode，见http_conn::m_register_durable：
+// writebehind：用户名进了内存用户表就返回成功，INSERT排队，由数据库线程每BATCH_ROWS行或FLUSH_MS毫秒合并落库
+// durable：连接挂起，等所在的批落库后再根据结果返回成功或失败页面
 
 //定义http响应的一些状态信息
 const char *ok_200_title = "OK";
+const char *ok_206_title = "Partial Content";
 const char *error_400_title = "Bad Request";
 const char *error_400_form = "Your request has bad syntax or is inherently impossible to staisfy.\n";
 const char *error_403_title = "Forbidden";
@@ -32,13 +42,69 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+const char *error_416_title = "Range Not Satisfiable";
+const char *error_416_form = "The requested range is not satisfiable.\n";
+const char *error_429_title = "Too Many Requests";
+const char *error_429_form = "Too many connections or requests from this address, please retry later.\n";
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form = "The server is overloaded, please retry later.\n";
+
+//内容固定的错误响应在启动时拼好，长连接和短连接各一份，下标为ERR_*
+enum
+{
+    ERR_400 = 0,
+    ERR_403,
+    ERR_404,
+    ERR_500,
+    ERR_429,
+    ERR_503,
+    ERR_COUNT
+};
+static http_prebuilt error_responses[ERR_COUNT][2];
+
+static bool build_error_responses()
+{
+    for (int linger = 0; linger < 2; ++linger)
+    {
+        http_prebuild(error_responses[ERR_400][linger], 400, error_400_title, error_400_form, linger);
+        http_prebuild(error_responses[ERR_403][linger], 403, error_403_title, error_403_form, linger);
+        http_prebuild(error_responses[ERR_404][linger], 404, error_404_title, error_404_form, linger);
+        http_prebuild(error_responses[ERR_500][linger], 500, error_500_title, error_500_form, linger);
+        http_prebuild(error_responses[ERR_429][linger], 429, error_429_title, error_429_form, linger);
+        http_prebuild(error_responses[ERR_503][linger], 503, error_503_title, error_503_form, linger);
+    }
+    return true;
+}
+static bool error_responses_built = build_error_responses();
 
 //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
 const char *doc_root = "/home/qgy/github/TinyWebServer/root";
 
-//将表中的用户名和密码放入map
-map<string, string> users;
-locker m_lock;
+//动态路由的处理函数，下标是路由注册时的handler
+http_conn::HTTP_CODE (http_conn::*const http_conn::route_handlers[http_conn::ROUTE_HANDLER_COUNT])(const http_route &) = {
+    &http_conn::do_login,
+    &http_conn::do_register,
+    &http_conn::do_metrics,
+};
+
+//启动时建好路由表：页面跳转和登录注册是精确路由，其余URL落到doc_root下的静态目录
+static bool build_routes()
+{
+    http_router *router = http_router::GetInstance();
+    string root(doc_root);
+    router->add_dir("/", doc_root);
+    router->add_file("/", (root + "/judge.html").c_str());
+    router->add_file("/0", (root + "/register.html").c_str());
+    router->add_file("/1", (root + "/log.html").c_str());
+    router->add_file("/5", (root + "/picture.html").c_str());
+    router->add_file("/6", (root + "/video.html").c_str());
+    router->add_file("/7", (root + "/fans.html").c_str());
+    router->add_handler("/2CGISQL.cgi", http_conn::ROUTE_LOGIN, (root + "/welcome.html").c_str(), (root + "/logError.html").c_str(), http_route::POST);
+    router->add_handler("/3CGISQL.cgi", http_conn::ROUTE_REGISTER, (root + "/log.html").c_str(), (root + "/registerError.html").c_str(), http_route::POST);
+    router->add_handler("/metrics", http_conn::ROUTE_METRICS, "", "", http_route::GET);
+    return true;
+}
+static bool routes_built = build_routes();
 
 void http_conn::initmysql_result(connection_pool *connPool)
 {
@@ -54,20 +120,19 @@ void http_conn::initmysql_result(connection_pool *connPool)
 
     //从表中检索完整的结果集
     MYSQL_RES *result = mysql_store_result(mysql);
+    if (!result)
+        return;
 
-    //返回结果集中的列数
-    int num_fields = mysql_num_fields(result);
-
-    //返回所有字段结构的数组
-    MYSQL_FIELD *fields = mysql_fetch_fields(result);
-
-    //从结果集中获取下一行，将对应的用户名和密码，存入map中
+    //结果集不是线程安全的，先在这里取出所有行，再由用户表并行插入
+    vector<pair<const char *, const char *> > rows;
+    rows.reserve(mysql_num_rows(result));
     while (MYSQL_ROW row = mysql_fetch_row(result))
     {
-        string temp1(row[0]);
-        string temp2(row[1]);
-        users[temp1] = temp2;
+        if (row[0] && row[1])
+            rows.push_back(make_pair(row[0], row[1]));
     }
+    user_table::GetInstance()->load(rows);
+    mysql_free_result(result);
 }
 
 //对文件描述符设置非阻塞
@@ -83,27 +148,14 @@ int setnonblocking(int fd)
 // 开启EPOLLONESHOT可以保证，同一个socket在某个时间段内只被一个线程操作
 // 当该线程处理完成后，需要重置该socket对应的EPOLLONESHOT，才能进行下一次监听
 // 这样的机制保障了：不会出现两个线程同时操作同一个socket文件，不会引发数据竞争
-void addfd(int epollfd, int fd, bool one_shot)
+// et为true时使用边缘触发
+void addfd(int epollfd, int fd, bool one_shot, bool et)
 {
     epoll_event event;
     event.data.fd = fd;
-
-#ifdef connfdET
-    event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-#endif
-
-#ifdef connfdLT
-    event.events = EPOLLIN | EPOLLRDHUP;
-#endif
-
-#ifdef listenfdET
-    event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-#endif
-
-#ifdef listenfdLT
     event.events = EPOLLIN | EPOLLRDHUP;
-#endif
-
+    if (et)
+        event.events |= EPOLLET;
     if (one_shot)
         event.events |= EPOLLONESHOT;
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
@@ -122,51 +174,130 @@ void modfd(int epollfd, int fd, int ev)
 {
     epoll_event event;
     event.data.fd = fd;
-
-#ifdef connfdET
-    event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
-#endif
-
-#ifdef connfdLT
     event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
-#endif
-
+    if (http_conn::m_conn_et)
+        event.events |= EPOLLET;
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+atomic<int> http_conn::m_user_count(0);
+bool http_conn::m_conn_et = false;
+bool http_conn::m_worker_write = true;
+bool http_conn::m_register_durable = false;
+int http_conn::m_shed_queue_ms = 200;
+atomic<bool> http_conn::m_draining(false);
+threadpool<http_conn> *http_conn::m_pool = NULL;
+
+//数据库线程上调用：连接在挂起期间没有被关闭和重用时，重新投递给线程池，从do_request继续
+void http_conn::db_done(sql_job *job)
+{
+    http_conn *conn = (http_conn *)job->arg;
+    if (job->generation != conn->m_generation.load())
+    {
+        conn->m_db_state.store(DB_IDLE);
+        return;
+    }
+    conn->m_db_ok = job->ok;
+    conn->m_db_state.store(DB_DONE);
+    conn->queued();
+    //请求队列满时就在数据库线程上处理，不能把连接丢下
+    if (!m_pool || !m_pool->append(conn, conn->m_sockfd))
+        conn->process();
+}
 
 //关闭连接，关闭一个连接，客户总量减一
 void http_conn::close_conn(bool real_close)
 {
+    if (real_close && (m_sockfd != -1) && m_notifier)
+    {
+        //io_uring后端上可能还有提交了没完成的操作，由事件循环等它们结束后再关闭fd
+        m_notifier->notify(m_sockfd, 0);
+        return;
+    }
+    //epoll后端不在这里close：fd和定时器都归reactor，shutdown后交回去，由reactor收到EPOLLRDHUP后统一关闭
+    //直接close会留下挂在时间轮上的定时器，到期时再close一次，关掉的可能已经是复用了这个fd号的新连接
     if (real_close && (m_sockfd != -1))
     {
-        removefd(m_epollfd, m_sockfd);
-        m_sockfd = -1;
-        m_user_count--;
+        shutdown(m_sockfd, SHUT_RDWR);
+        modfd(m_epollfd, m_sockfd, EPOLLIN);
     }
 }
 
+//拒绝：不解析请求，直接发出启动时拼好的短连接响应，socket缓冲区放不下也不等
+//工作线程和reactor上都可能调用，关闭方式和工作线程直接写失败时一样：epoll后端shutdown后交回reactor统一关闭
+void http_conn::shed(int code)
+{
+    const http_prebuilt &resp = error_responses[code == 429 ? ERR_429 : ERR_503][0];
+    send(m_sockfd, resp.data, resp.len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    metrics::status(code);
+    metrics::add(metrics::REQUESTS_SHED);
+    if (m_notifier)
+    {
+        m_notifier->notify(m_sockfd, 0);
+        return;
+    }
+    shutdown(m_sockfd, SHUT_RDWR);
+    modfd(m_epollfd, m_sockfd, EPOLLIN);
+}
+
+//刚accept、还没有http_conn的连接
+void http_conn::reject(int sockfd, int code)
+{
+    const http_prebuilt &resp = error_responses[code == 429 ? ERR_429 : ERR_503][0];
+    send(sockfd, resp.data, resp.len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    metrics::status(code);
+    close(sockfd);
+}
+
 //初始化连接,外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in &addr)
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd, conn_notifier *notifier)
 {
+    //上一个使用该槽的连接可能在发送中途被关闭，先归还它持有的文件缓存引用和缓冲区
+    release_read_buf();
+    release_write_buf();
+    m_epollfd = epollfd;
+    m_notifier = notifier;
     m_sockfd = sockfd;
     m_address = addr;
     //int reuse=1;
     //setsockopt(m_sockfd,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
-    addfd(m_epollfd, sockfd, true);
+    if (!m_notifier)
+        addfd(m_epollfd, sockfd, true, m_conn_et);
+    m_generation.fetch_add(1);
     m_user_count++;
+    m_queued_ns = 0;
     init();
+    m_idle.store(true);
 }
 
 //初始化新接受的连接
 //check_state默认为分析请求行状态
 void http_conn::init()
 {
-    mysql = NULL;
-    bytes_to_send = 0;
-    bytes_have_send = 0;
+    m_read_idx = 0;
+    m_checked_idx = 0;
+    m_request_end = 0;
+    m_close_after = false;
+    init_request();
+    init_response();
+}
+
+//一个请求解析完并生成响应后，为同一连接上的下一个请求重置解析状态
+//不再清零整个读写缓冲区：流水线上已经读入的下一个请求被移到读缓冲区开头，接着解析
+void http_conn::init_request()
+{
+    if (m_request_end > 0)
+    {
+        //解析请求体时末尾补的'\0'覆盖了下一个请求的首字节，先还原
+        if (m_request_end < m_read_idx)
+            m_read_buf[m_request_end] = m_request_end_char;
+        int left = m_read_idx - m_request_end;
+        if (left > 0)
+            memmove(m_read_buf, m_read_buf + m_request_end, left);
+        m_read_idx = left > 0 ? left : 0;
+        m_checked_idx = 0;
+    }
+    m_request_end = 0;
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
     m_method = GET;
@@ -175,78 +306,83 @@ void http_conn::init()
     m_content_length = 0;
     m_host = 0;
     m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
+    m_range = 0;
+    m_range_count = 0;
+    m_header_count = 0;
+    m_string = 0;
     cgi = 0;
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
+}
+
+//合并发送的若干个响应全部发完后，重置写状态
+void http_conn::init_response()
+{
+    release_write_buf();
+    m_metrics.clear();
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    m_write_idx = 0;
+    m_seg_count = 0;
+    m_seg_idx = 0;
+    m_seg_sent = 0;
+    m_response_count = 0;
 }
 
 //从状态机，用于分析出一行内容
 //返回值为行的读取状态，有LINE_OK,LINE_BAD,LINE_OPEN
+//用向量比较直接找'\n'，再检查前面是不是'\r'；没找到时m_checked_idx停在已读数据末尾，下次只扫描新读入的部分
 http_conn::LINE_STATUS http_conn::parse_line()
 {
-    char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx)
+    if (m_checked_idx >= m_read_idx)
+        return LINE_OPEN;
+    size_t len = m_read_idx - m_checked_idx;
+    size_t pos = http_find_byte(m_read_buf + m_checked_idx, len, '\n');
+    if (pos == len)
     {
-        temp = m_read_buf[m_checked_idx];
-        if (temp == '\r')
-        {
-            if ((m_checked_idx + 1) == m_read_idx)
-                return LINE_OPEN;
-            else if (m_read_buf[m_checked_idx + 1] == '\n')
-            {
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }
-        else if (temp == '\n')
-        {
-            if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
-            {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }
+        m_checked_idx = m_read_idx;
+        return LINE_OPEN;
     }
-    return LINE_OPEN;
+    int lf = m_checked_idx + pos;
+    if (lf == m_start_line || m_read_buf[lf - 1] != '\r')
+        return LINE_BAD;
+    m_read_buf[lf - 1] = '\0';
+    m_read_buf[lf] = '\0';
+    m_line_len = lf - 1 - m_start_line;
+    m_checked_idx = lf + 1;
+    return LINE_OK;
 }
 
 //循环读取客户数据，直到无数据可读或对方关闭连接
 //非阻塞ET工作模式下，需要一次性将数据读完
 bool http_conn::read_once()
 {
-    if (m_read_idx >= READ_BUFFER_SIZE)
+    m_idle.store(false, std::memory_order_relaxed);
+    //空闲连接不持有读缓冲区，读之前先租一块；写满了换大一档，到上限才放弃
+    if (m_read_idx >= m_read_size - 1 && !grow_read_buf())
     {
         return false;
     }
     int bytes_read = 0;
 
-#ifdef connfdLT
-
-    bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
-
-    if (bytes_read <= 0)
+    if (!m_conn_et)
     {
-        return false;
-    }
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - 1 - m_read_idx, 0);
 
-    m_read_idx += bytes_read;
+        if (bytes_read <= 0)
+        {
+            return false;
+        }
 
-    return true;
+        m_read_idx += bytes_read;
 
-#endif
+        return true;
+    }
 
-#ifdef connfdET
+    //ET：读到EAGAIN为止
     while (true)
     {
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        if (m_read_idx >= m_read_size - 1 && !grow_read_buf())
+            return false;
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - 1 - m_read_idx, 0);
         if (bytes_read == -1)
         {
             if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -260,7 +396,19 @@ bool http_conn::read_once()
         m_read_idx += bytes_read;
     }
     return true;
-#endif
+}
+
+bool http_conn::append_read(const char *data, int len)
+{
+    m_idle.store(false, std::memory_order_relaxed);
+    while (m_read_idx + len > m_read_size - 1)
+    {
+        if (!grow_read_buf())
+            return false;
+    }
+    memcpy(m_read_buf + m_read_idx, data, len);
+    m_read_idx += len;
+    return true;
 }
 
 
@@ -299,15 +447,20 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
         return BAD_REQUEST;
     *m_version++ = '\0';
     m_version += strspn(m_version, " \t");
-    if (strcasecmp(m_version, "HTTP/1.1") != 0)
+    //HTTP/1.1默认长连接，HTTP/1.0默认短连接，都可以被Connection头部改变
+    if (strcasecmp(m_version, "HTTP/1.1") == 0)
+        m_linger = true;
+    else if (strcasecmp(m_version, "HTTP/1.0") == 0)
+        m_linger = false;
+    else
         return BAD_REQUEST;
     if (strncasecmp(m_url, "http://", 7) == 0)
     {
         m_url += 7;
         m_url = strchr(m_url, '/');
     }
-
-    if (strncasecmp(m_url, "https://", 8) == 0)
+    //http://后面没有路径时m_url已经是NULL
+    else if (strncasecmp(m_url, "https://", 8) == 0)
     {
         m_url += 8;
         m_url = strchr(m_url, '/');
@@ -315,15 +468,13 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
 
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
-    //当url为/时，显示判断界面
-    if (strlen(m_url) == 1)
-        strcat(m_url, "judge.html");
     m_check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
 }
 
 
 //解析http请求报文的头部信息
+//每个头部行只扫描一遍：找到':'后切出名字和值，记入头部索引，再按名字长度分派给关心的几个头部
 http_conn::HTTP_CODE http_conn::parse_headers(char *text)
 {
     if (text[0] == '\0')
@@ -335,26 +486,69 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         }
         return GET_REQUEST;
     }
-    else if (strncasecmp(text, "Connection:", 11) == 0)
+    int len = m_line_len;
+    int colon = http_find_byte(text, len, ':');
+    if (colon == len)
+    {
+        LOG_INFO("oop!bad header: %s", text);
+        Log::get_instance()->flush();
+        return NO_REQUEST;
+    }
+    int name_len = colon;
+    while (name_len > 0 && (text[name_len - 1] == ' ' || text[name_len - 1] == '\t'))
+        --name_len;
+    char *value = text + colon + 1;
+    int value_len = len - colon - 1;
+    while (value_len > 0 && (*value == ' ' || *value == '\t'))
+    {
+        ++value;
+        --value_len;
+    }
+    while (value_len > 0 && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t'))
+        --value_len;
+    value[value_len] = '\0';
+
+    if (m_header_count < MAX_HEADERS)
+    {
+        http_header &h = m_work->headers[m_header_count++];
+        h.name = text - m_read_buf;
+        h.name_len = name_len;
+        h.value = value - m_read_buf;
+        h.value_len = value_len;
+    }
+
+    if (name_len == 10 && strncasecmp(text, "Connection", 10) == 0)
     {
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)
+        //Connection的值是逗号分隔的选项列表，例如"keep-alive, Upgrade"
+        char *p = value;
+        while (*p)
         {
-            m_linger = true;
+            p += strspn(p, " \t,");
+            int n = strcspn(p, " \t,");
+            if (n == 10 && strncasecmp(p, "keep-alive", 10) == 0)
+                m_linger = true;
+            else if (n == 5 && strncasecmp(p, "close", 5) == 0)
+                m_linger = false;
+            p += n;
         }
     }
-    else if (strncasecmp(text, "Content-length:", 15) == 0)
+    else if (name_len == 14 && strncasecmp(text, "Content-length", 14) == 0)
     {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
+        //请求体要整个放进读缓冲区：不是数字、负数或超过读缓冲区上限的都是坏请求，否则按它切请求体会越界
+        char *end;
+        errno = 0;
+        long long length = strtoll(value, &end, 10);
+        if (end == value || *end != '\0' || errno == ERANGE || length < 0 || length > buffer_pool::MAX_SIZE)
+            return BAD_REQUEST;
+        m_content_length = (int)length;
     }
-    else if (strncasecmp(text, "Host:", 5) == 0)
+    else if (name_len == 4 && strncasecmp(text, "Host", 4) == 0)
     {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
+        m_host = value;
+    }
+    else if (name_len == 5 && strncasecmp(text, "Range", 5) == 0)
+    {
+        m_range = value;
     }
     else
     {
@@ -365,11 +559,27 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
     return NO_REQUEST;
 }
 
+//在头部索引中查找名为name的头部，返回值的起始位置('\0'结尾)，没有时返回NULL
+const char *http_conn::find_header(const char *name) const
+{
+    int name_len = strlen(name);
+    for (int i = 0; i < m_header_count; ++i)
+    {
+        const http_header &h = m_work->headers[i];
+        if (h.name_len == name_len && strncasecmp(m_read_buf + h.name, name, name_len) == 0)
+            return m_read_buf + h.value;
+    }
+    return NULL;
+}
+
 //判断http请求是否被完整读入
 http_conn::HTTP_CODE http_conn::parse_content(char *text)
 {
     if (m_read_idx >= (m_content_length + m_checked_idx))
     {
+        //请求体后面可能紧跟着流水线上的下一个请求，记下被'\0'覆盖的字节
+        m_request_end = m_checked_idx + m_content_length;
+        m_request_end_char = m_read_buf[m_request_end];
         text[m_content_length] = '\0';
         //POST请求中最后为输入的用户名和密码
         m_string = text;
@@ -386,12 +596,18 @@ http_conn::HTTP_CODE http_conn::process_read()
     HTTP_CODE ret = NO_REQUEST;
     char *text = 0;
 
-    while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) || ((line_status = parse_line()) == LINE_OK))
+    //请求体不按行解析，否则分几次读入的请求体会被parse_line推进m_checked_idx，永远等不齐
+    while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) ||
+           (m_check_state != CHECK_STATE_CONTENT && (line_status = parse_line()) == LINE_OK))
     {
         text = get_line();
         m_start_line = m_checked_idx;
-        LOG_INFO("%s", text);
-        Log::get_instance()->flush();
+        //请求体收全之前没有结尾的'\0'，不能当字符串打印
+        if (m_check_state != CHECK_STATE_CONTENT)
+        {
+            LOG_INFO("%s", text);
+            Log::get_instance()->flush();
+        }
         switch (m_check_state)
         {
         case CHECK_STATE_REQUESTLINE:
@@ -408,6 +624,8 @@ http_conn::HTTP_CODE http_conn::process_read()
                 return BAD_REQUEST;
             else if (ret == GET_REQUEST)
             {
+                m_request_end = m_checked_idx;
+                m_request_end_char = m_read_buf[m_request_end];
                 return do_request();
             }
             break;
@@ -427,156 +645,382 @@ http_conn::HTTP_CODE http_conn::process_read()
     return NO_REQUEST;
 }
 
+//每个请求一次路由查找：静态文件的完整路径启动时就拼好了，目录路由只追加URL剩下的部分
 http_conn::HTTP_CODE http_conn::do_request()
 {
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    //printf("m_url:%s\n", m_url);
-    const char *p = strrchr(m_url, '/');
-
-    //处理cgi
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
-    {
-
-        //根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
-
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
-
-        //将用户名和密码提取出来
-        //user=123&passwd=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
-
-        //同步线程登录校验
-        if (*(p + 1) == '3')
-        {
-            //如果是注册，先检测数据库中是否有重名的
-            //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end())
-            {
+    const http_route *route = http_router::GetInstance()->match(m_url, m_method == POST ? http_route::POST : http_route::GET);
+    if (!route)
+        return NO_RESOURCE;
+    if (route->kind == http_route::HANDLER)
+        return (this->*route_handlers[route->handler])(*route);
 
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
+    //小文件的整条响应在内容缓存里，命中时不用拼路径、查文件缓存
+    if (m_method == GET && !cgi && !m_range)
+    {
+        m_content = content_cache::GetInstance()->acquire(m_url);
+        if (m_content)
+            return FILE_REQUEST;
+    }
+    if (route->kind == http_route::FILE)
+        return serve_file(route->target.c_str());
 
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
-        }
-        //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2')
+    int dir_len = route->target.size();
+    const char *rest = m_url + route->path.size() - 1; //保留前缀最后的'/'
+    int rest_len = strlen(rest);
+    if (dir_len + rest_len >= FILENAME_LEN)
+        return NO_RESOURCE;
+    char real_file[FILENAME_LEN];
+    memcpy(real_file, route->target.data(), dir_len);
+    memcpy(real_file + dir_len, rest, rest_len + 1);
+    return serve_file(real_file);
+}
+
+//从共享文件缓存中取文件，命中时不需要stat、open、mmap
+http_conn::HTTP_CODE http_conn::serve_file(const char *path)
+{
+    m_file = file_cache::GetInstance()->acquire(path);
+    if (!m_file)
+        return NO_RESOURCE;
+    HTTP_CODE ret = FILE_REQUEST;
+    if (!(m_file->st.st_mode & S_IROTH))
+        ret = FORBIDDEN_REQUEST;
+    else if (S_ISDIR(m_file->st.st_mode))
+        ret = BAD_REQUEST;
+    else if (m_file->fd == -1)
+        ret = FORBIDDEN_REQUEST;
+    if (ret != FILE_REQUEST)
+    {
+        unmap();
+        return ret;
+    }
+    m_file_address = m_file->address;
+    //第一次请求的小文件建立内容缓存条目，这次就用它发送
+    if (m_method == GET && !cgi && !m_range && m_file_address)
+    {
+        m_content = content_cache::GetInstance()->insert(m_url, path, m_file);
+        if (m_content)
         {
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/logError.html");
+            file_cache::GetInstance()->release(m_file);
+            m_file = NULL;
+            m_file_address = NULL;
         }
     }
+    return FILE_REQUEST;
+}
 
-    if (*(p + 1) == '0')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+//将用户名和密码提取出来
+//user=123&passwd=123
+//请求体不再受2KB读缓冲区限制，超长的用户名和密码截断，不能写出数组
+void http_conn::parse_credentials(char *name, char *password)
+{
+    int i, j = 0;
+    for (i = 5; m_string[i] != '&' && m_string[i] != '\0'; ++i)
+        if (j < 99)
+            name[j++] = m_string[i];
+    name[j] = '\0';
+
+    j = 0;
+    if (m_string[i] == '&' && i + 10 <= m_content_length)
+        for (i = i + 10; m_string[i] != '\0'; ++i)
+            if (j < 99)
+                password[j++] = m_string[i];
+    password[j] = '\0';
+}
+
+//登录：若浏览器端输入的用户名和密码在表中可以查找到，返回成功页面，否则返回失败页面
+http_conn::HTTP_CODE http_conn::do_login(const http_route &route)
+{
+    char name[100], password[100];
+    parse_credentials(name, password);
+    if (user_table::GetInstance()->check(name, password))
+        return serve_file(route.target.c_str());
+    return serve_file(route.fallback.c_str());
+}
 
-        free(m_url_real);
+//注册：先在用户表里占住用户名，同名的并发注册只有一个能成功
+//durable：INSERT交给数据库线程，连接挂起，工作线程不等数据库；落库后重新进入do_request
+//writebehind：用户表里已经有了，直接返回成功，INSERT排队批量落库
+http_conn::HTTP_CODE http_conn::do_register(const http_route &route)
+{
+    if (m_db_state.load() == DB_DONE)
+    {
+        m_db_state.store(DB_IDLE);
+        return serve_file(m_db_ok ? route.target.c_str() : route.fallback.c_str());
     }
-    else if (*(p + 1) == '1')
+    if (m_db_state.load() == DB_PENDING)
+        return INTERNAL_ERROR; //上一个连接的任务还没回来，m_db_state和m_db_ok不能复用
+
+    char name[100], password[100];
+    parse_credentials(name, password);
+    if (!user_table::GetInstance()->insert(name, password))
+        return serve_file(route.fallback.c_str());
+
+    if (m_register_durable)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        m_job = sql_executor::GetInstance()->alloc();
+        m_job->kind = sql_job::INSERT_USER;
+        strcpy(m_job->name, name);
+        strcpy(m_job->password, password);
+        m_job->done = db_done;
+        m_job->arg = this;
+        m_job->generation = m_generation.load();
+        m_db_state.store(DB_PENDING);
+        return DB_REQUEST;
+    }
+
+    sql_job job;
+    job.kind = sql_job::INSERT_USER;
+    strcpy(job.name, name);
+    strcpy(job.password, password);
+    sql_executor::GetInstance()->post(job);
+    return serve_file(route.target.c_str());
+}
 
-        free(m_url_real);
+//运行指标：正文在process_write中渲染进m_metrics，不访问数据库
+http_conn::HTTP_CODE http_conn::do_metrics(const http_route &)
+{
+    return METRICS_REQUEST;
+}
+//映射由文件缓存持有，这里只归还引用，包括合并发送的各个响应引用的文件
+void http_conn::unmap()
+{
+    if (m_file)
+    {
+        file_cache::GetInstance()->release(m_file);
+        m_file = NULL;
     }
-    else if (*(p + 1) == '5')
+    m_file_address = 0;
+    for (int i = 0; i < m_file_count; ++i)
+        file_cache::GetInstance()->release(m_work->files[i]);
+    m_file_count = 0;
+    if (m_content)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        content_cache::GetInstance()->release(m_content);
+        m_content = NULL;
+    }
+    for (int i = 0; i < m_content_count; ++i)
+        content_cache::GetInstance()->release(m_work->contents[i]);
+    m_content_count = 0;
+}
 
-        free(m_url_real);
+//读缓冲区写满(或还没有)时，从缓冲区池换一块大一档的，已读入的数据和指向它的解析指针一起搬过去
+//还没有读缓冲区说明连接刚从空闲转入活跃，解析和发送用的数组也在这时租用
+bool http_conn::grow_read_buf()
+{
+    int cap;
+    if (!m_work)
+    {
+        m_work = (work_area *)buffer_pool::GetInstance()->acquire(sizeof(work_area), cap);
+        if (!m_work)
+            return false;
     }
-    else if (*(p + 1) == '6')
+    int size = m_read_buf ? m_read_size * 2 : READ_BUFFER_SIZE;
+    char *buf = buffer_pool::GetInstance()->acquire(size, cap);
+    if (!buf)
+        return false;
+    char *old = m_read_buf;
+    if (old)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        memcpy(buf, old, m_read_idx);
+        char **ptrs[] = {&m_url, &m_version, &m_host, &m_range, &m_string};
+        for (size_t i = 0; i < sizeof(ptrs) / sizeof(ptrs[0]); ++i)
+        {
+            //只搬指向旧缓冲区的，没有设置的指针为NULL
+            char *p = *ptrs[i];
+            if (p >= old && p < old + m_read_size)
+                *ptrs[i] = buf + (p - old);
+        }
+        buffer_pool::GetInstance()->release(old, m_read_size);
     }
-    else if (*(p + 1) == '7')
+    m_read_buf = buf;
+    m_read_size = cap;
+    return true;
+}
+
+//连同解析和发送用的数组一起归还，数组里记着的文件引用先还给缓存
+void http_conn::release_read_buf()
+{
+    unmap();
+    buffer_pool::GetInstance()->release(m_read_buf, m_read_size);
+    m_read_buf = NULL;
+    m_read_size = 0;
+    if (m_work)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        buffer_pool::GetInstance()->release((char *)m_work, sizeof(work_area));
+        m_work = NULL;
+    }
+}
 
-        free(m_url_real);
+//当前写缓冲区块放不下下一个响应时，再租一块挂在后面；当前块是空的说明一块装不下，换大一档
+//已排队的段仍指向之前的块，这些块直到整批响应发完才归还
+bool http_conn::next_write_chunk()
+{
+    if (!can_grow_write())
+        return false;
+    int size = WRITE_BUFFER_SIZE;
+    if (m_write_buf && m_write_idx == 0)
+    {
+        size = m_write_size * 2;
+        buffer_pool::GetInstance()->release(m_write_buf, m_write_size);
+        m_write_chunk_count--;
     }
+    int cap;
+    char *buf = buffer_pool::GetInstance()->acquire(size, cap);
+    if (!buf)
+        return false;
+    m_write_chunks[m_write_chunk_count] = buf;
+    m_write_sizes[m_write_chunk_count] = cap;
+    m_write_chunk_count++;
+    m_write_buf = buf;
+    m_write_size = cap;
+    m_write_idx = 0;
+    return true;
+}
+
+bool http_conn::can_grow_write() const
+{
+    if (!m_write_buf)
+        return true;
+    if (m_write_idx == 0)
+        return m_write_size < buffer_pool::MAX_SIZE;
+    return m_write_chunk_count < MAX_WRITE_CHUNKS;
+}
+
+void http_conn::release_write_buf()
+{
+    for (int i = 0; i < m_write_chunk_count; ++i)
+        buffer_pool::GetInstance()->release(m_write_chunks[i], m_write_sizes[i]);
+    m_write_chunk_count = 0;
+    m_write_buf = NULL;
+    m_write_size = 0;
+    m_write_idx = 0;
+}
+
+//epoll后端重新注册EPOLLONESHOT事件，io_uring后端交给事件循环提交下一个操作
+void http_conn::rearm(int ev)
+{
+    if (m_notifier)
+        m_notifier->notify(m_sockfd, ev);
     else
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+        modfd(m_epollfd, m_sockfd, ev);
+}
 
-    if (stat(m_real_file, &m_file_stat) < 0)
-        return NO_RESOURCE;
-    if (!(m_file_stat.st_mode & S_IROTH))
-        return FORBIDDEN_REQUEST;
-    if (S_ISDIR(m_file_stat.st_mode))
-        return BAD_REQUEST;
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
-    return FILE_REQUEST;
+int http_conn::fill_iov()
+{
+    int count = 0;
+    for (int i = m_seg_idx; i < m_seg_count && m_work->segs[i].base; ++i, ++count)
+    {
+        m_work->iv[count].iov_base = (char *)m_work->segs[i].base + (i == m_seg_idx ? m_seg_sent : 0);
+        m_work->iv[count].iov_len = m_work->segs[i].len - (i == m_seg_idx ? m_seg_sent : 0);
+    }
+    return count;
 }
-void http_conn::unmap()
+
+void http_conn::file_seg(int &fd, off_t &offset, off_t &len) const
 {
-    if (m_file_address)
+    const send_seg *seg = &m_work->segs[m_seg_idx];
+    fd = seg->fd;
+    offset = seg->offset + m_seg_sent;
+    len = seg->len - m_seg_sent;
+}
+
+//把发出的字节数记到各段上
+void http_conn::sent(off_t n)
+{
+    metrics::add(metrics::BYTES_SENT, n);
+    bytes_have_send += n;
+    bytes_to_send -= n;
+    while (n > 0 && m_seg_idx < m_seg_count)
+    {
+        off_t left = m_work->segs[m_seg_idx].len - m_seg_sent;
+        if (n < left)
+        {
+            m_seg_sent += n;
+            n = 0;
+        }
+        else
+        {
+            n -= left;
+            m_seg_idx++;
+            m_seg_sent = 0;
+        }
+    }
+}
+
+bool http_conn::finish_write(bool *kept)
+{
+    unmap();
+    if (m_close_after)
     {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+        return false;
+    }
+    init_response();
+    //读缓冲区里还有流水线上没处理的请求，不重新注册EPOLLIN，由调用者再交给工作线程
+    if (m_read_idx > 0)
+    {
+        if (kept)
+            *kept = true;
+        return true;
     }
+    //连接转入空闲，读缓冲区也还给缓冲区池，必须在重新注册EPOLLIN之前
+    release_read_buf();
+    m_idle.store(true, std::memory_order_release);
+    rearm(EPOLLIN);
+    return true;
+}
+
+//发送用时记入write阶段；返回后连接可能已经归别的线程，只用局部变量
+bool http_conn::write(bool *kept)
+{
+    uint64_t start = metrics::now_ns();
+    bool ret = write_window(kept);
+    metrics::observe(metrics::STAGE_WRITE, metrics::now_ns() - start);
+    return ret;
 }
 
-bool http_conn::write()
+//按段发送响应：连续的内存段(包括小文件的映射)合并成一次sendmsg，文件段用sendfile直接从缓存的fd发送
+//后面还有数据时带上MSG_MORE，头部不会单独成包
+//每次最多发送SEND_WINDOW字节，慢速客户端下载大文件时不会长时间占住reactor
+bool http_conn::write_window(bool *kept)
 {
-    int temp = 0;
+    off_t temp = 0;
+    off_t window = 0;
 
     if (bytes_to_send == 0)
     {
+        init_response();
+        if (m_read_idx == 0)
+            release_read_buf();
         modfd(m_epollfd, m_sockfd, EPOLLIN);
-        init();
         return true;
     }
 
     while (1)
     {
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        if (window >= SEND_WINDOW)
+        {
+            modfd(m_epollfd, m_sockfd, EPOLLOUT);
+            return true;
+        }
+
+        int count = fill_iov();
+        if (count > 0)
+        {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = m_work->iv;
+            msg.msg_iovlen = count;
+            temp = sendmsg(m_sockfd, &msg, more_after(count) ? MSG_MORE : 0);
+        }
+        else
+        {
+            int fd;
+            off_t offset, len;
+            file_seg(fd, offset, len);
+            if (len > SEND_WINDOW - window)
+                len = SEND_WINDOW - window;
+            temp = sendfile(m_sockfd, fd, &offset, len);
+        }
 
         if (temp < 0)
         {
@@ -588,70 +1032,180 @@ bool http_conn::write()
             unmap();
             return false;
         }
-
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
-        if (bytes_have_send >= m_iv[0].iov_len)
-        {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        }
-        else
+        //文件在缓存记下st之后被截短，sendfile到了文件末尾只会返回0，再循环也没有进展
+        if (temp == 0 && count == 0)
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+            unmap();
+            return false;
         }
 
-        if (bytes_to_send <= 0)
-        {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
+        window += temp;
+        sent(temp);
 
-            if (m_linger)
-            {
-                init();
-                return true;
-            }
-            else
-            {
-                return false;
-            }
-        }
+        if (bytes_to_send <= 0)
+            return finish_write(kept);
     }
 }
 
+//一旦有一次写不下，后面的都失败，保证最后检查的那次add_*能反映整个响应是否写全
 bool http_conn::add_response(const char *format, ...)
 {
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
+    if (m_write_full || m_write_idx >= m_write_size)
+    {
+        m_write_full = true;
         return false;
+    }
     va_list arg_list;
     va_start(arg_list, format);
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
+    int len = vsnprintf(m_write_buf + m_write_idx, m_write_size - 1 - m_write_idx, format, arg_list);
+    if (len >= (m_write_size - 1 - m_write_idx))
     {
         va_end(arg_list);
+        m_write_full = true;
         return false;
     }
     m_write_idx += len;
     va_end(arg_list);
-    LOG_INFO("request:%s", m_write_buf);
-    Log::get_instance()->flush();
     return true;
 }
+//和add_response一样，一次写不下之后都失败
+bool http_conn::add_bytes(const char *data, int len)
+{
+    if (m_write_full || len > m_write_size - 1 - m_write_idx)
+    {
+        m_write_full = true;
+        return false;
+    }
+    memcpy(m_write_buf + m_write_idx, data, len);
+    m_write_idx += len;
+    return true;
+}
+//200响应的头部是固定模板，只填校验器、Date、Content-Length和Connection，不经过vsnprintf
+bool http_conn::add_ok_headers(off_t content_len, const file_entry *file)
+{
+    static const char head[] = "HTTP/1.1 200 OK\r\nAccept-Ranges:bytes\r\n";
+    static const char etag[] = "ETag:";
+    static const char last_modified[] = "\r\nLast-Modified:";
+    static const char cache_control[] = "\r\nCache-Control:max-age=";
+    static const char date[] = "Date:";
+    static const char length[] = "\r\nContent-Length:";
+    static const char keep_alive[] = "\r\nConnection:keep-alive\r\n\r\n";
+    static const char close[] = "\r\nConnection:close\r\n\r\n";
+    int etag_len = file ? strlen(file->etag) : 0;
+    int lm_len = file ? strlen(file->last_modified) : 0;
+    int max_len = sizeof(head) - 1 + sizeof(date) - 1 + HTTP_DATE_LEN + sizeof(length) - 1 + 20 + sizeof(keep_alive) - 1;
+    if (file)
+        max_len += sizeof(etag) - 1 + etag_len + sizeof(last_modified) - 1 + lm_len + sizeof(cache_control) - 1 + 20 + 2;
+    if (m_write_full || max_len > m_write_size - 1 - m_write_idx)
+    {
+        m_write_full = true;
+        return false;
+    }
+    char *p = m_write_buf + m_write_idx;
+    memcpy(p, head, sizeof(head) - 1);
+    p += sizeof(head) - 1;
+    if (file)
+    {
+        memcpy(p, etag, sizeof(etag) - 1);
+        p += sizeof(etag) - 1;
+        memcpy(p, file->etag, etag_len);
+        p += etag_len;
+        memcpy(p, last_modified, sizeof(last_modified) - 1);
+        p += sizeof(last_modified) - 1;
+        memcpy(p, file->last_modified, lm_len);
+        p += lm_len;
+        memcpy(p, cache_control, sizeof(cache_control) - 1);
+        p += sizeof(cache_control) - 1;
+        p += http_format_uint(p, file_cache::MAX_AGE);
+        *p++ = '\r';
+        *p++ = '\n';
+    }
+    memcpy(p, date, sizeof(date) - 1);
+    p += sizeof(date) - 1;
+    memcpy(p, http_date(), HTTP_DATE_LEN);
+    p += HTTP_DATE_LEN;
+    memcpy(p, length, sizeof(length) - 1);
+    p += sizeof(length) - 1;
+    p += http_format_uint(p, content_len);
+    if (m_linger)
+    {
+        memcpy(p, keep_alive, sizeof(keep_alive) - 1);
+        p += sizeof(keep_alive) - 1;
+    }
+    else
+    {
+        memcpy(p, close, sizeof(close) - 1);
+        p += sizeof(close) - 1;
+    }
+    m_write_idx = p - m_write_buf;
+    return true;
+}
+//缓存的固定头部和正文之间插入本响应的Date和Connection，三段连续的内存段一次sendmsg发出
+bool http_conn::add_cached_response(const content_variant &v)
+{
+    static const char keep_alive[] = "\r\nConnection:keep-alive\r\n\r\n";
+    static const char close[] = "\r\nConnection:close\r\n\r\n";
+    int start = m_write_idx;
+    add_bytes("Date:", 5);
+    add_bytes(http_date(), HTTP_DATE_LEN);
+    if (!(m_linger ? add_bytes(keep_alive, sizeof(keep_alive) - 1) : add_bytes(close, sizeof(close) - 1)))
+        return false;
+    add_seg(v.data, 0, v.header_len);
+    add_seg(m_write_buf + start, 0, m_write_idx - start);
+    add_seg(v.data + v.header_len, 0, v.len - v.header_len);
+    return true;
+}
+//条件请求：If-None-Match优先，有它时忽略If-Modified-Since
+//If-Modified-Since多数是浏览器原样送回的Last-Modified，先逐字比较，不同时才解析日期
+bool http_conn::not_modified(const char *etag, time_t mtime, const char *last_modified) const
+{
+    if (m_method != GET || cgi)
+        return false;
+    const char *inm = find_header("If-None-Match");
+    if (inm)
+        return http_etag_match(inm, etag);
+    const char *ims = find_header("If-Modified-Since");
+    if (!ims)
+        return false;
+    if (strcmp(ims, last_modified) == 0)
+        return true;
+    time_t since = http_parse_date(ims);
+    return since != -1 && mtime <= since;
+}
+//304没有正文，带上和200相同的校验器、Cache-Control和Vary
+bool http_conn::add_not_modified(const char *etag, const char *last_modified, bool vary)
+{
+    int start = m_write_idx;
+    if (!add_response("HTTP/1.1 304 Not Modified\r\nETag:%s\r\nLast-Modified:%s\r\nCache-Control:max-age=%d\r\n%sDate:%s\r\n",
+                      etag, last_modified, file_cache::MAX_AGE, vary ? "Vary:Accept-Encoding\r\n" : "", http_date()) ||
+        !add_linger() || !add_blank_line())
+        return false;
+    add_seg(m_write_buf + start, 0, m_write_idx - start);
+    return true;
+}
+bool http_conn::add_validators(const file_entry *file)
+{
+    return add_response("ETag:%s\r\nLast-Modified:%s\r\nCache-Control:max-age=%d\r\n", file->etag, file->last_modified, file_cache::MAX_AGE);
+}
+//错误响应直接引用启动时拼好的整条数据，不占写缓冲区
+void http_conn::add_error(int code)
+{
+    const http_prebuilt &resp = error_responses[code][m_linger ? 1 : 0];
+    add_seg(resp.data, 0, resp.len);
+}
 bool http_conn::add_status_line(int status, const char *title)
 {
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
-bool http_conn::add_headers(int content_len)
+bool http_conn::add_headers(off_t content_len)
 {
     add_content_length(content_len);
     add_linger();
-    add_blank_line();
+    return add_blank_line();
 }
-bool http_conn::add_content_length(int content_len)
+bool http_conn::add_content_length(off_t content_len)
 {
-    return add_response("Content-Length:%d\r\n", content_len);
+    return add_response("Content-Length:%lld\r\n", (long long)content_len);
 }
 bool http_conn::add_content_type()
 {
@@ -669,77 +1223,395 @@ bool http_conn::add_content(const char *content)
 {
     return add_response("%s", content);
 }
+void http_conn::add_seg(const char *base, off_t offset, off_t len)
+{
+    if (len <= 0 || m_seg_count >= MAX_SEGS)
+        return;
+    m_work->segs[m_seg_count].base = base;
+    m_work->segs[m_seg_count].fd = m_file ? m_file->fd : -1;
+    m_work->segs[m_seg_count].offset = offset;
+    m_work->segs[m_seg_count].len = len;
+    m_seg_count++;
+    bytes_to_send += len;
+}
+//文件中的一段：有映射时直接当作内存段，和前后的头部一起sendmsg；否则用sendfile
+void http_conn::add_file_seg(off_t offset, off_t len)
+{
+    if (m_file_address)
+        add_seg(m_file_address + offset, 0, len);
+    else
+        add_seg(NULL, offset, len);
+}
+
+//解析Range: bytes=a-b, c-, -n
+//返回0表示没有Range或者忽略它(格式不认识、区间太多)，返回整个文件；返回-1表示区间都不可满足；否则返回区间数
+int http_conn::parse_range(off_t size)
+{
+    m_range_count = 0;
+    if (!m_range || strncasecmp(m_range, "bytes=", 6) != 0)
+        return 0;
+    const char *p = m_range + 6;
+    bool any = false;
+    while (*p)
+    {
+        p += strspn(p, " \t");
+        off_t start = -1, end = -1;
+        char *next;
+        if (*p == '-')
+        {
+            //后缀区间：最后n个字节
+            long long n = strtoll(p + 1, &next, 10);
+            if (next == p + 1 || n < 0)
+                return 0;
+            if (n > 0)
+            {
+                start = n >= size ? 0 : size - n;
+                end = size - 1;
+            }
+        }
+        else
+        {
+            long long a = strtoll(p, &next, 10);
+            if (next == p || *next != '-' || a < 0)
+                return 0;
+            p = next + 1;
+            long long b = size - 1;
+            if (*p >= '0' && *p <= '9')
+            {
+                b = strtoll(p, &next, 10);
+                if (b < a)
+                    return 0;
+            }
+            else
+                next = (char *)p;
+            if (a < size)
+            {
+                start = a;
+                end = b < size ? b : size - 1;
+            }
+        }
+        any = true;
+        if (start >= 0)
+        {
+            if (m_range_count >= MAX_RANGES)
+                return 0;
+            m_work->ranges[m_range_count].start = start;
+            m_work->ranges[m_range_count].end = end;
+            m_range_count++;
+        }
+        p = next;
+        p += strspn(p, " \t");
+        if (*p == ',')
+            p++;
+        else if (*p != '\0')
+            return 0;
+    }
+    if (!any)
+        return 0;
+    return m_range_count > 0 ? m_range_count : -1;
+}
+
+//206响应：单区间直接带Content-Range；多区间用multipart/byteranges，分隔行写在写缓冲区中，和文件段交替发送
+bool http_conn::add_range_response()
+{
+    off_t size = m_file->st.st_size;
+    if (m_range_count == 1)
+    {
+        off_t len = m_work->ranges[0].end - m_work->ranges[0].start + 1;
+        int head = m_write_idx;
+        if (!add_status_line(206, ok_206_title) ||
+            !add_response("Content-Range:bytes %lld-%lld/%lld\r\n", (long long)m_work->ranges[0].start, (long long)m_work->ranges[0].end, (long long)size) ||
+            !add_validators(m_file) || !add_headers(len))
+            return false;
+        add_seg(m_write_buf + head, 0, m_write_idx - head);
+        add_file_seg(m_work->ranges[0].start, len);
+        return true;
+    }
+
+    char boundary[40];
+    snprintf(boundary, sizeof(boundary), "%08lx%08lx", (unsigned long)m_file->st.st_ino, (unsigned long)m_file->st.st_mtime);
+
+    //先算出每个分隔行的长度，得到整个body的长度
+    char part[128];
+    off_t body_len = 0;
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        body_len += snprintf(part, sizeof(part), "%s--%s\r\nContent-Range:bytes %lld-%lld/%lld\r\n\r\n", i ? "\r\n" : "",
+                             boundary, (long long)m_work->ranges[i].start, (long long)m_work->ranges[i].end, (long long)size);
+        body_len += m_work->ranges[i].end - m_work->ranges[i].start + 1;
+    }
+    body_len += snprintf(part, sizeof(part), "\r\n--%s--\r\n", boundary);
+
+    int head = m_write_idx;
+    if (!add_status_line(206, ok_206_title) ||
+        !add_response("Content-Type:multipart/byteranges; boundary=%s\r\n", boundary) ||
+        !add_validators(m_file) || !add_headers(body_len))
+        return false;
+    add_seg(m_write_buf + head, 0, m_write_idx - head);
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        int start = m_write_idx;
+        if (!add_response("%s--%s\r\nContent-Range:bytes %lld-%lld/%lld\r\n\r\n", i ? "\r\n" : "",
+                          boundary, (long long)m_work->ranges[i].start, (long long)m_work->ranges[i].end, (long long)size))
+            return false;
+        add_seg(m_write_buf + start, 0, m_write_idx - start);
+        add_file_seg(m_work->ranges[i].start, m_work->ranges[i].end - m_work->ranges[i].start + 1);
+    }
+    int start = m_write_idx;
+    if (!add_response("\r\n--%s--\r\n", boundary))
+        return false;
+    add_seg(m_write_buf + start, 0, m_write_idx - start);
+    return true;
+}
+
+//响应追加在写缓冲区和段列表的末尾，流水线上的多个响应可以合并成一次发送
 bool http_conn::process_write(HTTP_CODE ret)
 {
+    int write_start = m_write_idx;
+    int seg_start = m_seg_count;
+    off_t bytes_start = bytes_to_send;
+    m_write_full = false;
     switch (ret)
     {
     case INTERNAL_ERROR:
     {
-        add_status_line(500, error_500_title);
-        add_headers(strlen(error_500_form));
-        if (!add_content(error_500_form))
-            return false;
-        break;
+        add_error(ERR_500);
+        return true;
     }
     case BAD_REQUEST:
     {
-        add_status_line(404, error_404_title);
-        add_headers(strlen(error_404_form));
-        if (!add_content(error_404_form))
-            return false;
-        break;
+        //queue_responses已经清掉m_linger，取的是Connection: close的那份
+        add_error(ERR_400);
+        return true;
+    }
+    case NO_RESOURCE:
+    {
+        add_error(ERR_404);
+        return true;
     }
     case FORBIDDEN_REQUEST:
     {
-        add_status_line(403, error_403_title);
-        add_headers(strlen(error_403_form));
-        if (!add_content(error_403_form))
+        add_error(ERR_403);
+        return true;
+    }
+    case METRICS_REQUEST:
+    {
+        //正文引用m_metrics，queue_responses在它之后不再合并下一个响应，发完之前不会被改写
+        m_metrics.clear();
+        metrics::render(m_metrics);
+        add_status_line(200, ok_200_title);
+        add_response("Content-Type:%s\r\n", "text/plain; version=0.0.4");
+        if (!add_headers(m_metrics.size()))
             return false;
-        break;
+        add_seg(m_write_buf + write_start, 0, m_write_idx - write_start);
+        add_seg(m_metrics.data(), 0, m_metrics.size());
+        return true;
     }
     case FILE_REQUEST:
     {
-        add_status_line(200, ok_200_title);
-        if (m_file_stat.st_size != 0)
-        {
-            add_headers(m_file_stat.st_size);
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
+        if (m_content)
+        {
+            const content_variant &v = m_content->choose(find_header("Accept-Encoding"));
+            if (not_modified(v.etag, m_content->st.st_mtime, m_content->last_modified))
+                return add_not_modified(v.etag, m_content->last_modified, m_content->vary);
+            return add_cached_response(v);
+        }
+        if (not_modified(m_file->etag, m_file->st.st_mtime, m_file->last_modified))
+            return add_not_modified(m_file->etag, m_file->last_modified, false);
+        if (m_file->st.st_size != 0)
+        {
+            int ranges = parse_range(m_file->st.st_size);
+            if (ranges < 0)
+            {
+                add_status_line(416, error_416_title);
+                add_response("Content-Range:bytes */%lld\r\n", (long long)m_file->st.st_size);
+                add_headers(strlen(error_416_form));
+                if (!add_content(error_416_form))
+                    return false;
+                break;
+            }
+            //区间太多写不进写缓冲区时，先换一块写缓冲区重试，实在放不下才退回发送整个文件
+            if (ranges > 0)
+            {
+                if (add_range_response())
+                    return true;
+                m_write_idx = write_start;
+                m_seg_count = seg_start;
+                bytes_to_send = bytes_start;
+                if (m_write_full && can_grow_write())
+                    return false;
+                m_write_full = false;
+            }
+            if (!add_ok_headers(m_file->st.st_size, m_method == GET && !cgi ? m_file : NULL))
+                return false;
+            add_seg(m_write_buf + write_start, 0, m_write_idx - write_start);
+            add_file_seg(0, m_file->st.st_size);
             return true;
         }
         else
         {
             const char *ok_string = "<html><body></body></html>";
-            add_headers(strlen(ok_string));
+            add_ok_headers(strlen(ok_string), NULL);
             if (!add_content(ok_string))
                 return false;
         }
+        break;
     }
     default:
         return false;
     }
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    add_seg(m_write_buf + write_start, 0, m_write_idx - write_start);
     return true;
 }
+//流水线：读缓冲区中可能一次读入了多个请求，逐个解析并把响应追加到发送队列，最后一起发送
+//遇到短连接的请求，或者写缓冲区、段列表、文件引用放不下下一个响应时停止，剩下的请求等这批发完再处理
+//返回false表示连接已经关闭
+bool http_conn::queue_responses()
+{
+    while (true)
+    {
+        //挂起的注册请求已经解析完，结果回来后直接重新进入do_request
+        HTTP_CODE read_ret = m_db_state.load() == DB_DONE ? do_request() : process_read();
+        if (read_ret == NO_REQUEST || read_ret == DB_REQUEST)
+            break;
+        //排空中：这个响应发完就关闭，客户端重连到新进程上
+        if (m_draining.load(std::memory_order_relaxed))
+            m_linger = false;
+        //出错的请求没有可信的结束位置，后面的数据不能再当作流水线上的请求解析，这个响应发完就关闭
+        if (read_ret == BAD_REQUEST || read_ret == INTERNAL_ERROR)
+            m_linger = false;
+        if (!m_write_buf && !next_write_chunk())
+        {
+            close_conn();
+            return false;
+        }
+        int write_idx = m_write_idx;
+        int seg_count = m_seg_count;
+        off_t bytes = bytes_to_send;
+        bool write_ret = process_write(read_ret);
+        //当前写缓冲区块放不下这个响应，撤销写了一半的内容，换一块重新生成
+        while (!write_ret && m_write_full)
+        {
+            m_write_idx = write_idx;
+            m_seg_count = seg_count;
+            bytes_to_send = bytes;
+            if (!next_write_chunk())
+                break;
+            write_idx = m_write_idx;
+            write_ret = process_write(read_ret);
+        }
+        if (m_file)
+        {
+            m_work->files[m_file_count++] = m_file;
+            m_file = NULL;
+            m_file_address = NULL;
+        }
+        if (m_content)
+        {
+            m_work->contents[m_content_count++] = m_content;
+            m_content = NULL;
+        }
+        if (!write_ret)
+        {
+            if (m_response_count == 0)
+            {
+                close_conn();
+                return false;
+            }
+            //前面已经有排好的响应，先发出去，发完后关闭
+            m_close_after = true;
+            break;
+        }
+        m_response_count++;
+        metrics::add(metrics::REQUESTS);
+        metrics::status(response_status(seg_count));
+        m_close_after = !m_linger;
+        init_request();
+        if (m_close_after || m_read_idx == 0 || !m_metrics.empty())
+            break;
+        if (m_response_count >= MAX_PIPELINE || m_file_count >= MAX_PIPELINE || m_content_count >= MAX_PIPELINE ||
+            m_seg_count + MAX_RANGES * 2 + 2 > MAX_SEGS ||
+            (m_write_chunk_count >= MAX_WRITE_CHUNKS && m_write_size - m_write_idx < PIPELINE_RESERVE))
+            break;
+    }
+    return true;
+}
+
+//每个响应的第一段都以状态行"HTTP/1.1 200 ..."开头
+int http_conn::response_status(int seg) const
+{
+    if (seg >= m_seg_count || !m_work->segs[seg].base || m_work->segs[seg].len < 12)
+        return 0;
+    const char *p = m_work->segs[seg].base + 9;
+    return (p[0] - '0') * 100 + (p[1] - '0') * 10 + (p[2] - '0');
+}
+
+bool http_conn::inline_request() const
+{
+    static const char line[] = "GET /metrics ";
+    if (!m_read_buf || m_read_idx < (int)sizeof(line) - 1 + 4 || memcmp(m_read_buf, line, sizeof(line) - 1) != 0)
+        return false;
+    const char *end = (const char *)memmem(m_read_buf, m_read_idx, "\r\n\r\n", 4);
+    return end && end + 4 == m_read_buf + m_read_idx;
+}
+
+//process阶段只算解析和生成响应，写出的时间由write记入write阶段
 void http_conn::process()
 {
-    HTTP_CODE read_ret = process_read();
-    if (read_ret == NO_REQUEST)
+    uint64_t start = metrics::now_ns();
+    if (m_queued_ns)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        return;
+        uint64_t waited = start - m_queued_ns;
+        metrics::observe(metrics::STAGE_QUEUE, waited);
+        m_queued_ns = 0;
+        //排队太久说明线程池已经跟不上，新请求直接503，把时间留给已经在处理的请求
+        //数据库结果回来重新投递的请求已经做了一半，不丢
+        if (m_shed_queue_ms > 0 && waited > (uint64_t)m_shed_queue_ms * 1000000 && m_db_state.load() != DB_DONE)
+        {
+            shed(503);
+            return;
+        }
     }
-    bool write_ret = process_write(read_ret);
-    if (!write_ret)
+    while (true)
     {
-        close_conn();
+        bool live = queue_responses();
+        metrics::observe(metrics::STAGE_PROCESS, metrics::now_ns() - start);
+        if (!live)
+            return;
+        //提交后连接归数据库线程，结果回来前可能已经在别的工作线程上继续，这里不能再访问任何成员
+        //之前已排好的流水线响应留在发送队列里，和注册的响应一起发出
+        if (m_job)
+        {
+            sql_job *job = m_job;
+            m_job = NULL;
+            sql_executor::GetInstance()->submit(job);
+            return;
+        }
+        if (m_response_count == 0)
+        {
+            rearm(EPOLLIN);
+            return;
+        }
+        if (m_worker_write && !m_notifier)
+        {
+            //EPOLLONESHOT保证此时reactor不会同时操作这个连接；要关闭时只shutdown，
+            //由reactor收到EPOLLRDHUP后统一关闭并删除定时器，工作线程不碰定时器
+            //write重新注册事件后连接可能已经被reactor读入新请求交给别的工作线程，只能看kept，不能再读成员
+            bool kept = false;
+            if (!write(&kept))
+            {
+                shutdown(m_sockfd, SHUT_RDWR);
+                modfd(m_epollfd, m_sockfd, EPOLLIN);
+                return;
+            }
+            if (kept)
+            {
+                start = metrics::now_ns();
+                continue;
+            }
+            return;
+        }
+        rearm(EPOLLOUT);
+        return;
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
 }
@@ -19,9 +19,30 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <atomic>
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "../CGImysql/sql_executor.h"
+#include "../cache/file_cache.h"
+#include "../cache/content_cache.h"
+#include "../buffer/buffer_pool.h"
+#include "../metrics/metrics.h"
+#include "http_parser.h"
+#include "http_response.h"
 
+// 连接把"接下来要等什么事件"交给所属事件循环的接口，io_uring后端实现它，epoll后端不用(直接modfd)
+// ev为EPOLLIN、EPOLLOUT，或者0表示关闭连接；可能在工作线程上调用
+class conn_notifier
+{
+public:
+    virtual ~conn_notifier() {}
+    virtual void notify(int sockfd, int ev) = 0;
+};
+
+template <typename T>
+class threadpool;
+struct http_route;
 
 class http_conn
 {
@@ -46,8 +67,15 @@ public:
 
     // 使用const修饰后，该变量类内共享，但不可修改
     static const int FILENAME_LEN = 200;
-    static const int READ_BUFFER_SIZE = 2048;
-    static const int WRITE_BUFFER_SIZE = 1024;
+    static const int READ_BUFFER_SIZE = 2048;          //读缓冲区初始大小，写满后换大一档，最大buffer_pool::MAX_SIZE
+    static const int WRITE_BUFFER_SIZE = 1024;         //写缓冲区每块的大小，放不下时再租一块
+    static const int MAX_WRITE_CHUNKS = 8;             //一批合并发送的响应最多占用的写缓冲区块数
+    static const int MAX_HEADERS = 32;                 //头部索引最多记录的头部数，超过的仍然解析，但不进索引
+    static const int MAX_RANGES = 8;                   //一个Range请求最多支持的区间数，超过则忽略Range返回整个文件
+    static const int MAX_PIPELINE = 16;                //流水线上最多合并发送的响应数
+    static const int MAX_SEGS = 64;                    //合并发送的响应最多由多少段组成，至少能放下一个多区间响应
+    static const int PIPELINE_RESERVE = 512;           //写缓冲区块用完且剩余空间小于该值时不再合并下一个响应
+    static const off_t SEND_WINDOW = 1024 * 1024;      //每次write最多发送的字节数，发够后让出reactor，下次EPOLLOUT再继续
     enum METHOD
     {
         GET = 0,
@@ -75,7 +103,23 @@ public:
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
         INTERNAL_ERROR,
-        CLOSED_CONNECTION
+        CLOSED_CONNECTION,
+        DB_REQUEST, //已交给数据库线程，连接挂起，结果回来后从do_request继续
+        METRICS_REQUEST //运行指标，正文在生成响应时渲染
+    };
+    //动态路由处理函数表route_handlers的下标
+    enum ROUTE_HANDLER
+    {
+        ROUTE_LOGIN = 0,
+        ROUTE_REGISTER,
+        ROUTE_METRICS,
+        ROUTE_HANDLER_COUNT
+    };
+    enum DB_STATE
+    {
+        DB_IDLE = 0,
+        DB_PENDING,
+        DB_DONE
     };
     enum LINE_STATUS
     {
@@ -84,72 +128,207 @@ public:
         LINE_OPEN
     };
 
+    // 响应由若干段按顺序组成：base不为NULL时是一段内存，否则是文件fd中从offset开始的一段，用sendfile发送
+    struct send_seg
+    {
+        const char *base;
+        int fd;
+        off_t offset;
+        off_t len;
+    };
+    // Range请求中的一个闭区间[start, end]
+    struct byte_range
+    {
+        off_t start;
+        off_t end;
+    };
+    // 只在解析请求和发送响应期间用到的数组，和读缓冲区一起从缓冲区池租用、一起归还，空闲的长连接不占
+    // 连接槽按max_fd预先分配，只留下标量和指针；这里的总大小不超过缓冲区池的一档(4KB)
+    struct work_area
+    {
+        http_header headers[MAX_HEADERS]; //当前请求的头部索引
+        byte_range ranges[MAX_RANGES];
+        send_seg segs[MAX_SEGS];
+        struct iovec iv[MAX_SEGS];
+        file_entry *files[MAX_PIPELINE];  //已排队等待发送的响应引用的文件
+        content_entry *contents[MAX_PIPELINE];
+    };
+
 public:
-    http_conn() {}
+    http_conn() : m_notifier(NULL), m_read_buf(NULL), m_read_size(0), m_work(NULL), m_write_buf(NULL), m_write_size(0), m_write_chunk_count(0),
+                  m_file(NULL), m_file_address(NULL), m_file_count(0), m_content(NULL), m_content_count(0),
+                  m_job(NULL), m_db_state(DB_IDLE), m_db_ok(false), m_generation(0), m_queued_ns(0), m_idle(false) {}
     ~http_conn() {}
 
 public:
-    void init(int sockfd, const sockaddr_in &addr);
+    //notifier不为NULL时连接由io_uring后端驱动，不注册到epoll，读写由事件循环提交，这里只解析和生成响应
+    void init(int sockfd, const sockaddr_in &addr, int epollfd, conn_notifier *notifier = NULL);
     void close_conn(bool real_close = true);
     void process();
     bool read_once();
-    bool write();
+    //kept不为NULL时，返回后连接仍归调用者(流水线上还有请求、没有重新注册事件)则置为true
+    bool write(bool *kept = NULL);
+    //io_uring后端收到的数据从提供缓冲区拷进读缓冲区，放不下时换大一档，到上限返回false
+    bool append_read(const char *data, int len);
+    //把从当前段开始的连续内存段填进m_iv，返回段数；当前段是文件段时返回0，用file_seg取出
+    int fill_iov();
+    struct iovec *iov()
+    {
+        return m_work->iv;
+    }
+    //fill_iov填的count段之后还有数据，发送时带上MSG_MORE
+    bool more_after(int count) const
+    {
+        return m_seg_idx + count < m_seg_count;
+    }
+    void file_seg(int &fd, off_t &offset, off_t &len) const;
+    //记录发出的字节数
+    void sent(off_t n);
+    off_t bytes_left() const
+    {
+        return bytes_to_send;
+    }
+    //整批响应发完：归还文件引用，要关闭连接时返回false；连接转入空闲时重新等待读事件
+    bool finish_write(bool *kept = NULL);
+    //响应发完后读缓冲区中还有流水线上的请求，需要再交给工作线程处理
+    bool pipelined() const
+    {
+        return bytes_to_send == 0 && m_read_idx > 0;
+    }
     sockaddr_in *get_address()
     {
         return &m_address;
     }
+    //投递给线程池之前调用，process开始时记下在队列中等了多久
+    void queued()
+    {
+        m_queued_ns = metrics::now_ns();
+    }
+    //连接在等下一个请求：没有读到一半的请求，也没有在处理或发送的响应；排空时事件循环据此关闭空闲的长连接
+    //下一个请求已经到了内核、事件循环还没来得及读的也不算空闲，关掉的话客户端会丢掉这个请求
+    bool idle() const
+    {
+        int pending = 0;
+        return m_idle.load(std::memory_order_acquire) && ioctl(m_sockfd, FIONREAD, &pending) == 0 && pending == 0;
+    }
+    //读缓冲区里正好是一个完整的GET /metrics请求，事件循环直接在本线程上process，不经过线程池
+    bool inline_request() const;
+    //过载(code为503)或超过客户端限制(429)：发出预先拼好的响应后关闭连接
+    void shed(int code);
+    static void reject(int sockfd, int code);
     void initmysql_result(connection_pool *connPool);
 
 private:
     void init();
+    void init_request();
+    void init_response();
     HTTP_CODE process_read();
     bool process_write(HTTP_CODE ret);
+    bool queue_responses();
+    bool write_window(bool *kept);
+    int response_status(int seg) const;
     HTTP_CODE parse_request_line(char *text);
     HTTP_CODE parse_headers(char *text);
     HTTP_CODE parse_content(char *text);
     HTTP_CODE do_request();
     char *get_line() { return m_read_buf + m_start_line; };
     LINE_STATUS parse_line();
+    const char *find_header(const char *name) const;
     void unmap();
+    bool grow_read_buf();
+    bool next_write_chunk();
+    bool can_grow_write() const;
+    void release_read_buf();
+    void release_write_buf();
+    void rearm(int ev);
     bool add_response(const char *format, ...);
+    bool add_bytes(const char *data, int len);
+    bool add_ok_headers(off_t content_length, const file_entry *file);
+    void add_error(int code);
+    bool add_cached_response(const content_variant &v);
+    bool not_modified(const char *etag, time_t mtime, const char *last_modified) const;
+    bool add_not_modified(const char *etag, const char *last_modified, bool vary);
+    bool add_validators(const file_entry *file);
     bool add_content(const char *content);
     bool add_status_line(int status, const char *title);
-    bool add_headers(int content_length);
+    bool add_headers(off_t content_length);
     bool add_content_type();
-    bool add_content_length(int content_length);
+    bool add_content_length(off_t content_length);
+    int parse_range(off_t size);
+    bool add_range_response();
+    void add_seg(const char *base, off_t offset, off_t len);
+    void add_file_seg(off_t offset, off_t len);
     bool add_linger();
     bool add_blank_line();
+    static void db_done(sql_job *job);
+    HTTP_CODE serve_file(const char *path);
+    void parse_credentials(char *name, char *password);
+    HTTP_CODE do_login(const http_route &route);
+    HTTP_CODE do_register(const http_route &route);
+    HTTP_CODE do_metrics(const http_route &route);
+    static HTTP_CODE (http_conn::*const route_handlers[ROUTE_HANDLER_COUNT])(const http_route &);
 
 public:
-    static int m_epollfd;
-    static int m_user_count;
-    MYSQL *mysql;
+    static atomic<int> m_user_count; //接受连接时加一，事件循环关闭连接时减一
+    static threadpool<http_conn> *m_pool; //数据库任务完成后把连接重新投递给它
+    static bool m_conn_et; //连接socket使用边缘触发，启动时按配置设置
+    static bool m_worker_write; //工作线程生成响应后直接发送，false时交给reactor发送，配置项write_mode
+    static bool m_register_durable; //注册等INSERT落库后再返回，false时写后批量落库，配置项register_mode
+    static int m_shed_queue_ms; //请求在线程池队列中等待超过该时间，取出后直接返回503，0为不丢，配置项shed_queue_ms
+    static atomic<bool> m_draining; //进程在排空，之后的响应都带Connection: close
 
 private:
+    int m_epollfd; //该连接所属reactor的内核事件表
+    conn_notifier *m_notifier; //io_uring后端的事件循环，epoll后端为NULL
     int m_sockfd;
     sockaddr_in m_address;
-    char m_read_buf[READ_BUFFER_SIZE];
+    char *m_read_buf;         //从缓冲区池租用，空闲时为NULL
+    int m_read_size;          //容量，最后一个字节不存数据，请求体正好填满缓冲区时末尾的'\0'不越界
     int m_read_idx;
     int m_checked_idx;
     int m_start_line;
-    char m_write_buf[WRITE_BUFFER_SIZE];
-    int m_write_idx;
+    int m_request_end;        //当前请求(含请求体)的结束位置，流水线上的下一个请求从这里开始
+    char m_request_end_char;  //m_request_end处被'\0'覆盖前的字节
+    int m_line_len;           //parse_line刚切出的一行的长度，不含"\r\n"
+    work_area *m_work;        //和读缓冲区同时租用，空闲时为NULL
+    int m_header_count;
+    char *m_write_buf;        //当前写缓冲区块，即m_write_chunks的最后一块，空闲时为NULL
+    int m_write_size;
+    int m_write_idx;          //当前块中已写入的字节数
+    bool m_write_full;        //上一次add_response因当前块放不下而失败
+    char *m_write_chunks[MAX_WRITE_CHUNKS]; //已排队等待发送的响应占用的写缓冲区块
+    int m_write_sizes[MAX_WRITE_CHUNKS];
+    int m_write_chunk_count;
     CHECK_STATE m_check_state;
     METHOD m_method;
-    char m_real_file[FILENAME_LEN];
     char *m_url;
     char *m_version;
     char *m_host;
+    char *m_range;          //Range请求头的值，没有时为NULL
     int m_content_length;
     bool m_linger;
-    char *m_file_address;
-    struct stat m_file_stat;
-    struct iovec m_iv[2];
-    int m_iv_count;
+    file_entry *m_file;    //从文件缓存中获取的条目，响应发完后释放
+    char *m_file_address;  //小文件在缓存中的映射，大文件为NULL，用sendfile发送
+    int m_file_count;
+    content_entry *m_content; //内容缓存命中时的条目，此时m_file为NULL
+    int m_content_count;
+    int m_response_count;  //已排队等待发送的响应数
+    bool m_close_after;    //排队的响应发完后关闭连接
+    sql_job *m_job;        //注册的INSERT，从执行器取的，queue_responses遇到DB_REQUEST后由process最后一步提交
+    atomic<int> m_db_state; //不在init中重置：连接被定时器关闭后旧任务可能还没回来
+    bool m_db_ok;          //数据库线程回调时写入的执行结果，m_db_state为DB_DONE时有效
+    atomic<unsigned> m_generation; //每接受一个新连接加一，旧连接的任务结果回来时丢弃
+    uint64_t m_queued_ns;   //投递给线程池的时间，不在队列中时为0
+    string m_metrics;       ///metrics的正文，这批响应发完前不再改写，清空时保留容量
+    atomic<bool> m_idle;    //事件循环读到数据时清除，整批响应发完、重新等读事件之前置位
+    int m_range_count;
+    int m_seg_count;
+    int m_seg_idx;          //正在发送的段
+    off_t m_seg_sent;       //正在发送的段已经发出的字节数
     int cgi;        //是否启用的POST
     char *m_string; //存储请求头数据
-    int bytes_to_send;
-    int bytes_have_send;
+    off_t bytes_to_send;    //超过2GB的文件也不会溢出
+    off_t bytes_have_send;
 };
 
 #endif
@@ -0,0 +1,55 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// 请求解析用到的字节查找，参考picohttpparser的做法，一次比较16/32个字节
+// 编译时开了-mavx2就用AVX2一次比较32字节，否则用x86_64上总是可用的SSE2一次比较16字节，其他平台退回逐字节比较
+// 不足一个向量的尾部逐字节比较，不会读到len之外
+
+//返回buf[0, len)中第一个c的位置，找不到返回len
+inline size_t http_find_byte(const char *buf, size_t len, char c)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i pattern32 = _mm256_set1_epi8(c);
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(buf + i));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, pattern32));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i pattern16 = _mm_set1_epi8(c);
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern16));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < len; ++i)
+    {
+        if (buf[i] == c)
+            return i;
+    }
+    return len;
+}
+
+// 头部索引中的一项，记录的是相对读缓冲区开头的偏移，读缓冲区换大一档搬家后仍然有效
+struct http_header
+{
+    int name;
+    int name_len;
+    int value;
+    int value_len;
+};
+
+#endif
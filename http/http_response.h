@@ -0,0 +1,104 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// 生成响应时热路径上用到的格式化，代替逐个头部vsnprintf
+// 错误响应整条(状态行、头部、正文)在启动时拼好，发送时直接作为一个内存段；200响应只填Date、Content-Length和Connection
+
+// 启动时拼好的一条完整响应
+struct http_prebuilt
+{
+    char data[256];
+    int len;
+};
+
+inline void http_prebuild(http_prebuilt &out, int status, const char *title, const char *form, bool linger)
+{
+    out.len = snprintf(out.data, sizeof(out.data), "HTTP/1.1 %d %s\r\nContent-Length:%d\r\nConnection:%s\r\n\r\n%s",
+                       status, title, (int)strlen(form), linger ? "keep-alive" : "close", form);
+    if (out.len >= (int)sizeof(out.data))
+        out.len = sizeof(out.data) - 1;
+}
+
+// 把无符号整数写成十进制，返回位数；两位一查表，不走printf
+inline int http_format_uint(char *p, unsigned long long v)
+{
+    static const char digits[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char tmp[24];
+    char *q = tmp + sizeof(tmp);
+    while (v >= 100)
+    {
+        int i = (v % 100) * 2;
+        v /= 100;
+        *--q = digits[i + 1];
+        *--q = digits[i];
+    }
+    if (v >= 10)
+    {
+        int i = v * 2;
+        *--q = digits[i + 1];
+        *--q = digits[i];
+    }
+    else
+        *--q = '0' + v;
+    int n = tmp + sizeof(tmp) - q;
+    memcpy(p, q, n);
+    return n;
+}
+
+static const int HTTP_DATE_LEN = 29; //"Sun, 06 Nov 1994 08:49:37 GMT"
+
+// HTTP日期，每个线程按秒缓存，同一秒内的响应不再gmtime和strftime
+inline const char *http_date()
+{
+    static thread_local time_t t_date_sec = -1;
+    static thread_local char t_date[HTTP_DATE_LEN + 1];
+    time_t now = time(NULL);
+    if (now != t_date_sec)
+    {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        strftime(t_date, sizeof(t_date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        t_date_sec = now;
+    }
+    return t_date;
+}
+
+// 解析If-Modified-Since里的IMF-fixdate，格式不对返回-1
+inline time_t http_parse_date(const char *value)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end)
+        return -1;
+    return timegm(&tm);
+}
+
+// If-None-Match里有没有和etag相同的标签，"*"匹配任何标签；按弱比较，忽略W/前缀
+inline bool http_etag_match(const char *list, const char *etag)
+{
+    size_t elen = strlen(etag);
+    const char *p = list;
+    while (*p)
+    {
+        p += strspn(p, " \t,");
+        if (*p == '*')
+            return true;
+        if (p[0] == 'W' && p[1] == '/')
+            p += 2;
+        size_t n = strcspn(p, ", \t");
+        if (n == elen && strncmp(p, etag, elen) == 0)
+            return true;
+        p += n;
+    }
+    return false;
+}
+
+#endif
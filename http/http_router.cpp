@@ -0,0 +1,154 @@
+#include <string.h>
+#include "http_router.h"
+
+//方法掩码转成节点中的数组下标
+static const int method_bits[2] = {http_route::GET, http_route::POST};
+
+http_router::http_router() : m_root(new_node(""))
+{
+}
+
+http_router::~http_router()
+{
+    free_node(m_root);
+    for (size_t i = 0; i < m_routes.size(); ++i)
+        delete m_routes[i];
+}
+
+http_router *http_router::GetInstance()
+{
+    static http_router router;
+    return &router;
+}
+
+http_router::node *http_router::new_node(const string &label)
+{
+    node *n = new node;
+    n->label = label;
+    n->exact[0] = n->exact[1] = NULL;
+    n->prefix[0] = n->prefix[1] = NULL;
+    return n;
+}
+
+void http_router::free_node(node *n)
+{
+    for (size_t i = 0; i < n->children.size(); ++i)
+        free_node(n->children[i]);
+    delete n;
+}
+
+void http_router::add_file(const char *path, const char *file, int methods)
+{
+    http_route *route = new http_route;
+    route->kind = http_route::FILE;
+    route->methods = methods;
+    route->path = path;
+    route->target = file;
+    route->handler = -1;
+    add(route, false);
+}
+
+void http_router::add_dir(const char *prefix, const char *dir, int methods)
+{
+    http_route *route = new http_route;
+    route->kind = http_route::DIR;
+    route->methods = methods;
+    route->path = prefix;
+    route->target = dir;
+    route->handler = -1;
+    add(route, true);
+}
+
+void http_router::add_handler(const char *path, int handler, const char *target, const char *fallback, int methods)
+{
+    http_route *route = new http_route;
+    route->kind = http_route::HANDLER;
+    route->methods = methods;
+    route->path = path;
+    route->target = target;
+    route->fallback = fallback;
+    route->handler = handler;
+    add(route, false);
+}
+
+//沿公共前缀往下走，边只匹配了一部分时把它拆成两段；后注册的同路径同方法路由覆盖先注册的
+void http_router::add(http_route *route, bool is_prefix)
+{
+    m_routes.push_back(route);
+    node *n = m_root;
+    const char *p = route->path.c_str();
+    while (*p)
+    {
+        node *child = NULL;
+        for (size_t i = 0; i < n->children.size(); ++i)
+        {
+            if (n->children[i]->label[0] == *p)
+            {
+                child = n->children[i];
+                break;
+            }
+        }
+        if (!child)
+        {
+            child = new_node(p);
+            n->children.push_back(child);
+            n = child;
+            break;
+        }
+        size_t common = 0;
+        while (common < child->label.size() && p[common] && child->label[common] == p[common])
+            common++;
+        if (common < child->label.size())
+        {
+            node *split = new_node(child->label.substr(common));
+            split->children.swap(child->children);
+            memcpy(split->exact, child->exact, sizeof(child->exact));
+            memcpy(split->prefix, child->prefix, sizeof(child->prefix));
+            child->label.erase(common);
+            child->children.push_back(split);
+            child->exact[0] = child->exact[1] = NULL;
+            child->prefix[0] = child->prefix[1] = NULL;
+        }
+        n = child;
+        p += common;
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        if (!(route->methods & method_bits[i]))
+            continue;
+        if (is_prefix)
+            n->prefix[i] = route;
+        else
+            n->exact[i] = route;
+    }
+}
+
+const http_route *http_router::match(const char *url, int method) const
+{
+    int m = method == http_route::POST ? 1 : 0;
+    const http_route *best = m_root->prefix[m];
+    const node *n = m_root;
+    const char *p = url;
+    while (*p)
+    {
+        const node *child = NULL;
+        for (size_t i = 0; i < n->children.size(); ++i)
+        {
+            if (n->children[i]->label[0] == *p)
+            {
+                child = n->children[i];
+                break;
+            }
+        }
+        if (!child)
+            return best;
+        size_t len = child->label.size();
+        if (strncmp(p, child->label.c_str(), len) != 0)
+            return best;
+        p += len;
+        n = child;
+        if (n->prefix[m])
+            best = n->prefix[m];
+    }
+    return n->exact[m] ? n->exact[m] : best;
+}
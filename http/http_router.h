@@ -0,0 +1,66 @@
+#ifndef HTTP_ROUTER_H
+#define HTTP_ROUTER_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// 一条路由，启动时注册，之后只读；目标路径在注册时就拼好doc_root，请求时不再拼接
+struct http_route
+{
+    enum KIND
+    {
+        FILE = 0, //固定的一个文件，target是完整路径
+        DIR,      //前缀下的静态目录，target加上URL去掉前缀后的部分
+        HANDLER   //动态处理，handler是http_conn中处理函数表的下标
+    };
+    enum METHOD_MASK
+    {
+        GET = 1,
+        POST = 2,
+        ANY = GET | POST
+    };
+    int kind;
+    int methods;
+    string path;
+    string target;  //FILE、DIR的目标；HANDLER成功时返回的页面
+    string fallback; //HANDLER失败时返回的页面
+    int handler;
+};
+
+// 压缩前缀树(radix trie)，每条边是一段路径；精确路由挂在路径结束的节点上，DIR路由挂在前缀节点上
+// 匹配时沿树走一遍，精确路由优先，否则取经过的最长的DIR前缀；不分配内存
+class http_router
+{
+public:
+    static http_router *GetInstance();
+
+    void add_file(const char *path, const char *file, int methods = http_route::ANY);
+    //prefix以'/'结尾，dir不以'/'结尾：add_dir("/", doc_root)把"/a.jpg"映射到doc_root + "/a.jpg"
+    void add_dir(const char *prefix, const char *dir, int methods = http_route::ANY);
+    void add_handler(const char *path, int handler, const char *target, const char *fallback, int methods = http_route::ANY);
+
+    const http_route *match(const char *url, int method) const;
+
+private:
+    struct node
+    {
+        string label;
+        vector<node *> children;
+        const http_route *exact[2]; //按方法下标
+        const http_route *prefix[2];
+    };
+
+    http_router();
+    ~http_router();
+    void add(http_route *route, bool is_prefix);
+    static node *new_node(const string &label);
+    static void free_node(node *n);
+
+private:
+    node *m_root;
+    vector<http_route *> m_routes;
+};
+
+#endif
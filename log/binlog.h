@@ -0,0 +1,138 @@
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// 二进制日志的记录格式，写日志的一方(log.h)和离线解码工具(log_decode.cpp)共用
+// 文件由一串记录组成，每条记录第一个字节是类型：
+//   REC_HEADER  文件头，记录同一时刻的系统时间和单调时钟，解码时据此把时间戳换算成日期时间
+//   REC_FORMAT  格式串定义：编号、级别、格式串本身，一定出现在使用它的事件之前，换文件时会重新写一遍
+//   REC_EVENT   一条日志：格式串编号、单调时钟纳秒时间戳，后跟nargs个参数
+// 每个参数是一个类型字节加原始值：整数、无符号整数、指针各8字节，浮点数8字节double，字符串2字节长度加内容
+namespace binlog
+{
+enum
+{
+    REC_HEADER = 'H',
+    REC_FORMAT = 'F',
+    REC_EVENT = 'E'
+};
+enum
+{
+    ARG_INT = 'i',
+    ARG_UINT = 'u',
+    ARG_DOUBLE = 'd',
+    ARG_PTR = 'p',
+    ARG_STR = 's'
+};
+static const uint8_t TRUNCATED = 0xff; //参数放不下，只保留了格式串编号和时间戳
+
+struct __attribute__((packed)) file_header
+{
+    uint8_t type;
+    char magic[7]; //"TWSBLOG"
+    int64_t wall_ns;
+    int64_t mono_ns;
+};
+
+struct __attribute__((packed)) format_header
+{
+    uint8_t type;
+    uint8_t level;
+    uint16_t len;
+    uint32_t id;
+};
+
+struct __attribute__((packed)) event_header
+{
+    uint8_t type;
+    uint8_t level;
+    uint8_t nargs;
+    uint16_t len; //整条记录的长度，含本头部
+    uint32_t id;
+    uint64_t ts;
+};
+
+inline uint64_t mono_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+inline int64_t wall_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+//往固定大小的缓冲区里追加字节，放不下时置ok为false，之后的追加都忽略
+struct writer
+{
+    char *p;
+    char *end;
+    bool ok;
+    writer(char *begin, char *e) : p(begin), end(e), ok(true) {}
+    void put(const void *data, size_t len)
+    {
+        if (!ok || (size_t)(end - p) < len)
+        {
+            ok = false;
+            return;
+        }
+        memcpy(p, data, len);
+        p += len;
+    }
+    template <typename T>
+    void put_tagged(char tag, T v)
+    {
+        put(&tag, 1);
+        put(&v, sizeof(v));
+    }
+};
+
+//按参数的静态类型选择编码，printf能接受的类型都在这里有对应
+inline void encode(writer &w, bool v) { w.put_tagged(ARG_INT, (int64_t)v); }
+inline void encode(writer &w, char v) { w.put_tagged(ARG_INT, (int64_t)v); }
+inline void encode(writer &w, signed char v) { w.put_tagged(ARG_INT, (int64_t)v); }
+inline void encode(writer &w, short v) { w.put_tagged(ARG_INT, (int64_t)v); }
+inline void encode(writer &w, int v) { w.put_tagged(ARG_INT, (int64_t)v); }
+inline void encode(writer &w, long v) { w.put_tagged(ARG_INT, (int64_t)v); }
+inline void encode(writer &w, long long v) { w.put_tagged(ARG_INT, (int64_t)v); }
+inline void encode(writer &w, unsigned char v) { w.put_tagged(ARG_UINT, (uint64_t)v); }
+inline void encode(writer &w, unsigned short v) { w.put_tagged(ARG_UINT, (uint64_t)v); }
+inline void encode(writer &w, unsigned int v) { w.put_tagged(ARG_UINT, (uint64_t)v); }
+inline void encode(writer &w, unsigned long v) { w.put_tagged(ARG_UINT, (uint64_t)v); }
+inline void encode(writer &w, unsigned long long v) { w.put_tagged(ARG_UINT, (uint64_t)v); }
+inline void encode(writer &w, float v) { w.put_tagged(ARG_DOUBLE, (double)v); }
+inline void encode(writer &w, double v) { w.put_tagged(ARG_DOUBLE, v); }
+inline void encode(writer &w, const char *v)
+{
+    if (!v)
+        v = "(null)";
+    size_t len = strlen(v);
+    if (len > 0xffff)
+        len = 0xffff;
+    uint16_t n = (uint16_t)len;
+    char tag = ARG_STR;
+    w.put(&tag, 1);
+    w.put(&n, sizeof(n));
+    w.put(v, n);
+}
+inline void encode(writer &w, char *v) { encode(w, (const char *)v); }
+template <typename T>
+inline void encode(writer &w, T *v) { w.put_tagged(ARG_PTR, (uint64_t)(uintptr_t)v); }
+
+inline void encode_all(writer &w) {}
+template <typename T, typename... Rest>
+inline void encode_all(writer &w, T first, Rest... rest)
+{
+    encode(w, first);
+    encode_all(w, rest...);
+}
+} // namespace binlog
+
+#endif
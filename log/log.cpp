@@ -6,14 +6,55 @@
 #include <pthread.h>
 using namespace std;
 
+static const char *level_tag[] = {"[debug]:", "[info]:", "[warn]:", "[erro]:"};
+
+//每个线程的格式化缓冲区和环形缓冲区，线程退出时析构
+//格式化缓冲区直接释放；环形缓冲区里可能还有没刷出的日志，只标记关闭，由后台线程取完后摘下释放
+//线程池自适应增减线程时，退出的线程不会留下缓冲区
+struct thread_log
+{
+    char *buf;
+    log_ring *ring;
+    ~thread_log()
+    {
+        delete[] buf;
+        buf = NULL;
+        if (ring)
+            ring->close();
+        ring = NULL;
+    }
+};
+static thread_local thread_log t_log = {NULL, NULL};
+
+//按秒缓存的时间前缀
+static thread_local time_t t_sec = -1;
+static thread_local struct tm t_tm;
+static thread_local char t_prefix[32];
+static thread_local int t_prefix_len = 0;
+
 Log::Log()
 {
     m_count = 0;
+    m_today = 0;
     m_is_async = false;
+    m_level = 0;
+    m_fp = NULL;
+    m_batch = NULL;
+    m_stop = false;
+    m_binary = false;
 }
 
 Log::~Log()
 {
+    if (m_is_async)
+    {
+        m_stop = true;
+        pthread_join(m_tid, NULL);
+        drain();
+        for (size_t i = 0; i < m_rings.size(); ++i)
+            delete m_rings[i];
+        delete[] m_batch;
+    }
     if (m_fp != NULL)
     {
         fclose(m_fp);
@@ -21,28 +62,18 @@ Log::~Log()
 }
 
 //异步需要设置阻塞队列的长度，同步不需要设置
-bool Log::init(const char *file_name, int log_buf_size, int split_lines, int max_queue_size)
+bool Log::init(const char *file_name, int log_buf_size, int split_lines, int max_queue_size, int flush_interval_ms, bool binary)
 {
-    //如果设置了max_queue_size,则设置为异步
-    if (max_queue_size >= 1)
-    {
-        m_is_async = true;
-        m_log_queue = new block_queue<string>(max_queue_size);
-        pthread_t tid;
-        //flush_log_thread为回调函数,这里表示创建线程异步写日志
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
-    }
-
+    m_binary = binary;
     m_log_buf_size = log_buf_size;
-    m_buf = new char[m_log_buf_size];
-    memset(m_buf, '\0', m_log_buf_size);
     m_split_lines = split_lines;
+    m_flush_interval = flush_interval_ms > 0 ? flush_interval_ms : 1;
 
     time_t t = time(NULL);
     struct tm *sys_tm = localtime(&t);
     struct tm my_tm = *sys_tm;
 
- 
+
     const char *p = strrchr(file_name, '/');
     char log_full_name[256] = {0};
 
@@ -59,55 +90,58 @@ bool Log::init(const char *file_name, int log_buf_size, int split_lines, int max
 
     m_today = my_tm.tm_mday;
 
+    //二进制日志写到加了.bin后缀的文件里，和文本日志区分开
+    if (m_binary)
+        strcat(log_full_name, ".bin");
     m_fp = fopen(log_full_name, "a");
     if (m_fp == NULL)
     {
         return false;
     }
+    if (m_binary)
+        write_bin_preamble();
 
+    //如果设置了max_queue_size,则设置为异步
+    if (max_queue_size >= 1)
+    {
+        m_is_async = true;
+        m_ring_size = (size_t)max_queue_size * log_buf_size;
+        if (m_ring_size < 64 * 1024)
+            m_ring_size = 64 * 1024;
+        m_ring_size = log_ring(m_ring_size).capacity();
+        m_batch = new char[m_ring_size];
+        //flush_log_thread为回调函数,这里表示创建线程异步写日志
+        pthread_create(&m_tid, NULL, flush_log_thread, NULL);
+    }
     return true;
 }
 
-void Log::write_log(int level, const char *format, ...)
+//当前线程的环形缓冲区，第一次写日志时创建并登记，之后不再加锁
+log_ring *Log::thread_ring()
 {
-    struct timeval now = {0, 0};
-    gettimeofday(&now, NULL);
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
-    char s[16] = {0};
-    switch (level)
+    if (!t_log.ring)
     {
-    case 0:
-        strcpy(s, "[debug]:");
-        break;
-    case 1:
-        strcpy(s, "[info]:");
-        break;
-    case 2:
-        strcpy(s, "[warn]:");
-        break;
-    case 3:
-        strcpy(s, "[erro]:");
-        break;
-    default:
-        strcpy(s, "[info]:");
-        break;
+        t_log.ring = new log_ring(m_ring_size);
+        m_mutex.lock();
+        m_rings.push_back(t_log.ring);
+        m_mutex.unlock();
     }
-    //写入一个log，对m_count++, m_split_lines最大行数
-    m_mutex.lock();
-    m_count++;
+    return t_log.ring;
+}
 
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) //everyday log
+//按天或者超过最大行数时换一个日志文件
+void Log::rotate(const struct tm &my_tm, long long count)
+{
+    m_mutex.lock();
+    if (m_today != my_tm.tm_mday || count % m_split_lines == 0)
     {
-        
         char new_log[256] = {0};
         fflush(m_fp);
         fclose(m_fp);
         char tail[16] = {0};
-       
+
         snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
-       
+
         if (m_today != my_tm.tm_mday)
         {
             snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
@@ -116,49 +150,175 @@ void Log::write_log(int level, const char *format, ...)
         }
         else
         {
-            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
+            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, count / m_split_lines);
         }
+        if (m_binary)
+            strcat(new_log, ".bin");
         m_fp = fopen(new_log, "a");
+        if (m_binary)
+            write_bin_preamble();
     }
- 
     m_mutex.unlock();
+}
 
-    va_list valst;
-    va_start(valst, format);
+//二进制日志文件头：时间基准和目前登记过的所有格式串，每个文件都能单独解码，调用时持有m_mutex或者还没有其他线程
+void Log::write_bin_preamble()
+{
+    binlog::file_header head;
+    head.type = binlog::REC_HEADER;
+    memcpy(head.magic, "TWSBLOG", 7);
+    head.wall_ns = binlog::wall_ns();
+    head.mono_ns = binlog::mono_ns();
+    fwrite(&head, sizeof(head), 1, m_fp);
+    for (size_t i = 0; i < m_formats.size(); ++i)
+    {
+        binlog::format_header fh;
+        fh.type = binlog::REC_FORMAT;
+        fh.level = (uint8_t)m_format_levels[i];
+        fh.len = (uint16_t)m_formats[i].size();
+        fh.id = (uint32_t)i;
+        fwrite(&fh, sizeof(fh), 1, m_fp);
+        fwrite(m_formats[i].data(), 1, fh.len, m_fp);
+    }
+}
 
-    string log_str;
+//格式串定义直接写进文件，排在之后所有用到它的事件前面(事件要么同步写，要么还在环形缓冲区里等刷盘)
+int Log::register_format(int level, const char *format)
+{
     m_mutex.lock();
-
-    //写入的具体时间内容格式
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
-                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
-    
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
-    m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
-
+    int id = m_formats.size();
+    m_formats.push_back(format);
+    m_format_levels.push_back(level);
+    binlog::format_header fh;
+    fh.type = binlog::REC_FORMAT;
+    fh.level = (uint8_t)level;
+    fh.len = (uint16_t)m_formats[id].size();
+    fh.id = (uint32_t)id;
+    fwrite(&fh, sizeof(fh), 1, m_fp);
+    fwrite(format, 1, fh.len, m_fp);
     m_mutex.unlock();
+    return id;
+}
 
-    if (m_is_async && !m_log_queue->full())
-    {
-        m_log_queue->push(log_str);
-    }
-    else
+char *Log::record_buf()
+{
+    if (!t_log.buf)
+        t_log.buf = new char[m_log_buf_size];
+    return t_log.buf;
+}
+
+//同一秒内复用已经分解好的日期时间，不必每行都localtime
+static void refresh_time(time_t sec)
+{
+    if (sec != t_sec)
     {
-        m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
-        m_mutex.unlock();
+        localtime_r(&sec, &t_tm);
+        t_sec = sec;
+        t_prefix_len = snprintf(t_prefix, sizeof(t_prefix), "%d-%02d-%02d %02d:%02d:%02d",
+                                t_tm.tm_year + 1900, t_tm.tm_mon + 1, t_tm.tm_mday,
+                                t_tm.tm_hour, t_tm.tm_min, t_tm.tm_sec);
     }
+}
+
+//一条编码好的二进制记录：计数、按需换文件，然后和文本日志一样进环形缓冲区或者同步写
+void Log::commit(const char *rec, size_t len)
+{
+    refresh_time(time(NULL));
+    long long count = ++m_count;
+    if (m_today != t_tm.tm_mday || count % m_split_lines == 0)
+        rotate(t_tm, count);
+
+    if (m_is_async && thread_ring()->push(rec, len))
+        return;
+
+    m_mutex.lock();
+    fwrite(rec, 1, len, m_fp);
+    m_mutex.unlock();
+}
+
+void Log::write_log(int level, const char *format, ...)
+{
+    if (!enabled(level))
+        return;
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    refresh_time(now.tv_sec);
+    const char *s = level_tag[level >= 0 && level <= 3 ? level : 1];
+
+    //写入一个log，对m_count++, m_split_lines最大行数
+    long long count = ++m_count;
+    if (m_today != t_tm.tm_mday || count % m_split_lines == 0) //everyday log
+        rotate(t_tm, count);
 
+    //每个线程格式化到自己的缓冲区，不再共用m_buf
+    record_buf();
+
+    //写入的具体时间内容格式
+    int n = snprintf(t_log.buf, 48, "%s.%06ld %s ", t_prefix, now.tv_usec, s);
+
+    va_list valst;
+    va_start(valst, format);
+    //超长的内容截断，留出换行符和'\0'的位置
+    int m = vsnprintf(t_log.buf + n, m_log_buf_size - n - 1, format, valst);
     va_end(valst);
+    if (m > m_log_buf_size - n - 2)
+        m = m_log_buf_size - n - 2;
+    t_log.buf[n + m] = '\n';
+    t_log.buf[n + m + 1] = '\0';
+
+    //异步时放进本线程的环形缓冲区；缓冲区满了(刷盘跟不上)退回同步写，不丢日志
+    if (m_is_async && thread_ring()->push(t_log.buf, n + m + 1))
+        return;
+
+    m_mutex.lock();
+    fwrite(t_log.buf, 1, n + m + 1, m_fp);
+    m_mutex.unlock();
 }
 
 void Log::flush(void)
 {
+    if (m_is_async)
+        return;
     m_mutex.lock();
     //强制刷新写入流缓冲区
     fflush(m_fp);
     m_mutex.unlock();
 }
+
+//把所有线程环形缓冲区里的日志取出来，每个缓冲区一次fwrite，最后一次fflush
+//所属线程已经退出的缓冲区先看关闭标志再取，取完后摘下释放
+void Log::drain()
+{
+    m_mutex.lock();
+    for (size_t i = 0; i < m_rings.size();)
+    {
+        log_ring *ring = m_rings[i];
+        bool closed = ring->closed();
+        size_t len = ring->pop(m_batch);
+        if (len > 0)
+            fwrite(m_batch, 1, len, m_fp);
+        if (!closed)
+        {
+            ++i;
+            continue;
+        }
+        delete ring;
+        m_rings[i] = m_rings.back();
+        m_rings.pop_back();
+    }
+    fflush(m_fp);
+    m_mutex.unlock();
+}
+
+//后台线程，每隔刷盘间隔批量写一次
+void Log::async_write_log()
+{
+    struct timespec ts;
+    ts.tv_sec = m_flush_interval / 1000;
+    ts.tv_nsec = (m_flush_interval % 1000) * 1000000L;
+    while (!m_stop)
+    {
+        nanosleep(&ts, NULL);
+        drain();
+    }
+}
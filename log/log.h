@@ -4,12 +4,24 @@
 #include <stdio.h>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <atomic>
 #include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
 #include <pthread.h>
-#include "block_queue.h"
+#include "../lock/locker.h"
+#include "log_ring.h"
+#include "binlog.h"
 
 using namespace std;
 
+//编译期的日志级别下限，低于它的LOG_*在编译时就被去掉，例如-DLOG_LEVEL=1去掉所有LOG_DEBUG
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 0
+#endif
+
 class Log
 {
 public:
@@ -23,47 +35,113 @@ public:
     static void *flush_log_thread(void *args)
     {
         Log::get_instance()->async_write_log();
+        return NULL;
     }
-    //可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
-    bool init(const char *file_name, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0);
+    //可选择的参数有日志文件、日志缓冲区大小、最大行数、最长日志条队列、异步刷盘间隔(毫秒)以及是否二进制日志
+    //max_queue_size大于0时为异步，每个线程的环形缓冲区至少能放下max_queue_size条最长的日志
+    //二进制日志不在写日志的线程上格式化，只记录格式串编号、单调时钟时间戳和原始参数，用log_decode离线还原成文本
+    bool init(const char *file_name, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0, int flush_interval_ms = 100, bool binary = false);
 
     void write_log(int level, const char *format, ...);
 
+    bool binary() const
+    {
+        return m_binary;
+    }
+    //登记一个格式串，返回它的编号；每个LOG_*调用点只在第一次执行时登记一次
+    int register_format(int level, const char *format);
+    //二进制日志：把参数按类型原样编码在格式串编号后面
+    template <typename... Args>
+    void write_bin(int level, int id, Args... args)
+    {
+        char *buf = record_buf();
+        binlog::writer w(buf, buf + m_log_buf_size);
+        binlog::event_header head;
+        head.type = binlog::REC_EVENT;
+        head.level = (uint8_t)level;
+        head.nargs = (uint8_t)sizeof...(args);
+        head.id = (uint32_t)id;
+        head.ts = binlog::mono_ns();
+        w.put(&head, sizeof(head));
+        binlog::encode_all(w, args...);
+        //参数太长放不下的记录截断成没有参数的形式，解码时会标出来
+        if (!w.ok)
+        {
+            head.nargs = binlog::TRUNCATED;
+            memcpy(buf, &head, sizeof(head));
+            w.p = buf + sizeof(head);
+        }
+        head.len = (uint16_t)(w.p - buf);
+        memcpy(buf, &head, sizeof(head));
+        commit(buf, w.p - buf);
+    }
+
+    //同步模式下fflush；异步模式下由后台线程按刷盘间隔批量写入，这里什么都不做
     void flush(void);
 
+    //运行期的日志级别下限，低于它的日志不格式化直接丢弃
+    void set_level(int level)
+    {
+        m_level.store(level, memory_order_relaxed);
+    }
+    bool enabled(int level) const
+    {
+        return level >= m_level.load(memory_order_relaxed);
+    }
+
 private:
     Log();
     virtual ~Log();
-    void *async_write_log()
-    {
-        string single_log;
-        //从阻塞队列中取出一个日志string，写入文件
-        while (m_log_queue->pop(single_log))
-        {
-            m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
-        }
-    }
+    void async_write_log();
+    log_ring *thread_ring();
+    void drain();
+    void rotate(const struct tm &my_tm, long long count);
+    char *record_buf();
+    void commit(const char *rec, size_t len);
+    void write_bin_preamble();
 
 private:
     char dir_name[128]; //路径名
     char log_name[128]; //log文件名
     int m_split_lines;  //日志最大行数
     int m_log_buf_size; //日志缓冲区大小
-    long long m_count;  //日志行数记录
-    int m_today;        //因为按天分类,记录当前时间是那一天
+    atomic<long long> m_count;  //日志行数记录
+    atomic<int> m_today;        //因为按天分类,记录当前时间是那一天
     FILE *m_fp;         //打开log的文件指针
-    char *m_buf;
-    block_queue<string> *m_log_queue; //阻塞队列
     bool m_is_async;                  //是否同步标志位
+    atomic<int> m_level;
+    size_t m_ring_size;               //每个线程环形缓冲区的大小
+    int m_flush_interval;             //异步刷盘间隔，毫秒
+    vector<log_ring *> m_rings;       //所有线程的环形缓冲区，注册时加锁，后台线程遍历时加锁；线程退出后取完即摘下
+    char *m_batch;                    //后台线程批量写入用的缓冲区
+    pthread_t m_tid;
+    atomic<bool> m_stop;
+    bool m_binary;                    //二进制日志
+    vector<string> m_formats;         //已登记的格式串，换文件时重新写到新文件开头
+    vector<int> m_format_levels;
     locker m_mutex;
 };
 
 
-#define LOG_DEBUG(format, ...) Log::get_instance()->write_log(0, format, ##__VA_ARGS__)
-#define LOG_INFO(format, ...) Log::get_instance()->write_log(1, format, ##__VA_ARGS__)
-#define LOG_WARN(format, ...) Log::get_instance()->write_log(2, format, ##__VA_ARGS__)
-#define LOG_ERROR(format, ...) Log::get_instance()->write_log(3, format, ##__VA_ARGS__)
+//二进制模式下每个调用点用一个局部静态变量记住格式串编号，C++11保证它只初始化一次
+#define LOG_WRITE(level, format, ...)                                                              \
+    do                                                                                             \
+    {                                                                                              \
+        if (level >= LOG_LEVEL && Log::get_instance()->enabled(level))                             \
+        {                                                                                          \
+            if (Log::get_instance()->binary())                                                     \
+            {                                                                                      \
+                static int log_format_id = Log::get_instance()->register_format(level, format);   \
+                Log::get_instance()->write_bin(level, log_format_id, ##__VA_ARGS__);              \
+            }                                                                                      \
+            else                                                                                   \
+                Log::get_instance()->write_log(level, format, ##__VA_ARGS__);                      \
+        }                                                                                          \
+    } while (0)
+
+#define LOG_DEBUG(format, ...) LOG_WRITE(0, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_WRITE(1, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_WRITE(2, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_WRITE(3, format, ##__VA_ARGS__)
 
 #endif
@@ -0,0 +1,213 @@
+// 二进制日志解码工具：把Log以二进制模式写出的文件还原成和文本日志一样的格式
+// 用法：./log_decode 2024_01_01_ServerLog.bin [...]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <time.h>
+#include "binlog.h"
+
+using namespace std;
+
+static const char *level_tag[] = {"[debug]:", "[info]:", "[warn]:", "[erro]:"};
+
+struct arg
+{
+    char tag;
+    int64_t i;
+    double d;
+    string s;
+};
+
+//按格式串把参数逐个格式化，每个转换说明单独交给snprintf，长度修饰符换成和参数类型一致的
+static string render(const string &fmt, const vector<arg> &args)
+{
+    string out;
+    size_t next = 0;
+    char piece[4096];
+    for (size_t i = 0; i < fmt.size(); ++i)
+    {
+        if (fmt[i] != '%')
+        {
+            out += fmt[i];
+            continue;
+        }
+        if (i + 1 < fmt.size() && fmt[i + 1] == '%')
+        {
+            out += '%';
+            ++i;
+            continue;
+        }
+        string spec = "%";
+        size_t j = i + 1;
+        while (j < fmt.size() && strchr("-+ #0123456789.*", fmt[j]))
+        {
+            //'*'宽度和精度也是参数
+            if (fmt[j] == '*' && next < args.size())
+                spec += to_string(args[next++].i);
+            else
+                spec += fmt[j];
+            ++j;
+        }
+        while (j < fmt.size() && strchr("hlLqjzt", fmt[j]))
+            ++j;
+        if (j >= fmt.size())
+            break;
+        char conv = fmt[j];
+        i = j;
+        if (next >= args.size())
+        {
+            out += "(missing)";
+            continue;
+        }
+        const arg &a = args[next++];
+        if (strchr("diouxXc", conv))
+        {
+            spec += conv == 'c' ? "c" : string("ll") + conv;
+            if (conv == 'c')
+                snprintf(piece, sizeof(piece), spec.c_str(), (int)a.i);
+            else
+                snprintf(piece, sizeof(piece), spec.c_str(), (long long)a.i);
+        }
+        else if (strchr("fFeEgGaA", conv))
+        {
+            spec += conv;
+            snprintf(piece, sizeof(piece), spec.c_str(), a.tag == binlog::ARG_DOUBLE ? a.d : (double)a.i);
+        }
+        else if (conv == 's')
+        {
+            //字符串可能比piece长，不带宽度精度时直接拼接
+            if (spec == "%" && a.tag == binlog::ARG_STR)
+            {
+                out += a.s;
+                continue;
+            }
+            spec += 's';
+            snprintf(piece, sizeof(piece), spec.c_str(), a.tag == binlog::ARG_STR ? a.s.c_str() : "(bad arg)");
+        }
+        else if (conv == 'p')
+        {
+            snprintf(piece, sizeof(piece), "%p", (void *)(uintptr_t)a.i);
+        }
+        else
+        {
+            snprintf(piece, sizeof(piece), "%%%c", conv);
+        }
+        out += piece;
+    }
+    return out;
+}
+
+static bool decode(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+    {
+        perror(path);
+        return false;
+    }
+    vector<char> data;
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        data.insert(data.end(), chunk, chunk + n);
+    fclose(fp);
+
+    vector<string> formats;
+    int64_t wall_base = 0, mono_base = 0;
+    size_t pos = 0;
+    while (pos < data.size())
+    {
+        const char *p = &data[pos];
+        size_t left = data.size() - pos;
+        if (*p == binlog::REC_HEADER && left >= sizeof(binlog::file_header))
+        {
+            binlog::file_header h;
+            memcpy(&h, p, sizeof(h));
+            wall_base = h.wall_ns;
+            mono_base = h.mono_ns;
+            pos += sizeof(h);
+        }
+        else if (*p == binlog::REC_FORMAT && left >= sizeof(binlog::format_header))
+        {
+            binlog::format_header h;
+            memcpy(&h, p, sizeof(h));
+            if (left < sizeof(h) + h.len)
+                break;
+            if (formats.size() <= h.id)
+                formats.resize(h.id + 1);
+            formats[h.id].assign(p + sizeof(h), h.len);
+            pos += sizeof(h) + h.len;
+        }
+        else if (*p == binlog::REC_EVENT && left >= sizeof(binlog::event_header))
+        {
+            binlog::event_header h;
+            memcpy(&h, p, sizeof(h));
+            if (h.len < sizeof(h) || left < h.len)
+                break;
+            vector<arg> args;
+            const char *q = p + sizeof(h);
+            const char *end = p + h.len;
+            for (int k = 0; h.nargs != binlog::TRUNCATED && k < h.nargs && q < end; ++k)
+            {
+                arg a;
+                a.tag = *q++;
+                a.i = 0;
+                a.d = 0;
+                if (a.tag == binlog::ARG_STR)
+                {
+                    uint16_t len;
+                    memcpy(&len, q, sizeof(len));
+                    q += sizeof(len);
+                    a.s.assign(q, len);
+                    q += len;
+                }
+                else if (a.tag == binlog::ARG_DOUBLE)
+                {
+                    memcpy(&a.d, q, sizeof(a.d));
+                    q += sizeof(a.d);
+                }
+                else
+                {
+                    memcpy(&a.i, q, sizeof(a.i));
+                    q += sizeof(a.i);
+                }
+                args.push_back(a);
+            }
+
+            int64_t ns = wall_base + ((int64_t)h.ts - mono_base);
+            time_t sec = ns / 1000000000;
+            struct tm tm;
+            localtime_r(&sec, &tm);
+            printf("%d-%02d-%02d %02d:%02d:%02d.%06ld %s ", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                   tm.tm_hour, tm.tm_min, tm.tm_sec, (long)(ns % 1000000000 / 1000), level_tag[h.level <= 3 ? h.level : 1]);
+            if (h.id >= formats.size())
+                printf("(unknown format %u)\n", h.id);
+            else if (h.nargs == binlog::TRUNCATED)
+                printf("%s (arguments truncated)\n", formats[h.id].c_str());
+            else
+                printf("%s\n", render(formats[h.id], args).c_str());
+            pos += h.len;
+        }
+        else
+        {
+            fprintf(stderr, "%s: corrupt record at offset %zu\n", path, pos);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc <= 1)
+    {
+        printf("usage: %s log_file.bin ...\n", argv[0]);
+        return 1;
+    }
+    bool ok = true;
+    for (int i = 1; i < argc; ++i)
+        ok = decode(argv[i]) && ok;
+    return ok ? 0 : 1;
+}
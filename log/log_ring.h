@@ -0,0 +1,90 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <atomic>
+#include <string.h>
+#include <stddef.h>
+
+// 单生产者单消费者的字节环形缓冲区，每个写日志的线程一个
+// 生产者是写日志的线程，只推进m_head；消费者是后台刷盘线程，只推进m_tail，不需要锁
+// 每次push的是完整的一行，pop总是取走全部已写入的数据，所以取出的内容总是以行结尾
+class log_ring
+{
+public:
+    //容量向上取整为2的幂
+    log_ring(size_t size)
+    {
+        size_t cap = 4096;
+        while (cap < size)
+            cap <<= 1;
+        m_mask = cap - 1;
+        m_buf = new char[cap];
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+        m_closed.store(false, std::memory_order_relaxed);
+    }
+    ~log_ring()
+    {
+        delete[] m_buf;
+    }
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+    //空间不够时返回false，由调用者决定怎么处理这一行
+    bool push(const char *data, size_t len)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        if (capacity() - (head - tail) < len)
+            return false;
+        size_t pos = head & m_mask;
+        size_t first = len < capacity() - pos ? len : capacity() - pos;
+        memcpy(m_buf + pos, data, first);
+        memcpy(m_buf, data + first, len - first);
+        m_head.store(head + len, std::memory_order_release);
+        return true;
+    }
+
+    //生产者线程退出时调用，之后不再push
+    void close()
+    {
+        m_closed.store(true, std::memory_order_release);
+    }
+    //消费者先看到关闭再pop，就能取到生产者关闭前写入的全部数据
+    bool closed() const
+    {
+        return m_closed.load(std::memory_order_acquire);
+    }
+
+    //把已写入的数据全部拷到out(至少capacity()字节)，返回字节数
+    size_t pop(char *out)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_acquire);
+        size_t len = head - tail;
+        if (len == 0)
+            return 0;
+        size_t pos = tail & m_mask;
+        size_t first = len < capacity() - pos ? len : capacity() - pos;
+        memcpy(out, m_buf + pos, first);
+        memcpy(out + first, m_buf, len - first);
+        m_tail.store(head, std::memory_order_release);
+        return len;
+    }
+
+private:
+    static const size_t CACHELINE = 64;
+    char *m_buf;
+    size_t m_mask;
+    char m_pad0[CACHELINE];
+    std::atomic<size_t> m_head;
+    char m_pad1[CACHELINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_tail;
+    char m_pad2[CACHELINE - sizeof(std::atomic<size_t>)];
+    std::atomic<bool> m_closed;
+};
+
+#endif
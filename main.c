@@ -8,370 +8,228 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <pthread.h>
 
 #include "./lock/locker.h"
 #include "./threadpool/threadpool.h"
 #include "./timer/lst_timer.h"
 #include "./http/http_conn.h"
+#include "./reactor/reactor.h"
+#include "./reactor/uring_reactor.h"
+#include "./reactor/handoff.h"
 #include "./log/log.h"
 #include "./CGImysql/sql_connection_pool.h"
+#include "./CGImysql/sql_executor.h"
+#include "./metrics/metrics.h"
+#include "./admission/admission.h"
+#include "./config/config.h"
+#include "./tls/tls_server.h"
+
+// 原来的SYNLOG/ASYNLOG、LISTQUEUE/LOCKFREEQUEUE/WORKSTEALQUEUE、MULTIREACTOR/SINGLEREACTOR、URINGREACTOR、CLIENTLIMIT
+// 都改成了运行时配置，见config/config.h：./server [port] [-f server.conf] [--key=value]...
+
+//每个reactor拥有自己的监听socket、内核事件表、信号管道和定时器链表
+//多reactor时监听socket开启SO_REUSEPORT；R为reactor或uring_reactor
+template <typename R>
+int run_reactors(int reactor_number, int port, threadpool<http_conn> *pool, http_conn *users)
+{
+    R *reactors = new R[reactor_number];
+    for (int i = 0; i < reactor_number; ++i)
+    {
+        if (!reactors[i].init(i, port, reactor_number > 1, pool, users))
+        {
+            LOG_ERROR("reactor %d init failure, errno is:%d", i, errno);
+            return 1;
+        }
+    }
 
-#define MAX_FD 65536           //最大文件描述符
-#define MAX_EVENT_NUMBER 10000 //最大事件数
-#define TIMESLOT 5             //最小超时单位
+    reactor::addsig(SIGTERM, reactor::sig_handler, false);
+    reactor::addsig(SIGUSR2, reactor::sig_handler);
+    reactor::addsig(SIGCHLD, reactor::sig_handler);
+    //监听socket都已经打开，是SIGUSR2交接启动的就让老进程开始排空
+    handoff::ready();
 
-#define SYNLOG  //同步写日志
-//#define ASYNLOG //异步写日志
+    //0号reactor运行在主线程，其余的各自一个线程
+    pthread_t *tids = new pthread_t[reactor_number];
+    for (int i = 1; i < reactor_number; ++i)
+    {
+        if (pthread_create(tids + i, NULL, R::worker, reactors + i) != 0)
+        {
+            LOG_ERROR("%s", "create reactor thread failure");
+            return 1;
+        }
+    }
 
-//#define listenfdET //边缘触发非阻塞
-#define listenfdLT //水平触发阻塞
+    reactors[0].eventloop();
 
-//这三个函数在http_conn.cpp中定义，改变链接属性
-extern int addfd(int epollfd, int fd, bool one_shot);
-extern int remove(int epollfd, int fd);
-extern int setnonblocking(int fd);
+    for (int i = 1; i < reactor_number; ++i)
+        pthread_join(tids[i], NULL);
 
-//设置定时器相关参数
-static int pipefd[2];
-static sort_timer_lst timer_lst;
-static int epollfd = 0;
+    //握手线程会往reactor的inbox里交回连接，先停下来；没完成的握手直接关闭
+    tls_server::GetInstance()->stop();
+    //reactor都退出后不会再有新请求；先等数据库线程做完，它的回调还会投递线程池，再停线程池
+    //工作线程可能还在处理请求、通过notify访问reactor，停下来之前不能释放reactor
+    sql_executor::GetInstance()->drain(1000);
+    if (!pool->stop(1000))
+    {
+        LOG_WARN("%s", "threadpool stop timeout");
+        return 0;
+    }
 
-//信号处理函数
-void sig_handler(int sig)
+    delete[] tids;
+    delete[] reactors;
+    return 0;
+}
+
+//GET /metrics读时计算的仪表
+static long active_connections()
 {
-    //为保证函数的可重入性，保留原来的errno
-    int save_errno = errno;
-    int msg = sig;
-    send(pipefd[1], (char *)&msg, 1, 0);
-    errno = save_errno;
+    return http_conn::m_user_count.load();
 }
 
-//设置信号函数
-void addsig(int sig, void(handler)(int), bool restart = true)
+static long pool_queue_depth()
 {
-    struct sigaction sa;
-    memset(&sa, '\0', sizeof(sa));
-    sa.sa_handler = handler;
-    if (restart)
-        sa.sa_flags |= SA_RESTART;
-    sigfillset(&sa.sa_mask);
-    assert(sigaction(sig, &sa, NULL) != -1);
+    return http_conn::m_pool ? http_conn::m_pool->queue_depth() : 0;
 }
 
-//定时处理任务，重新定时以不断触发SIGALRM信号
-void timer_handler()
+static long db_free_connections()
 {
-    timer_lst.tick();
-    alarm(TIMESLOT);
+    return connection_pool::GetInstance()->GetFreeConn();
 }
 
-//定时器回调函数，删除非活动连接在socket上的注册事件，并关闭
-void cb_func(client_data *user_data)
+static long db_open_connections()
 {
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
-    assert(user_data);
-    close(user_data->sockfd);
-    http_conn::m_user_count--;
-    LOG_INFO("close fd %d", user_data->sockfd);
-    Log::get_instance()->flush();
+    return connection_pool::GetInstance()->GetOpenConn();
 }
 
-void show_error(int connfd, const char *info)
+static long pool_threads()
 {
-    printf("%s", info);
-    send(connfd, info, strlen(info), 0);
-    close(connfd);
+    return http_conn::m_pool ? http_conn::m_pool->thread_count() : 0;
 }
 
 int main(int argc, char *argv[])
 {
-#ifdef ASYNLOG
-    Log::get_instance()->init("ServerLog", 2000, 800000, 8); //异步日志模型
-#endif
-
-#ifdef SYNLOG
-    Log::get_instance()->init("ServerLog", 2000, 800000, 0); //同步日志模型
-#endif
-
-    if (argc <= 1)
-    {
-        printf("usage: %s ip_address port_number\n", basename(argv[0]));
+    config conf;
+    if (!conf.parse(argc, argv))
         return 1;
-    }
-
-    int port = atoi(argv[1]);
-
-    addsig(SIGPIPE, SIG_IGN);
+    //SIGUSR2交接启动时从环境变量读出继承来的监听socket
+    handoff::init(argv);
+
+    if (conf.log_mode == "async")
+        Log::get_instance()->init(conf.log_file.c_str(), 2000, 800000, 8, 100); //异步日志模型，每100ms批量刷盘
+    else if (conf.log_mode == "binary")
+        Log::get_instance()->init(conf.log_file.c_str(), 2000, 800000, 8, 100, true); //异步二进制日志模型，不在工作线程上格式化，用log_decode还原成文本
+    else
+        Log::get_instance()->init(conf.log_file.c_str(), 2000, 800000, 0); //同步日志模型
+    Log::get_instance()->set_level(conf.log_level);
+    conf.log();
+
+    //连接表、定时器表按max_fd分配，要在创建reactor之前设置
+    reactor::m_max_fd = conf.max_fd;
+    reactor::m_idle_ms = conf.idle_timeout * 1000;
+    reactor::m_listen_et = conf.listen_et;
+    reactor::m_drain_ms = conf.drain_timeout * 1000;
+    reactor::m_tls_port = conf.tls_port;
+    http_conn::m_conn_et = conf.conn_et;
+    http_conn::m_worker_write = conf.write_mode == "worker";
+    http_conn::m_register_durable = conf.register_mode == "durable";
+    http_conn::m_shed_queue_ms = conf.shed_queue_ms;
+
+    reactor::addsig(SIGPIPE, SIG_IGN);
 
     //创建数据库连接池
     connection_pool *connPool = connection_pool::GetInstance();
-    connPool->init("localhost", "root", "root", "qgydb", 3306, 8);
+    //平时保持db_conns个连接，等待时扩到db_conns_max个；后台线程ping空闲连接，断了的重连
+    if (!connPool->init(conf.db_host, conf.db_user, conf.db_password, conf.db_name, conf.db_port, conf.db_conns,
+                        conf.db_conns_max, conf.db_ping_interval, conf.db_wait_timeout))
+    {
+        LOG_ERROR("%s", "mysql connection pool init failure");
+        Log::get_instance()->flush();
+        return 1;
+    }
 
     //创建线程池
     //线程池类实例化时，模板参数T取http_conn，即线程池实例中的每个T request
     //都是一个http_conn类
+    int queue_mode = threadpool<http_conn>::LIST_QUEUE;
+    if (conf.queue == "lockfree")
+        queue_mode = threadpool<http_conn>::LOCKFREE_QUEUE;
+    else if (conf.queue == "worksteal")
+        queue_mode = threadpool<http_conn>::WORKSTEAL_QUEUE;
+    //auto：工作窃取按连接固定线程，绑到CPU才能留住cache；其他队列不绑
+    int affinity_mode = threadpool<http_conn>::AFFINITY_NONE;
+    if (conf.affinity == "cpu" || (conf.affinity == "auto" && conf.queue == "worksteal"))
+        affinity_mode = threadpool<http_conn>::AFFINITY_CPU;
+    else if (conf.affinity == "numa")
+        affinity_mode = threadpool<http_conn>::AFFINITY_NUMA;
     threadpool<http_conn> *pool = NULL;
     try
     {
-        pool = new threadpool<http_conn>(connPool);
+        pool = new threadpool<http_conn>(conf.threads, conf.max_requests, queue_mode, affinity_mode, conf.threads_max);
     }
     catch (...)
     {
         return 1;
     }
 
-    http_conn *users = new http_conn[MAX_FD];
+    //每个槽只有几百字节，请求用到的缓冲区和数组在连接活跃时才从缓冲区池租用
+    http_conn *users = new http_conn[conf.max_fd];
     assert(users);
 
     //初始化数据库读取表
     users->initmysql_result(connPool);
 
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(listenfd >= 0);
-
-    //struct linger tmp={1,0};
-    //SO_LINGER若有数据待发送，延迟关闭
-    //setsockopt(listenfd,SOL_SOCKET,SO_LINGER,&tmp,sizeof(tmp));
-
-    int ret = 0;
-    struct sockaddr_in address;
-    bzero(&address, sizeof(address));
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = htonl(INADDR_ANY);
-    address.sin_port = htons(port);
-
-    int flag = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
-    ret = bind(listenfd, (struct sockaddr *)&address, sizeof(address));
-    assert(ret >= 0);
-    ret = listen(listenfd, 5);
-    assert(ret >= 0);
-
-    //创建内核事件表
-    epoll_event events[MAX_EVENT_NUMBER];
-    epollfd = epoll_create(5);
-    assert(epollfd != -1);
-
-    addfd(epollfd, listenfd, false);
-    http_conn::m_epollfd = epollfd;
-
-    //创建管道
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
-    assert(ret != -1);
-    setnonblocking(pipefd[1]);
-    addfd(epollfd, pipefd[0], false);
-
-    addsig(SIGALRM, sig_handler, false);
-    addsig(SIGTERM, sig_handler, false);
-    bool stop_server = false;
-
-    client_data *users_timer = new client_data[MAX_FD];
-
-    bool timeout = false;
-    alarm(TIMESLOT);
-
-    while (!stop_server)
+    //注册的INSERT在专用的数据库线程上批量执行，需要落库确认的连接完成后重新投递给线程池
+    http_conn::m_pool = pool;
+    if (!sql_executor::GetInstance()->init(connPool, conf.db_threads))
     {
-        // 主线程等待所监听的内核事件表上的变动
-        // epollfd就是所监听的内核事件表的文件描述符      events是一个epoll_event类型的数组
-        // 用来承接内核返回的有变动的事件
-
-        // 大量连接、少量活跃时，使用epoll更高效；少量连接，普遍活跃时，采用poll和select更高效
-        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
-        if (number < 0 && errno != EINTR)
-        {
-            LOG_ERROR("%s", "epoll failure");
-            break;
-        }
-
-        for (int i = 0; i < number; i++)
-        {
-            int sockfd = events[i].data.fd;
-
-            //处理新到的客户连接
-            if (sockfd == listenfd)
-            {
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof(client_address);
-#ifdef listenfdLT
-                int connfd = accept(listenfd, (struct sockaddr *)&client_address, &client_addrlength);
-                if (connfd < 0)
-                {
-                    LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                    continue;
-                }
-                if (http_conn::m_user_count >= MAX_FD)
-                {
-                    show_error(connfd, "Internal server busy");
-                    LOG_ERROR("%s", "Internal server busy");
-                    continue;
-                }
-                users[connfd].init(connfd, client_address);
-
-                //初始化client_data数据
-                //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
-                users_timer[connfd].address = client_address;
-                users_timer[connfd].sockfd = connfd;
-                util_timer *timer = new util_timer;
-                timer->user_data = &users_timer[connfd];
-                timer->cb_func = cb_func;
-                time_t cur = time(NULL);
-                timer->expire = cur + 3 * TIMESLOT;
-                users_timer[connfd].timer = timer;
-                timer_lst.add_timer(timer);
-#endif
-
-#ifdef listenfdET
-                while (1)
-                {
-                    int connfd = accept(listenfd, (struct sockaddr *)&client_address, &client_addrlength);
-                    if (connfd < 0)
-                    {
-                        LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                        break;
-                    }
-                    if (http_conn::m_user_count >= MAX_FD)
-                    {
-                        show_error(connfd, "Internal server busy");
-                        LOG_ERROR("%s", "Internal server busy");
-                        break;
-                    }
-                    users[connfd].init(connfd, client_address);
-
-                    //初始化client_data数据
-                    //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
-                    users_timer[connfd].address = client_address;
-                    users_timer[connfd].sockfd = connfd;
-                    util_timer *timer = new util_timer;
-                    timer->user_data = &users_timer[connfd];
-                    timer->cb_func = cb_func;
-                    time_t cur = time(NULL);
-                    timer->expire = cur + 3 * TIMESLOT;
-                    users_timer[connfd].timer = timer;
-                    timer_lst.add_timer(timer);
-                }
-                continue;
-#endif
-            }
-
-            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
-            {
-                //服务器端关闭连接，移除对应的定时器
-                util_timer *timer = users_timer[sockfd].timer;
-                timer->cb_func(&users_timer[sockfd]);
+        LOG_ERROR("%s", "create sql executor thread failure");
+        return 1;
+    }
 
-                if (timer)
-                {
-                    timer_lst.del_timer(timer);
-                }
-            }
+    //按客户端IP限制连接数和请求速率，超过时返回429；令牌桶每次读到请求取一个
+    admission::GetInstance()->init(conf.client_max_conn, conf.client_rate, conf.client_burst);
 
-            //处理信号
-            else if ((sockfd == pipefd[0]) && (events[i].events & EPOLLIN))
-            {
-                int sig;
-                char signals[1024];
-                ret = recv(pipefd[0], signals, sizeof(signals), 0);
-                if (ret == -1)
-                {
-                    continue;
-                }
-                else if (ret == 0)
-                {
-                    continue;
-                }
-                else
-                {
-                    for (int i = 0; i < ret; ++i)
-                    {
-                        switch (signals[i])
-                        {
-                        case SIGALRM:
-                        {
-                            timeout = true;
-                            break;
-                        }
-                        case SIGTERM:
-                        {
-                            stop_server = true;
-                        }
-                        }
-                    }
-                }
-            }
+    //TLS监听在第二个端口上，握手在专门的线程上做，完成后交给kTLS；证书或者内核不支持时不启动
+    if (conf.tls_port > 0 && !tls_server::GetInstance()->init(conf.tls_cert, conf.tls_key, conf.tls_threads))
+    {
+        LOG_ERROR("%s", "tls init failure");
+        Log::get_instance()->flush();
+        return 1;
+    }
 
-            //处理客户连接上接收到的数据
-            else if (events[i].events & EPOLLIN)
-            {
-                util_timer *timer = users_timer[sockfd].timer;
-                if (users[sockfd].read_once())
-                {
-                    LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
-                    Log::get_instance()->flush();
-                    //若监测到读事件，将该事件放入请求队列
-                    pool->append(users + sockfd);
+    metrics::add_gauge("webserver_active_connections", "Open client connections.", active_connections);
+    metrics::add_gauge("webserver_threadpool_queue_depth", "Requests waiting in the threadpool queue.", pool_queue_depth);
+    metrics::add_gauge("webserver_threadpool_threads", "Worker threads currently running.", pool_threads);
+    metrics::add_gauge("webserver_db_free_connections", "Idle connections in the MySQL pool.", db_free_connections);
+    metrics::add_gauge("webserver_db_open_connections", "Open connections in the MySQL pool, idle or in use.", db_open_connections);
+
+    //0表示每个CPU核一个事件循环，各自SO_REUSEPORT监听
+    int reactor_number = conf.reactors;
+    if (reactor_number <= 0)
+        reactor_number = sysconf(_SC_NPROCESSORS_ONLN);
+    if (reactor_number <= 0)
+        reactor_number = 1;
+    if (reactor_number > MAX_REACTOR)
+        reactor_number = MAX_REACTOR;
 
-                    //若有数据传输，则将定时器往后延迟3个单位
-                    //并对新的定时器在链表上的位置进行调整
-                    if (timer)
-                    {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_lst.adjust_timer(timer);
-                    }
-                }
-                else
-                {
-                    timer->cb_func(&users_timer[sockfd]);
-                    if (timer)
-                    {
-                        timer_lst.del_timer(timer);
-                    }
-                }
-            }
-            else if (events[i].events & EPOLLOUT)
-            {
-                util_timer *timer = users_timer[sockfd].timer;
-                if (users[sockfd].write())
-                {
-                    LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
-                    Log::get_instance()->flush();
+    int ret = 0;
+    if (conf.uring && uring::supported())
+        ret = run_reactors<uring_reactor>(reactor_number, conf.port, pool, users);
+    else
+    {
+        if (conf.uring)
+            LOG_WARN("%s", "io_uring not supported, fall back to epoll");
+        ret = run_reactors<reactor>(reactor_number, conf.port, pool, users);
+    }
 
-                    //若有数据传输，则将定时器往后延迟3个单位
-                    //并对新的定时器在链表上的位置进行调整
-                    if (timer)
-                    {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_lst.adjust_timer(timer);
-                    }
-                }
-                else
-                {
-                    timer->cb_func(&users_timer[sockfd]);
-                    if (timer)
-                    {
-                        timer_lst.del_timer(timer);
-                    }
-                }
-            }
-        }
-        if (timeout)
-        {
-            timer_handler();
-            timeout = false;
-        }
+    //线程池没能停下来时run_reactors已经提前返回，这里不释放，直接退出进程
+    if (pool->thread_count() > 0)
+    {
+        Log::get_instance()->flush();
+        return ret;
     }
-    close(epollfd);
-    close(listenfd);
-    close(pipefd[1]);
-    close(pipefd[0]);
     delete[] users;
-    delete[] users_timer;
     delete pool;
-    return 0;
+    return ret;
 }
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include "metrics.h"
+
+thread_local metrics::shard *metrics::t_shard = NULL;
+//分片在线程第一次记录时创建，线程退出时计数并进m_retired后释放；线程池按负载增减线程，分片数只跟着当前线程数走
+thread_local metrics::shard_guard metrics::t_guard = {NULL};
+locker metrics::m_lock;
+vector<metrics::shard *> metrics::m_shards;
+metrics::shard metrics::m_retired;
+vector<metrics::gauge> metrics::m_gauges;
+
+static const int statuses[metrics::STATUS_COUNT - 1] = {200, 206, 304, 400, 403, 404, 416, 429, 500, 503};
+static const char *const stage_names[metrics::STAGE_COUNT] = {"queue", "process", "write", "db_wait", "tls_handshake"};
+
+metrics::shard *metrics::new_shard()
+{
+    shard *s = new shard;
+    for (int i = 0; i < COUNTER_COUNT; ++i)
+        s->counters[i].store(0);
+    for (int i = 0; i < STATUS_COUNT; ++i)
+        s->statuses[i].store(0);
+    for (int i = 0; i < STAGE_COUNT; ++i)
+    {
+        for (int j = 0; j <= BUCKETS; ++j)
+            s->buckets[i][j].store(0);
+        s->sum_ns[i].store(0);
+    }
+    m_lock.lock();
+    m_shards.push_back(s);
+    m_lock.unlock();
+    t_guard.s = s;
+    return s;
+}
+
+metrics::shard_guard::~shard_guard()
+{
+    if (s)
+        retire(s);
+    s = NULL;
+}
+
+//退出的线程不会再写自己的分片，并进m_retired和从m_shards摘下在同一把锁里，render不会少算也不会重复算
+void metrics::retire(shard *s)
+{
+    m_lock.lock();
+    for (int i = 0; i < COUNTER_COUNT; ++i)
+        inc(m_retired.counters[i], s->counters[i].load(std::memory_order_relaxed));
+    for (int i = 0; i < STATUS_COUNT; ++i)
+        inc(m_retired.statuses[i], s->statuses[i].load(std::memory_order_relaxed));
+    for (int i = 0; i < STAGE_COUNT; ++i)
+    {
+        for (int j = 0; j <= BUCKETS; ++j)
+            inc(m_retired.buckets[i][j], s->buckets[i][j].load(std::memory_order_relaxed));
+        inc(m_retired.sum_ns[i], s->sum_ns[i].load(std::memory_order_relaxed));
+    }
+    for (size_t k = 0; k < m_shards.size(); ++k)
+    {
+        if (m_shards[k] == s)
+        {
+            m_shards[k] = m_shards.back();
+            m_shards.pop_back();
+            break;
+        }
+    }
+    m_lock.unlock();
+    t_shard = NULL;
+    delete s;
+}
+
+void metrics::status(int code)
+{
+    int i = 0;
+    while (i < STATUS_COUNT - 1 && statuses[i] != code)
+        ++i;
+    inc(thread_shard()->statuses[i], 1);
+}
+
+void metrics::add_gauge(const char *name, const char *help, long (*fn)())
+{
+    gauge g = {name, help, fn};
+    m_lock.lock();
+    m_gauges.push_back(g);
+    m_lock.unlock();
+}
+
+static void append(string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void append(string &out, const char *format, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len > 0)
+        out.append(line, len < (int)sizeof(line) ? len : sizeof(line) - 1);
+}
+
+static void append_counter(string &out, const char *name, const char *help, uint64_t value)
+{
+    append(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, (unsigned long long)value);
+}
+
+void metrics::render(string &out)
+{
+    uint64_t counters[COUNTER_COUNT] = {0};
+    uint64_t codes[STATUS_COUNT] = {0};
+    uint64_t buckets[STAGE_COUNT][BUCKETS + 1] = {{0}};
+    uint64_t sum_ns[STAGE_COUNT] = {0};
+
+    m_lock.lock();
+    for (size_t k = 0; k <= m_shards.size(); ++k)
+    {
+        const shard *s = k < m_shards.size() ? m_shards[k] : &m_retired;
+        for (int i = 0; i < COUNTER_COUNT; ++i)
+            counters[i] += s->counters[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < STATUS_COUNT; ++i)
+            codes[i] += s->statuses[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < STAGE_COUNT; ++i)
+        {
+            for (int j = 0; j <= BUCKETS; ++j)
+                buckets[i][j] += s->buckets[i][j].load(std::memory_order_relaxed);
+            sum_ns[i] += s->sum_ns[i].load(std::memory_order_relaxed);
+        }
+    }
+    size_t gauges = m_gauges.size();
+    m_lock.unlock();
+
+    append_counter(out, "webserver_connections_accepted_total", "Connections accepted.", counters[CONN_ACCEPTED]);
+    append_counter(out, "webserver_connections_rejected_total", "Connections refused at accept, server full or per-IP limit reached.", counters[CONN_REJECTED]);
+    append_counter(out, "webserver_requests_total", "Requests answered.", counters[REQUESTS]);
+    append_counter(out, "webserver_requests_shed_total", "Requests refused with 503 or 429 without being processed.", counters[REQUESTS_SHED]);
+    append_counter(out, "webserver_sent_bytes_total", "Bytes written to client sockets.", counters[BYTES_SENT]);
+    append_counter(out, "webserver_tls_handshakes_total", "TLS handshakes completed and handed to kernel TLS.", counters[TLS_HANDSHAKES]);
+    append_counter(out, "webserver_tls_resumed_total", "TLS handshakes that resumed a session from a ticket.", counters[TLS_RESUMED]);
+    append_counter(out, "webserver_tls_failed_total", "TLS handshakes that failed, timed out or could not be offloaded.", counters[TLS_FAILED]);
+    append_counter(out, "webserver_db_opened_total", "MySQL connections opened after startup, to grow the pool or refill it.", counters[DB_OPENED]);
+    append_counter(out, "webserver_db_reconnects_total", "MySQL connections reconnected after a failed ping or statement.", counters[DB_RECONNECTS]);
+    append_counter(out, "webserver_db_wait_timeouts_total", "Requests for a MySQL connection that timed out.", counters[DB_TIMEOUTS]);
+
+    //仪表只在启动时注册，之后只读，这里不用再加锁
+    for (size_t i = 0; i < gauges; ++i)
+    {
+        const gauge &g = m_gauges[i];
+        append(out, "# HELP %s %s\n# TYPE %s gauge\n%s %ld\n", g.name, g.help, g.name, g.name, g.fn());
+    }
+
+    append(out, "# HELP webserver_responses_total Responses by status code.\n# TYPE webserver_responses_total counter\n");
+    for (int i = 0; i < STATUS_COUNT - 1; ++i)
+        append(out, "webserver_responses_total{code=\"%d\"} %llu\n", statuses[i], (unsigned long long)codes[i]);
+    append(out, "webserver_responses_total{code=\"other\"} %llu\n", (unsigned long long)codes[STATUS_COUNT - 1]);
+
+    //Prometheus的桶是累计的：le为上界，计数包括所有更小的桶
+    append(out, "# HELP webserver_stage_seconds Time a request spends in each stage.\n# TYPE webserver_stage_seconds histogram\n");
+    for (int i = 0; i < STAGE_COUNT; ++i)
+    {
+        uint64_t total = 0;
+        for (int j = 0; j < BUCKETS; ++j)
+        {
+            total += buckets[i][j];
+            append(out, "webserver_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n", stage_names[i], (double)(1ULL << j) * 1e-6,
+                   (unsigned long long)total);
+        }
+        total += buckets[i][BUCKETS];
+        append(out, "webserver_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", stage_names[i], (unsigned long long)total);
+        append(out, "webserver_stage_seconds_sum{stage=\"%s\"} %.9f\n", stage_names[i], sum_ns[i] * 1e-9);
+        append(out, "webserver_stage_seconds_count{stage=\"%s\"} %llu\n", stage_names[i], (unsigned long long)total);
+    }
+}
@@ -0,0 +1,126 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+
+using namespace std;
+
+// 运行指标：每个线程一个按cache line对齐的分片，只有所属线程写，读的时候把所有分片加起来
+// 分片里的值都是单写者的，用relaxed的load + store累加，不需要带lock前缀的原子加；读者最多看到稍旧的值
+// 直方图按2的幂分桶，第i个桶的上界是2^i微秒，覆盖1us到约8s，更慢的落进+Inf
+class metrics
+{
+public:
+    enum COUNTER
+    {
+        CONN_ACCEPTED = 0, //accept成功并开始服务的连接
+        CONN_REJECTED,     //连接数满被拒绝的连接
+        REQUESTS,          //生成了响应的请求
+        REQUESTS_SHED,     //过载或超过客户端限制，没有处理就返回503/429的请求
+        BYTES_SENT,        //发到socket上的字节数
+        TLS_HANDSHAKES,    //完成并交给kTLS的TLS握手
+        TLS_RESUMED,       //其中用ticket恢复会话的
+        TLS_FAILED,        //失败、超时或者没能卸载到内核的TLS握手
+        DB_OPENED,         //连接池启动之后新开的数据库连接：等待时扩容或者补足最小连接数
+        DB_RECONNECTS,     //ping不通或者执行失败后重连成功的数据库连接
+        DB_TIMEOUTS,       //等了db_wait_timeout还没取到数据库连接
+        COUNTER_COUNT
+    };
+    // 一个请求经过的阶段：在线程池队列中等待、process()解析和生成响应、write()发送、等数据库连接池的连接
+    // 以及TLS连接在握手线程上从accept到交回reactor的时间
+    enum STAGE
+    {
+        STAGE_QUEUE = 0,
+        STAGE_PROCESS,
+        STAGE_WRITE,
+        STAGE_DB_WAIT,
+        STAGE_TLS_HANDSHAKE,
+        STAGE_COUNT
+    };
+    static const int BUCKETS = 24;
+    static const int STATUS_COUNT = 11; //statuses中的状态码，不在表里的记到最后一个"other"
+
+    static uint64_t now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    static void add(int counter, uint64_t n = 1)
+    {
+        inc(thread_shard()->counters[counter], n);
+    }
+    static void observe(int stage, uint64_t ns)
+    {
+        shard *s = thread_shard();
+        inc(s->buckets[stage][bucket(ns)], 1);
+        inc(s->sum_ns[stage], ns);
+    }
+    static void status(int code);
+
+    // 读时计算的仪表，例如活跃连接数、队列深度；启动时注册，fn在渲染/metrics的线程上调用
+    static void add_gauge(const char *name, const char *help, long (*fn)());
+
+    // 合并所有分片，按Prometheus文本格式追加到out
+    static void render(string &out);
+
+private:
+    struct shard
+    {
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+        std::atomic<uint64_t> statuses[STATUS_COUNT];
+        std::atomic<uint64_t> buckets[STAGE_COUNT][BUCKETS + 1];
+        std::atomic<uint64_t> sum_ns[STAGE_COUNT];
+    } __attribute__((aligned(64)));
+
+    // 线程退出时析构：把本线程分片的计数并进m_retired，再摘下释放
+    struct shard_guard
+    {
+        shard *s;
+        ~shard_guard();
+    };
+
+    struct gauge
+    {
+        const char *name;
+        const char *help;
+        long (*fn)();
+    };
+
+    static void inc(std::atomic<uint64_t> &v, uint64_t n)
+    {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    //不超过1us的落进第0个桶，否则是第一个上界不小于它的桶
+    static int bucket(uint64_t ns)
+    {
+        uint64_t us = (ns + 999) / 1000;
+        if (us <= 1)
+            return 0;
+        int i = 64 - __builtin_clzll(us - 1);
+        return i < BUCKETS ? i : BUCKETS;
+    }
+    static shard *thread_shard()
+    {
+        if (!t_shard)
+            t_shard = new_shard();
+        return t_shard;
+    }
+    static shard *new_shard();
+    static void retire(shard *s);
+
+    static thread_local shard *t_shard;
+    static thread_local shard_guard t_guard;
+    static locker m_lock;
+    static vector<shard *> m_shards;
+    static shard m_retired; //已退出线程的计数，m_lock保护
+    static vector<gauge> m_gauges;
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+#include "handoff.h"
+#include "../log/log.h"
+
+#ifndef SYS_close_range
+#define SYS_close_range 436
+#endif
+
+using namespace std;
+
+extern char **environ;
+
+static const char LISTEN_FDS_ENV[] = "WEBSERVER_LISTEN_FDS";
+static const char PARENT_PID_ENV[] = "WEBSERVER_PARENT_PID";
+
+locker handoff::m_lock;
+int handoff::m_listenfds[MAX_LISTEN];
+int handoff::m_listen_count = 0;
+int handoff::m_inherited[MAX_LISTEN];
+int handoff::m_inherited_count = 0;
+pid_t handoff::m_parent = 0;
+pid_t handoff::m_child = 0;
+char **handoff::m_argv = NULL;
+
+void handoff::init(char *argv[])
+{
+    m_argv = argv;
+    const char *fds = getenv(LISTEN_FDS_ENV);
+    const char *parent = getenv(PARENT_PID_ENV);
+    if (fds)
+    {
+        const char *p = fds;
+        while (*p && m_inherited_count < MAX_LISTEN)
+        {
+            char *end = NULL;
+            long fd = strtol(p, &end, 10);
+            if (end == p)
+                break;
+            if (fd > 2)
+                m_inherited[m_inherited_count++] = fd;
+            p = *end == ',' ? end + 1 : end;
+        }
+    }
+    if (parent)
+        m_parent = atoi(parent);
+    //不再传给以后exec的程序，交接时重新生成
+    unsetenv(LISTEN_FDS_ENV);
+    unsetenv(PARENT_PID_ENV);
+}
+
+//只认正在监听、端口相同的TCP socket；端口改了的配置重新bind
+int handoff::inherited(int port)
+{
+    for (int i = 0; i < m_inherited_count; ++i)
+    {
+        int fd = m_inherited[i];
+        if (fd < 0)
+            continue;
+        int listening = 0;
+        socklen_t len = sizeof(listening);
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) != 0 || !listening ||
+            getsockname(fd, (struct sockaddr *)&addr, &addr_len) != 0 || addr.sin_family != AF_INET ||
+            ntohs(addr.sin_port) != port)
+            continue;
+        m_inherited[i] = -1;
+        LOG_INFO("inherited listen socket %d", fd);
+        return fd;
+    }
+    return -1;
+}
+
+//老进程的reactor比新进程多时，多出来的SO_REUSEPORT监听socket关掉，内核不再往它的队列里分新连接
+void handoff::ready()
+{
+    for (int i = 0; i < m_inherited_count; ++i)
+    {
+        if (m_inherited[i] < 0)
+            continue;
+        LOG_WARN("close unused inherited socket %d", m_inherited[i]);
+        close(m_inherited[i]);
+        m_inherited[i] = -1;
+    }
+    //父进程不是老进程说明它已经退出了，不能把信号发给不相干的进程
+    if (m_parent > 0 && m_parent == getppid())
+    {
+        LOG_INFO("handoff ready, ask old process %d to drain", m_parent);
+        kill(m_parent, SIGTERM);
+    }
+    m_parent = 0;
+}
+
+void handoff::add_listenfd(int fd)
+{
+    m_lock.lock();
+    if (m_listen_count < MAX_LISTEN)
+        m_listenfds[m_listen_count++] = fd;
+    m_lock.unlock();
+}
+
+void handoff::remove_listenfd(int fd)
+{
+    m_lock.lock();
+    for (int i = 0; i < m_listen_count; ++i)
+    {
+        if (m_listenfds[i] == fd)
+        {
+            m_listenfds[i] = m_listenfds[--m_listen_count];
+            break;
+        }
+    }
+    m_lock.unlock();
+}
+
+//环境变量在fork之前准备好，子进程里只做系统调用
+pid_t handoff::spawn()
+{
+    int fds[MAX_LISTEN];
+    m_lock.lock();
+    int n = m_listen_count;
+    memcpy(fds, m_listenfds, n * sizeof(int));
+    bool busy = m_child > 0;
+    m_lock.unlock();
+    if (busy || n == 0 || !m_argv)
+    {
+        LOG_WARN("%s", busy ? "handoff already in progress" : "no listen socket to hand off");
+        return -1;
+    }
+
+    string list;
+    for (int i = 0; i < n; ++i)
+    {
+        if (i > 0)
+            list += ',';
+        list += to_string(fds[i]);
+    }
+    vector<string> env;
+    for (char **e = environ; *e; ++e)
+    {
+        if (strncmp(*e, LISTEN_FDS_ENV, sizeof(LISTEN_FDS_ENV) - 1) != 0 && strncmp(*e, PARENT_PID_ENV, sizeof(PARENT_PID_ENV) - 1) != 0)
+            env.push_back(*e);
+    }
+    env.push_back(string(LISTEN_FDS_ENV) + "=" + list);
+    env.push_back(string(PARENT_PID_ENV) + "=" + to_string(getpid()));
+    vector<char *> envp;
+    for (size_t i = 0; i < env.size(); ++i)
+        envp.push_back((char *)env[i].c_str());
+    envp.push_back(NULL);
+
+    Log::get_instance()->flush();
+    pid_t pid = fork();
+    if (pid == 0)
+        exec_child(fds, n, &envp[0]);
+    if (pid < 0)
+    {
+        LOG_ERROR("handoff fork failure, errno is:%d", errno);
+        return -1;
+    }
+    m_lock.lock();
+    m_child = pid;
+    m_lock.unlock();
+    LOG_INFO("handoff: started %s as process %d with %d listen sockets", m_argv[0], pid, n);
+    return pid;
+}
+
+//fork出来的子进程：多线程进程fork后只能调用异步信号安全的函数，这里只有close和exec
+void handoff::exec_child(const int *fds, int n, char **envp)
+{
+    close_fds_except(fds, n);
+    //argv[0]不带路径时按PATH查找，和shell启动时一样
+    execvpe(m_argv[0], m_argv, envp);
+    _exit(127);
+}
+
+//客户连接、epoll、数据库连接等都没有FD_CLOEXEC，不关掉的话新进程会一直持有老连接，客户端收不到FIN
+void handoff::close_fds_except(const int *keep, int n)
+{
+    int sorted[MAX_LISTEN];
+    for (int i = 0; i < n; ++i)
+    {
+        int j = i;
+        while (j > 0 && sorted[j - 1] > keep[i])
+        {
+            sorted[j] = sorted[j - 1];
+            --j;
+        }
+        sorted[j] = keep[i];
+    }
+    struct rlimit rl;
+    unsigned max_fd = getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY ? rl.rlim_cur : 1 << 20;
+    unsigned first = 3;
+    for (int i = 0; i <= n; ++i)
+    {
+        unsigned last = i < n ? (unsigned)sorted[i] : max_fd;
+        if (first < last)
+        {
+            //close_range需要5.9以上的内核，没有时逐个close
+            if (syscall(SYS_close_range, first, last - 1, 0) != 0)
+            {
+                for (unsigned fd = first; fd < last; ++fd)
+                    close(fd);
+            }
+        }
+        first = last + 1;
+    }
+}
+
+void handoff::reap()
+{
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        m_lock.lock();
+        if (pid == m_child)
+            m_child = 0;
+        m_lock.unlock();
+        if (WIFEXITED(status))
+            LOG_WARN("child process %d exited with status %d", pid, WEXITSTATUS(status));
+        else
+            LOG_WARN("child process %d killed by signal %d", pid, WTERMSIG(status));
+    }
+}
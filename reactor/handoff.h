@@ -0,0 +1,51 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <sys/types.h>
+#include "../lock/locker.h"
+
+// 不停机升级：收到SIGUSR2时fork并exec磁盘上的新程序，把所有监听socket原样传过去
+// 监听socket没有FD_CLOEXEC，exec后仍然打开，fd号写在环境变量WEBSERVER_LISTEN_FDS里，其余的fd在exec之前全部关掉
+// 新进程用同样的命令行参数启动，open_listenfd先认领继承来的socket，端口相同的才用；都初始化好之后给老进程发SIGTERM
+// 老进程收到后排空退出；两个进程在交接期间accept同一个监听队列，不会有连接被拒绝，也不会有连接留在队列里没人接
+// 新进程启动失败时老进程照常服务，SIGCHLD时回收并记日志，可以再次SIGUSR2
+class handoff
+{
+public:
+    // 启动时调用：记下exec用的命令行，读出继承来的监听socket
+    static void init(char *argv[]);
+
+    // 认领一个继承来的、监听port的socket，没有时返回-1
+    static int inherited(int port);
+
+    // 所有reactor初始化之后调用：关闭没有认领的继承socket；是交接启动的就通知老进程开始排空
+    static void ready();
+
+    // 登记/注销一个正在使用的监听socket，交接时传给新进程
+    static void add_listenfd(int fd);
+    static void remove_listenfd(int fd);
+
+    // fork + exec新程序，返回子进程pid，失败或者已经有一个在启动时返回-1；0号reactor上调用
+    static pid_t spawn();
+
+    // SIGCHLD：回收退出的子进程
+    static void reap();
+
+    static const int MAX_LISTEN = 256;
+
+private:
+    static void exec_child(const int *fds, int n, char **envp);
+    static void close_fds_except(const int *keep, int n);
+
+private:
+    static locker m_lock;
+    static int m_listenfds[MAX_LISTEN]; //正在使用的监听socket
+    static int m_listen_count;
+    static int m_inherited[MAX_LISTEN]; //继承来还没有认领的，认领后置为-1
+    static int m_inherited_count;
+    static pid_t m_parent;              //交接启动时老进程的pid
+    static pid_t m_child;               //正在启动的新进程
+    static char **m_argv;
+};
+
+#endif
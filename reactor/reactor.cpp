@@ -0,0 +1,566 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <cassert>
+#include <signal.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include "reactor.h"
+#include "../log/log.h"
+#include "../admission/admission.h"
+#include "handoff.h"
+
+//这三个函数在http_conn.cpp中定义，改变链接属性
+extern void addfd(int epollfd, int fd, bool one_shot, bool et);
+extern void removefd(int epollfd, int fd);
+extern int setnonblocking(int fd);
+
+int reactor::m_sig_pipefd[MAX_REACTOR];
+int reactor::m_reactor_count = 0;
+int reactor::m_max_fd = 65536;
+int reactor::m_idle_ms = 15000;
+bool reactor::m_listen_et = false;
+int reactor::m_drain_ms = 10000;
+int reactor::m_tls_port = 0;
+
+//定时器回调函数，删除非活动连接在socket上的注册事件，并关闭
+static void cb_func(client_data *user_data)
+{
+    assert(user_data);
+    epoll_ctl(user_data->epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
+    close(user_data->sockfd);
+    http_conn::m_user_count--;
+    admission::GetInstance()->disconnect(user_data->address.sin_addr.s_addr);
+    LOG_INFO("close fd %d", user_data->sockfd);
+    Log::get_instance()->flush();
+}
+
+reactor::reactor() : m_id(0), m_listenfd(-1), m_tls_listenfd(-1), m_epollfd(-1), m_timerfd(-1), m_wakefd(-1), m_accept_paused(false), m_draining(false), m_drain_deadline(0), m_fd_end(0), m_timer_lst(TIMER_TICK), m_users_timer(NULL), m_users(NULL), m_pool(NULL)
+{
+    m_pipefd[0] = m_pipefd[1] = -1;
+}
+
+reactor::~reactor()
+{
+    if (m_epollfd != -1)
+        close(m_epollfd);
+    if (m_listenfd != -1)
+        close(m_listenfd);
+    if (m_tls_listenfd != -1)
+        close(m_tls_listenfd);
+    if (m_timerfd != -1)
+        close(m_timerfd);
+    if (m_wakefd != -1)
+        close(m_wakefd);
+    if (m_pipefd[0] != -1)
+    {
+        close(m_pipefd[1]);
+        close(m_pipefd[0]);
+    }
+    delete[] m_users_timer;
+}
+
+//信号处理函数
+void reactor::sig_handler(int sig)
+{
+    //为保证函数的可重入性，保留原来的errno
+    int save_errno = errno;
+    int msg = sig;
+    //每个reactor都要收到信号，各自退出
+    for (int i = 0; i < m_reactor_count; ++i)
+        send(m_sig_pipefd[i], (char *)&msg, 1, 0);
+    errno = save_errno;
+}
+
+//设置信号函数
+void reactor::addsig(int sig, void(handler)(int), bool restart)
+{
+    struct sigaction sa;
+    memset(&sa, '\0', sizeof(sa));
+    sa.sa_handler = handler;
+    if (restart)
+        sa.sa_flags |= SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    assert(sigaction(sig, &sa, NULL) != -1);
+}
+
+//交接启动时先用老进程传过来的监听socket，它已经bind和listen过，队列里的连接也在
+int reactor::open_listenfd(int port, bool reuseport)
+{
+    int listenfd = handoff::inherited(port);
+    if (listenfd >= 0)
+    {
+        handoff::add_listenfd(listenfd);
+        return listenfd;
+    }
+    listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (listenfd < 0)
+        return -1;
+
+    //struct linger tmp={1,0};
+    //SO_LINGER若有数据待发送，延迟关闭
+    //setsockopt(listenfd,SOL_SOCKET,SO_LINGER,&tmp,sizeof(tmp));
+
+    int ret = 0;
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    int flag = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    //多个reactor绑定同一端口，由内核按四元组哈希把新连接分给其中一个监听socket
+    if (reuseport)
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
+    ret = bind(listenfd, (struct sockaddr *)&address, sizeof(address));
+    if (ret >= 0)
+        ret = listen(listenfd, LISTEN_BACKLOG);
+    if (ret < 0)
+    {
+        close(listenfd);
+        return -1;
+    }
+    handoff::add_listenfd(listenfd);
+    return listenfd;
+}
+
+bool reactor::add_sig_pipe(int fd)
+{
+    if (m_reactor_count >= MAX_REACTOR)
+        return false;
+    m_sig_pipefd[m_reactor_count++] = fd;
+    return true;
+}
+
+bool reactor::init(int id, int port, bool reuseport, threadpool<http_conn> *pool, http_conn *users)
+{
+    m_id = id;
+    m_pool = pool;
+    m_users = users;
+
+    m_listenfd = open_listenfd(port, reuseport);
+    if (m_listenfd < 0)
+        return false;
+
+    //创建内核事件表
+    m_epollfd = epoll_create(5);
+    if (m_epollfd == -1)
+        return false;
+
+    addfd(m_epollfd, m_listenfd, false, m_listen_et);
+
+    //创建管道
+    int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
+    if (ret == -1)
+        return false;
+    setnonblocking(m_pipefd[1]);
+    addfd(m_epollfd, m_pipefd[0], false, false);
+    if (!add_sig_pipe(m_pipefd[1]))
+        return false;
+
+    //用timerfd代替alarm + SIGALRM，每TIMER_TICK毫秒触发一次，可读时推进时间轮
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerfd == -1)
+        return false;
+    struct itimerspec its;
+    its.it_value.tv_sec = TIMER_TICK / 1000;
+    its.it_value.tv_nsec = (TIMER_TICK % 1000) * 1000000;
+    its.it_interval = its.it_value;
+    if (timerfd_settime(m_timerfd, 0, &its, NULL) == -1)
+        return false;
+    addfd(m_epollfd, m_timerfd, false, false);
+
+    if (m_tls_port > 0)
+    {
+        m_tls_listenfd = open_listenfd(m_tls_port, reuseport);
+        if (m_tls_listenfd < 0)
+            return false;
+        addfd(m_epollfd, m_tls_listenfd, false, m_listen_et);
+        m_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_wakefd == -1)
+            return false;
+        addfd(m_epollfd, m_wakefd, false, false);
+        m_inbox.init(m_wakefd);
+    }
+
+    m_users_timer = new client_data[m_max_fd];
+    return true;
+}
+
+void *reactor::worker(void *arg)
+{
+    reactor *r = (reactor *)arg;
+    r->eventloop();
+    return r;
+}
+
+//定时处理任务，把时间轮推进到当前时间
+void reactor::timer_handler()
+{
+    m_timer_lst.tick();
+    try_resume_accept();
+    admission::GetInstance()->sweep();
+}
+
+//连接数满、fd超出连接表时回503；单个IP的连接数超限回429；接受后连接数到高水位就暂停accept
+//TLS连接还没握手，说不了HTTP，拒绝时直接关闭；通过的交给握手线程，握手完成后才算接受
+void reactor::admit(int connfd, const sockaddr_in &client_address, bool tls)
+{
+    if (http_conn::m_user_count >= m_max_fd || connfd >= m_max_fd)
+    {
+        metrics::add(metrics::CONN_REJECTED);
+        if (tls)
+            close(connfd);
+        else
+            http_conn::reject(connfd, 503);
+        LOG_ERROR("%s", "Internal server busy");
+        return;
+    }
+    if (!admission::GetInstance()->connect(client_address.sin_addr.s_addr))
+    {
+        metrics::add(metrics::CONN_REJECTED);
+        if (tls)
+            close(connfd);
+        else
+            http_conn::reject(connfd, 429);
+        return;
+    }
+    if (tls)
+    {
+        tls_server::GetInstance()->handshake(connfd, client_address, &m_inbox);
+        return;
+    }
+    deal_conn(connfd, client_address);
+    if (http_conn::m_user_count >= ACCEPT_PAUSE_CONN)
+        pause_accept();
+}
+
+//握手线程交回的TLS连接，收发都已经在内核里加解密，之后和明文连接一样
+void reactor::deal_tls()
+{
+    uint64_t count;
+    read(m_wakefd, &count, sizeof(count));
+    m_inbox.take(m_tls_batch);
+    for (size_t i = 0; i < m_tls_batch.size(); ++i)
+        deal_conn(m_tls_batch[i].first, m_tls_batch[i].second);
+    m_tls_batch.clear();
+    if (http_conn::m_user_count >= ACCEPT_PAUSE_CONN)
+        pause_accept();
+}
+
+//不再accept，新连接在监听队列里等，而不是被接受后马上拒绝
+void reactor::pause_accept()
+{
+    if (m_accept_paused)
+        return;
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0);
+    if (m_tls_listenfd != -1)
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_tls_listenfd, 0);
+    m_accept_paused = true;
+    LOG_WARN("reactor %d pause accept, %d connections", m_id, http_conn::m_user_count.load());
+}
+
+void reactor::try_resume_accept()
+{
+    if (!m_accept_paused || m_draining || http_conn::m_user_count >= ACCEPT_RESUME_CONN || m_pool->queue_depth() > QUEUE_RESUME_DEPTH)
+        return;
+    addfd(m_epollfd, m_listenfd, false, m_listen_et);
+    if (m_tls_listenfd != -1)
+        addfd(m_epollfd, m_tls_listenfd, false, m_listen_et);
+    m_accept_paused = false;
+    LOG_WARN("reactor %d resume accept", m_id);
+}
+
+//线程池队列满：这个请求回503，同时暂停accept，不再接进更多的连接
+void reactor::shed(int sockfd)
+{
+    m_users[sockfd].shed(503);
+    pause_accept();
+}
+
+//不再accept，监听socket直接关掉，内核不再为本进程完成新的握手；交接时新进程手里还有一份，队列里的连接由它接
+void reactor::start_drain()
+{
+    m_draining = true;
+    m_drain_deadline = time_wheel::now_ms() + m_drain_ms;
+    http_conn::m_draining = true;
+    pause_accept();
+    handoff::remove_listenfd(m_listenfd);
+    close(m_listenfd);
+    m_listenfd = -1;
+    if (m_tls_listenfd != -1)
+    {
+        handoff::remove_listenfd(m_tls_listenfd);
+        close(m_tls_listenfd);
+        m_tls_listenfd = -1;
+    }
+    LOG_INFO("reactor %d draining, %d connections", m_id, http_conn::m_user_count.load());
+}
+
+//排空中每个定时周期调用一次：关闭空闲的长连接，本reactor没有连接了或者过了期限时返回true
+//定时器挂在本reactor时间轮上的连接就是本reactor的连接
+bool reactor::drain_done()
+{
+    int live = 0;
+    for (int fd = 0; fd < m_fd_end; ++fd)
+    {
+        if (m_users_timer[fd].timer.slot < 0)
+            continue;
+        if (m_users[fd].idle())
+            close_timer(fd);
+        else
+            live++;
+    }
+    if (live == 0)
+    {
+        LOG_INFO("reactor %d drained", m_id);
+        return true;
+    }
+    if (time_wheel::now_ms() >= m_drain_deadline)
+    {
+        LOG_WARN("reactor %d drain timeout, %d connections left", m_id, live);
+        return true;
+    }
+    return false;
+}
+
+//初始化client_data数据
+//设置嵌在client_data中的定时器的回调函数和超时时间，绑定用户数据，将定时器添加到时间轮中
+void reactor::deal_conn(int connfd, const sockaddr_in &client_address)
+{
+    metrics::add(metrics::CONN_ACCEPTED);
+    m_users[connfd].init(connfd, client_address, m_epollfd);
+    if (connfd >= m_fd_end)
+        m_fd_end = connfd + 1;
+
+    m_users_timer[connfd].address = client_address;
+    m_users_timer[connfd].sockfd = connfd;
+    m_users_timer[connfd].epollfd = m_epollfd;
+    util_timer *timer = &m_users_timer[connfd].timer;
+    timer->user_data = &m_users_timer[connfd];
+    timer->cb_func = cb_func;
+    time_t cur = time_wheel::now_ms();
+    timer->expire = cur + m_idle_ms;
+    m_timer_lst.add_timer(timer);
+}
+
+//若有数据传输，则将定时器往后延迟m_idle_ms
+//并对新的定时器在链表上的位置进行调整
+void reactor::adjust_timer(util_timer *timer)
+{
+    if (timer)
+    {
+        time_t cur = time_wheel::now_ms();
+        timer->expire = cur + m_idle_ms;
+        LOG_INFO("%s", "adjust timer once");
+        Log::get_instance()->flush();
+        m_timer_lst.adjust_timer(timer);
+    }
+}
+
+//服务器端关闭连接，移除对应的定时器
+void reactor::close_timer(int sockfd)
+{
+    util_timer *timer = &m_users_timer[sockfd].timer;
+    timer->cb_func(&m_users_timer[sockfd]);
+    m_timer_lst.del_timer(timer);
+}
+
+bool reactor::deal_signal(bool &stop_server)
+{
+    char signals[1024];
+    int ret = recv(m_pipefd[0], signals, sizeof(signals), 0);
+    if (ret <= 0)
+    {
+        return false;
+    }
+    for (int i = 0; i < ret; ++i)
+    {
+        switch (signals[i])
+        {
+        case SIGTERM:
+        {
+            //不排空，或者排空中又收到一次，立即退出
+            if (m_draining || m_drain_ms <= 0)
+                stop_server = true;
+            else
+            {
+                start_drain();
+                stop_server = drain_done();
+            }
+            break;
+        }
+        case SIGUSR2:
+        {
+            if (m_id == 0 && !m_draining)
+                handoff::spawn();
+            break;
+        }
+        case SIGCHLD:
+        {
+            if (m_id == 0)
+                handoff::reap();
+            break;
+        }
+        }
+    }
+    return true;
+}
+
+//LT每次accept一个；ET accept到没有新连接为止
+void reactor::deal_accept(int listenfd)
+{
+    bool tls = listenfd == m_tls_listenfd;
+    struct sockaddr_in client_address;
+    socklen_t client_addrlength = sizeof(client_address);
+    do
+    {
+        int connfd = accept(listenfd, (struct sockaddr *)&client_address, &client_addrlength);
+        //交接期间两个进程accept同一个队列，连接被另一个进程先接走时是EAGAIN
+        if (connfd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR("%s:errno is:%d", "accept error", errno);
+            return;
+        }
+        admit(connfd, client_address, tls);
+    } while (m_listen_et && !m_accept_paused);
+}
+
+//读出timerfd的到期次数，具体经过了多少个槽由时间轮按当前时间计算
+bool reactor::deal_timerfd()
+{
+    uint64_t expirations;
+    int ret = read(m_timerfd, &expirations, sizeof(expirations));
+    return ret == sizeof(expirations);
+}
+
+//处理客户连接上接收到的数据
+void reactor::deal_read(int sockfd)
+{
+    util_timer *timer = &m_users_timer[sockfd].timer;
+    if (m_users[sockfd].read_once())
+    {
+        LOG_INFO("deal with the client(%s)", inet_ntoa(m_users[sockfd].get_address()->sin_addr));
+        Log::get_instance()->flush();
+        adjust_timer(timer);
+        //超过该IP的请求速率，回429后关闭
+        if (!admission::GetInstance()->request(m_users[sockfd].get_address()->sin_addr.s_addr))
+        {
+            m_users[sockfd].shed(429);
+            return;
+        }
+        //GET /metrics在本线程上直接处理，线程池打满时也能取到指标
+        //其余请求放入请求队列，以fd作为亲和键，工作窃取模式下同一连接总由同一个工作线程处理
+        if (m_users[sockfd].inline_request())
+            m_users[sockfd].process();
+        else
+        {
+            m_users[sockfd].queued();
+            if (!m_pool->append(m_users + sockfd, sockfd))
+                shed(sockfd);
+        }
+    }
+    else
+    {
+        close_timer(sockfd);
+    }
+}
+
+void reactor::deal_write(int sockfd)
+{
+    util_timer *timer = &m_users_timer[sockfd].timer;
+    if (m_users[sockfd].write())
+    {
+        LOG_INFO("send data to the client(%s)", inet_ntoa(m_users[sockfd].get_address()->sin_addr));
+        Log::get_instance()->flush();
+        adjust_timer(timer);
+        //流水线上还有已读入的请求，直接交给工作线程，不必等下一次EPOLLIN
+        if (m_users[sockfd].pipelined())
+        {
+            m_users[sockfd].queued();
+            if (!m_pool->append(m_users + sockfd, sockfd))
+                shed(sockfd);
+        }
+    }
+    else
+    {
+        close_timer(sockfd);
+    }
+}
+
+void reactor::eventloop()
+{
+    bool stop_server = false;
+    bool timeout = false;
+
+    while (!stop_server)
+    {
+        // 本reactor等待所监听的内核事件表上的变动
+        // m_epollfd就是所监听的内核事件表的文件描述符      m_events是一个epoll_event类型的数组
+        // 用来承接内核返回的有变动的事件
+
+        // 大量连接、少量活跃时，使用epoll更高效；少量连接，普遍活跃时，采用poll和select更高效
+        int number = epoll_wait(m_epollfd, m_events, MAX_EVENT_NUMBER, -1);
+        if (number < 0 && errno != EINTR)
+        {
+            LOG_ERROR("%s", "epoll failure");
+            break;
+        }
+
+        for (int i = 0; i < number; i++)
+        {
+            int sockfd = m_events[i].data.fd;
+
+            //处理新到的客户连接
+            if (sockfd == m_listenfd || sockfd == m_tls_listenfd)
+            {
+                deal_accept(sockfd);
+                continue;
+            }
+
+            else if (m_events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                close_timer(sockfd);
+            }
+
+            //处理信号
+            else if ((sockfd == m_pipefd[0]) && (m_events[i].events & EPOLLIN))
+            {
+                deal_signal(stop_server);
+            }
+
+            //握手线程交回了TLS连接
+            else if ((sockfd == m_wakefd) && (m_events[i].events & EPOLLIN))
+            {
+                deal_tls();
+            }
+
+            //处理定时，和原来的SIGALRM一样，优先处理I/O，定时任务放到本轮最后
+            else if ((sockfd == m_timerfd) && (m_events[i].events & EPOLLIN))
+            {
+                if (deal_timerfd())
+                    timeout = true;
+            }
+
+            else if (m_events[i].events & EPOLLIN)
+            {
+                deal_read(sockfd);
+            }
+            else if (m_events[i].events & EPOLLOUT)
+            {
+                deal_write(sockfd);
+            }
+        }
+        if (timeout)
+        {
+            timer_handler();
+            timeout = false;
+            if (m_draining && drain_done())
+                stop_server = true;
+        }
+    }
+}
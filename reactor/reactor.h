@@ -0,0 +1,107 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <pthread.h>
+#include "../threadpool/threadpool.h"
+#include "../timer/time_wheel.h"
+#include "../http/http_conn.h"
+#include "../tls/tls_server.h"
+
+#define MAX_EVENT_NUMBER 10000 //最大事件数
+#define TIMER_TICK 100         //时间轮槽间隔(毫秒)，也是timerfd的触发周期
+#define MAX_REACTOR 256        //最多的事件循环数
+#define LISTEN_BACKLOG 1024    //监听队列长度，实际不超过/proc/sys/net/core/somaxconn；暂停accept期间新连接在这里排队
+#define ACCEPT_PAUSE_CONN (reactor::m_max_fd - reactor::m_max_fd / 64)  //连接数到这里暂停accept
+#define ACCEPT_RESUME_CONN (reactor::m_max_fd - reactor::m_max_fd / 32) //连接数降到这里以下、并且线程池队列不超过QUEUE_RESUME_DEPTH时恢复
+#define QUEUE_RESUME_DEPTH 1000
+
+// 一个reactor就是一个独立的事件循环：
+// 自己的epoll内核事件表、自己的监听socket、自己的信号管道、自己的timerfd、时间轮和连接定时器表
+// 单reactor模式下只有一个实例，运行在主线程
+// 多reactor模式下每个核一个实例，各自的监听socket都设置SO_REUSEPORT，由内核在它们之间分发新连接
+// 各reactor之间不共享任何可变状态：http_conn数组按fd下标访问，fd由哪个reactor accept，就只由哪个reactor操作
+// 过载时：线程池队列满或连接数到高水位就暂停accept，新连接留在内核的监听队列里，每个定时周期检查一次是否恢复
+// SIGTERM时排空：关闭监听socket，空闲的长连接马上关闭，还在处理的请求发完响应(带Connection: close)后关闭，
+// 本reactor没有连接了或者过了m_drain_ms就退出事件循环；排空中再收到SIGTERM立即退出
+// SIGUSR2时0号reactor把监听socket交给exec出来的新程序，见handoff.h
+// 配置了m_tls_port时每个reactor再开一个TLS监听socket：accept后交给握手线程，握手完成、交给kTLS后经m_inbox交回，之后和明文连接一样
+class reactor
+{
+public:
+    reactor();
+    ~reactor();
+
+    // id为reactor编号；reuseport为true时监听socket开启SO_REUSEPORT
+    bool init(int id, int port, bool reuseport, threadpool<http_conn> *pool, http_conn *users);
+
+    // 事件循环，直到收到SIGTERM并排空
+    void eventloop();
+
+    // pthread_create的回调函数，在新线程中运行eventloop
+    static void *worker(void *arg);
+
+    // 注册进程级的信号处理函数，信号会被转发到所有reactor的管道
+    static void addsig(int sig, void(handler)(int), bool restart = true);
+    static void sig_handler(int sig);
+
+    // 创建并监听端口，reuseport为true时开启SO_REUSEPORT，失败返回-1；io_uring后端共用
+    static int open_listenfd(int port, bool reuseport);
+    // 登记一个信号管道的写端，sig_handler会把信号写进去；io_uring后端共用
+    static bool add_sig_pipe(int fd);
+
+public:
+    // 启动时按配置设置，在创建reactor之前，所有reactor共用；io_uring后端也用
+    static int m_max_fd;     //连接表的大小，fd不小于它的连接直接拒绝
+    static int m_idle_ms;    //连接空闲多少毫秒后关闭
+    static bool m_listen_et; //监听socket边缘触发，一次accept到EAGAIN为止
+    static int m_drain_ms;   //SIGTERM后最多等多久让连接上的请求做完，0为立即退出
+    static int m_tls_port;   //TLS监听端口，0为不开；要先初始化tls_server
+
+private:
+    void deal_accept(int listenfd);
+    void admit(int connfd, const sockaddr_in &client_address, bool tls);
+    void deal_tls();
+    void deal_conn(int connfd, const sockaddr_in &client_address);
+    void pause_accept();
+    void try_resume_accept();
+    void shed(int sockfd);
+    void start_drain();
+    bool drain_done();
+    bool deal_signal(bool &stop_server);
+    bool deal_timerfd();
+    void deal_read(int sockfd);
+    void deal_write(int sockfd);
+    void adjust_timer(util_timer *timer);
+    void close_timer(int sockfd);
+    void timer_handler();
+
+private:
+    int m_id;
+    int m_listenfd;
+    int m_tls_listenfd;       //TLS监听socket，不开TLS时为-1
+    int m_epollfd;
+    int m_pipefd[2];
+    int m_timerfd;            //周期性触发的timerfd，驱动时间轮
+    int m_wakefd;             //握手线程交回连接时写的eventfd
+    tls_inbox m_inbox;
+    std::vector<std::pair<int, sockaddr_in> > m_tls_batch;
+    bool m_accept_paused;     //监听socket已从内核事件表中摘下
+    bool m_draining;          //收到SIGTERM，正在排空
+    time_t m_drain_deadline;  //排空的期限，毫秒
+    int m_fd_end;             //服务过的最大fd+1，排空时只扫到这里
+    time_wheel m_timer_lst;
+    client_data *m_users_timer; //本reactor的连接定时器表
+    http_conn *m_users;
+    threadpool<http_conn> *m_pool;
+    epoll_event m_events[MAX_EVENT_NUMBER];
+
+    // 所有reactor信号管道的写端，信号处理函数逐个写入
+    static int m_sig_pipefd[MAX_REACTOR];
+    static int m_reactor_count;
+};
+
+#endif
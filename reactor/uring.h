@@ -0,0 +1,249 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <atomic>
+
+// 不依赖liburing的最小io_uring封装，只包含uring_reactor用到的部分
+// 提交队列(SQ)、完成队列(CQ)和SQE数组按内核约定mmap到用户态，头尾指针用acquire/release访问
+// 只由创建它的reactor线程使用，不加锁
+class uring
+{
+public:
+    uring() : m_fd(-1), m_sq_ptr(NULL), m_cq_ptr(NULL), m_sqes(NULL), m_buf_ring(NULL), m_buf_base(NULL) {}
+    ~uring()
+    {
+        if (m_buf_ring)
+            munmap(m_buf_ring, m_buf_ring_size);
+        free(m_buf_base);
+        if (m_sqes)
+            munmap(m_sqes, m_sqes_size);
+        if (m_cq_ptr && m_cq_ptr != m_sq_ptr)
+            munmap(m_cq_ptr, m_cq_size);
+        if (m_sq_ptr)
+            munmap(m_sq_ptr, m_sq_size);
+        if (m_fd != -1)
+            close(m_fd);
+    }
+
+    bool init(unsigned entries)
+    {
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 4;
+        m_fd = syscall(__NR_io_uring_setup, entries, &p);
+        if (m_fd < 0)
+            return false;
+
+        m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            if (m_cq_size > m_sq_size)
+                m_sq_size = m_cq_size;
+            m_cq_size = m_sq_size;
+        }
+        m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if (m_sq_ptr == MAP_FAILED)
+        {
+            m_sq_ptr = NULL;
+            return false;
+        }
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            m_cq_ptr = m_sq_ptr;
+        else
+        {
+            m_cq_ptr = mmap(0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+            if (m_cq_ptr == MAP_FAILED)
+            {
+                m_cq_ptr = NULL;
+                return false;
+            }
+        }
+        m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        m_sqes = (struct io_uring_sqe *)mmap(0, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        if (m_sqes == MAP_FAILED)
+        {
+            m_sqes = NULL;
+            return false;
+        }
+
+        char *sq = (char *)m_sq_ptr;
+        m_sq_head = (unsigned *)(sq + p.sq_off.head);
+        m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+        m_sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+        m_sq_entries = p.sq_entries;
+        m_sq_array = (unsigned *)(sq + p.sq_off.array);
+        char *cq = (char *)m_cq_ptr;
+        m_cq_head = (unsigned *)(cq + p.cq_off.head);
+        m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+        m_cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+        m_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+        m_sqe_tail = *m_sq_tail;
+        return true;
+    }
+
+    //取一个空闲的SQE，SQ满了先提交一次
+    struct io_uring_sqe *get_sqe()
+    {
+        unsigned head = load_acquire(m_sq_head);
+        if (m_sqe_tail - head >= m_sq_entries)
+        {
+            submit(0);
+            head = load_acquire(m_sq_head);
+            if (m_sqe_tail - head >= m_sq_entries)
+                return NULL;
+        }
+        unsigned idx = m_sqe_tail & m_sq_mask;
+        struct io_uring_sqe *sqe = &m_sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        m_sq_array[idx] = idx;
+        m_sqe_tail++;
+        return sqe;
+    }
+
+    //提交队列里还能放下的SQE数
+    unsigned sq_space()
+    {
+        return m_sq_entries - (m_sqe_tail - load_acquire(m_sq_head));
+    }
+
+    //把攒下的SQE一次提交，并等待至少wait_nr个完成事件；一轮事件循环只进一次内核
+    int submit(unsigned wait_nr)
+    {
+        unsigned tail = *m_sq_tail;
+        unsigned to_submit = m_sqe_tail - tail;
+        store_release(m_sq_tail, m_sqe_tail);
+        unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+        if (to_submit == 0 && wait_nr == 0)
+            return 0;
+        int ret = syscall(__NR_io_uring_enter, m_fd, to_submit, wait_nr, flags, NULL, 0);
+        return ret < 0 ? -errno : ret;
+    }
+
+    //取下一个完成事件，没有时返回NULL；处理完后调用cqe_seen
+    struct io_uring_cqe *peek_cqe()
+    {
+        unsigned head = *m_cq_head;
+        if (head == load_acquire(m_cq_tail))
+            return NULL;
+        return &m_cqes[head & m_cq_mask];
+    }
+    void cqe_seen()
+    {
+        store_release(m_cq_head, *m_cq_head + 1);
+    }
+
+    //注册一个提供缓冲区的环(provided buffer ring)：count块、每块size字节，recv时由内核挑一块空闲的填数据
+    bool setup_buf_ring(unsigned short bgid, unsigned count, unsigned size)
+    {
+        m_buf_count = count;
+        m_buf_size = size;
+        m_buf_mask = count - 1;
+        m_buf_ring_size = count * sizeof(struct io_uring_buf);
+        void *ring = mmap(NULL, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (ring == MAP_FAILED)
+            return false;
+        m_buf_ring = (struct io_uring_buf_ring *)ring;
+        if (posix_memalign((void **)&m_buf_base, 4096, (size_t)count * size) != 0)
+        {
+            m_buf_base = NULL;
+            return false;
+        }
+
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (unsigned long)m_buf_ring;
+        reg.ring_entries = count;
+        reg.bgid = bgid;
+        if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+            return false;
+
+        m_buf_tail = 0;
+        for (unsigned i = 0; i < count; ++i)
+            add_buf(i);
+        commit_bufs();
+        return true;
+    }
+    char *buf_addr(unsigned bid)
+    {
+        return m_buf_base + (size_t)bid * m_buf_size;
+    }
+    unsigned buf_size() const
+    {
+        return m_buf_size;
+    }
+    //数据拷走后把缓冲区还给内核，攒一批后commit_bufs一起生效
+    void add_buf(unsigned bid)
+    {
+        //linux/io_uring.h里的柔性数组bufs在C++下偏移不为0，直接按环首地址下标，第0项和tail重叠是内核约定
+        struct io_uring_buf *buf = (struct io_uring_buf *)m_buf_ring + (m_buf_tail & m_buf_mask);
+        buf->addr = (unsigned long)buf_addr(bid);
+        buf->len = m_buf_size;
+        buf->bid = bid;
+        m_buf_tail++;
+    }
+    void commit_bufs()
+    {
+        std::atomic_thread_fence(std::memory_order_release);
+        *(volatile unsigned short *)&m_buf_ring->tail = m_buf_tail;
+    }
+
+    //内核是否支持本后端用到的功能：provided buffer ring查不到就认为不支持，退回epoll
+    static bool supported()
+    {
+        uring probe;
+        if (!probe.init(8))
+            return false;
+        return probe.setup_buf_ring(0, 8, 4096);
+    }
+
+private:
+    static unsigned load_acquire(unsigned *p)
+    {
+        return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+    }
+    static void store_release(unsigned *p, unsigned v)
+    {
+        __atomic_store_n(p, v, __ATOMIC_RELEASE);
+    }
+
+private:
+    int m_fd;
+    void *m_sq_ptr;
+    void *m_cq_ptr;
+    size_t m_sq_size;
+    size_t m_cq_size;
+    size_t m_sqes_size;
+    struct io_uring_sqe *m_sqes;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_array;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    unsigned m_sqe_tail; //本地已填好但还没提交的SQE尾
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+
+    struct io_uring_buf_ring *m_buf_ring;
+    size_t m_buf_ring_size;
+    char *m_buf_base;
+    unsigned m_buf_count;
+    unsigned m_buf_size;
+    unsigned m_buf_mask;
+    unsigned short m_buf_tail;
+};
+
+#endif
@@ -0,0 +1,811 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <cassert>
+#include <signal.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include "uring_reactor.h"
+#include "../log/log.h"
+#include "../admission/admission.h"
+#include "handoff.h"
+
+extern int setnonblocking(int fd);
+
+//定时器在reactor线程上tick，回调通过它找到所属的reactor
+static thread_local uring_reactor *t_reactor = NULL;
+
+static void uring_cb_func(client_data *user_data)
+{
+    assert(user_data && t_reactor);
+    t_reactor->expire(user_data->sockfd);
+}
+
+uring_reactor::uring_reactor() : m_id(0), m_listenfd(-1), m_tls_listenfd(-1), m_timerfd(-1), m_wakefd(-1), m_stop(false), m_timeout(false), m_accept_armed(false), m_tls_accept_armed(false), m_accept_paused(false), m_draining(false), m_drain_deadline(0), m_fd_end(0),
+                                 m_timer_lst(TIMER_TICK), m_users_timer(NULL), m_conns(NULL), m_users(NULL), m_pool(NULL),
+                                 m_wake_pending(false)
+{
+    m_pipefd[0] = m_pipefd[1] = -1;
+}
+
+uring_reactor::~uring_reactor()
+{
+    if (m_listenfd != -1)
+        close(m_listenfd);
+    if (m_tls_listenfd != -1)
+        close(m_tls_listenfd);
+    if (m_timerfd != -1)
+        close(m_timerfd);
+    if (m_wakefd != -1)
+        close(m_wakefd);
+    if (m_pipefd[0] != -1)
+    {
+        close(m_pipefd[1]);
+        close(m_pipefd[0]);
+    }
+    if (m_conns)
+    {
+        for (int i = 0; i < reactor::m_max_fd; ++i)
+        {
+            if (m_conns[i].pipefd[0] != -1)
+            {
+                close(m_conns[i].pipefd[0]);
+                close(m_conns[i].pipefd[1]);
+            }
+        }
+    }
+    delete[] m_conns;
+    delete[] m_users_timer;
+}
+
+//和reactor不同，这里的fd都保持阻塞：io_uring对socket和管道按就绪通知重试，非阻塞反而会把EAGAIN直接交回来
+bool uring_reactor::init(int id, int port, bool reuseport, threadpool<http_conn> *pool, http_conn *users)
+{
+    m_id = id;
+    m_pool = pool;
+    m_users = users;
+
+    if (!m_ring.init(URING_ENTRIES))
+        return false;
+    if (!m_ring.setup_buf_ring(URING_BUF_GROUP, URING_BUF_COUNT, URING_BUF_SIZE))
+        return false;
+
+    m_listenfd = reactor::open_listenfd(port, reuseport);
+    if (m_listenfd < 0)
+        return false;
+
+    int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
+    if (ret == -1)
+        return false;
+    setnonblocking(m_pipefd[1]);
+    if (!reactor::add_sig_pipe(m_pipefd[1]))
+        return false;
+
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (m_timerfd == -1)
+        return false;
+    struct itimerspec its;
+    its.it_value.tv_sec = TIMER_TICK / 1000;
+    its.it_value.tv_nsec = (TIMER_TICK % 1000) * 1000000;
+    its.it_interval = its.it_value;
+    if (timerfd_settime(m_timerfd, 0, &its, NULL) == -1)
+        return false;
+
+    m_wakefd = eventfd(0, EFD_CLOEXEC);
+    if (m_wakefd == -1)
+        return false;
+
+    if (reactor::m_tls_port > 0)
+    {
+        m_tls_listenfd = reactor::open_listenfd(reactor::m_tls_port, reuseport);
+        if (m_tls_listenfd < 0)
+            return false;
+        m_inbox.init(m_wakefd);
+    }
+
+    m_users_timer = new client_data[reactor::m_max_fd];
+    m_conns = new conn_state[reactor::m_max_fd];
+    for (int i = 0; i < reactor::m_max_fd; ++i)
+    {
+        m_conns[i].state = ST_CLOSED;
+        m_conns[i].inflight = 0;
+        m_conns[i].pipefd[0] = m_conns[i].pipefd[1] = -1;
+        m_conns[i].pipe_bytes = 0;
+        m_conns[i].pipe_size = 0;
+    }
+    return true;
+}
+
+void *uring_reactor::worker(void *arg)
+{
+    uring_reactor *r = (uring_reactor *)arg;
+    r->eventloop();
+    return r;
+}
+
+//取一个SQE并填好user_data，连接上的操作计入在途数
+struct io_uring_sqe *uring_reactor::sqe(int op, int fd)
+{
+    struct io_uring_sqe *s = m_ring.get_sqe();
+    if (!s)
+    {
+        LOG_ERROR("%s", "io_uring submission queue full");
+        return NULL;
+    }
+    s->user_data = pack(op, fd);
+    if (op == OP_RECV || op == OP_SEND || op == OP_SPLICE_IN || op == OP_SPLICE_OUT)
+        m_conns[fd].inflight++;
+    return s;
+}
+
+void uring_reactor::post_accept()
+{
+    post_accept(m_listenfd);
+    if (m_tls_listenfd != -1)
+        post_accept(m_tls_listenfd);
+}
+
+//multishot accept：一次提交持续产生新连接，直到完成事件不再带IORING_CQE_F_MORE才需要重新提交
+void uring_reactor::post_accept(int listenfd)
+{
+    if (accept_armed(listenfd))
+        return;
+    struct io_uring_sqe *s = sqe(listenfd == m_tls_listenfd ? OP_TLS_ACCEPT : OP_ACCEPT, listenfd);
+    if (!s)
+        return;
+    s->opcode = IORING_OP_ACCEPT;
+    s->fd = listenfd;
+    s->ioprio = IORING_ACCEPT_MULTISHOT;
+    accept_armed(listenfd) = true;
+}
+
+void uring_reactor::cancel_accept()
+{
+    cancel_accept(m_listenfd);
+    if (m_tls_listenfd != -1)
+        cancel_accept(m_tls_listenfd);
+}
+
+//和epoll后端一样，连接数到高水位或者线程池队列满时停止accept，新连接留在监听队列里
+//取消multishot accept；取消之前已经完成的accept照常处理
+void uring_reactor::cancel_accept(int listenfd)
+{
+    if (!accept_armed(listenfd))
+        return;
+    struct io_uring_sqe *s = sqe(OP_CANCEL, listenfd);
+    if (!s)
+        return;
+    s->opcode = IORING_OP_ASYNC_CANCEL;
+    s->fd = -1;
+    s->addr = pack(listenfd == m_tls_listenfd ? OP_TLS_ACCEPT : OP_ACCEPT, listenfd);
+}
+
+void uring_reactor::pause_accept()
+{
+    if (m_accept_paused)
+        return;
+    m_accept_paused = true;
+    LOG_WARN("reactor %d pause accept, %d connections", m_id, http_conn::m_user_count.load());
+    cancel_accept();
+}
+
+void uring_reactor::try_resume_accept()
+{
+    if (!m_accept_paused || m_draining || http_conn::m_user_count >= ACCEPT_RESUME_CONN || m_pool->queue_depth() > QUEUE_RESUME_DEPTH)
+        return;
+    m_accept_paused = false;
+    LOG_WARN("reactor %d resume accept", m_id);
+    post_accept();
+}
+
+void uring_reactor::shed(int fd)
+{
+    m_users[fd].shed(503);
+    pause_accept();
+}
+
+//取消accept后马上关闭监听socket；在途的accept持有它的引用，取消完成后才真正关闭，所以取消马上提交
+//取消生效之前已经完成握手的连接照常接进来，带着Connection: close处理完
+void uring_reactor::start_drain()
+{
+    m_draining = true;
+    m_drain_deadline = time_wheel::now_ms() + reactor::m_drain_ms;
+    http_conn::m_draining = true;
+    cancel_accept();
+    m_ring.submit(0);
+    m_accept_paused = true;
+    handoff::remove_listenfd(m_listenfd);
+    close(m_listenfd);
+    m_listenfd = -1;
+    if (m_tls_listenfd != -1)
+    {
+        handoff::remove_listenfd(m_tls_listenfd);
+        close(m_tls_listenfd);
+        m_tls_listenfd = -1;
+    }
+    LOG_INFO("reactor %d draining, %d connections", m_id, http_conn::m_user_count.load());
+}
+
+//在等读、没有读到一半请求的连接就是空闲的；还有在途recv时close_fd先shutdown，下个周期才算关完
+bool uring_reactor::drain_done()
+{
+    int live = 0;
+    for (int fd = 0; fd < m_fd_end; ++fd)
+    {
+        if (m_conns[fd].state == ST_CLOSED)
+            continue;
+        if (m_conns[fd].state == ST_RECV && m_users[fd].idle())
+            close_fd(fd);
+        if (m_conns[fd].state != ST_CLOSED)
+            live++;
+    }
+    if (live == 0)
+    {
+        LOG_INFO("reactor %d drained", m_id);
+        return true;
+    }
+    if (time_wheel::now_ms() >= m_drain_deadline)
+    {
+        LOG_WARN("reactor %d drain timeout, %d connections left", m_id, live);
+        return true;
+    }
+    return false;
+}
+
+void uring_reactor::deal_signal(char sig)
+{
+    switch (sig)
+    {
+    case SIGTERM:
+        if (m_draining || reactor::m_drain_ms <= 0)
+            m_stop = true;
+        else
+        {
+            start_drain();
+            m_stop = drain_done();
+        }
+        break;
+    case SIGUSR2:
+        if (m_id == 0 && !m_draining)
+            handoff::spawn();
+        break;
+    case SIGCHLD:
+        if (m_id == 0)
+            handoff::reap();
+        break;
+    }
+}
+
+//不指定缓冲区，由内核从提供缓冲区环中选一块
+void uring_reactor::post_recv(int fd)
+{
+    m_conns[fd].state = ST_RECV;
+    struct io_uring_sqe *s = sqe(OP_RECV, fd);
+    if (!s)
+    {
+        close_fd(fd);
+        return;
+    }
+    s->opcode = IORING_OP_RECV;
+    s->fd = fd;
+    s->len = URING_BUF_SIZE;
+    s->flags = IOSQE_BUFFER_SELECT;
+    s->buf_group = URING_BUF_GROUP;
+}
+
+//信号管道、timerfd、eventfd都是读一下就重新提交
+void uring_reactor::post_read(int op, int fd, void *buf, unsigned len)
+{
+    struct io_uring_sqe *s = sqe(op, fd);
+    if (!s)
+        return;
+    s->opcode = IORING_OP_READ;
+    s->fd = fd;
+    s->addr = (unsigned long)buf;
+    s->len = len;
+    s->off = (uint64_t)-1;
+}
+
+bool uring_reactor::ensure_pipe(int fd)
+{
+    conn_state &c = m_conns[fd];
+    if (c.pipefd[0] != -1)
+        return true;
+    if (pipe2(c.pipefd, O_CLOEXEC) == -1)
+    {
+        c.pipefd[0] = c.pipefd[1] = -1;
+        return false;
+    }
+    //管道默认64KB，尽量放大到一个发送窗口，失败就用默认大小
+    fcntl(c.pipefd[1], F_SETPIPE_SZ, (int)http_conn::SEND_WINDOW);
+    c.pipe_size = fcntl(c.pipefd[1], F_GETPIPE_SZ);
+    if (c.pipe_size <= 0)
+        c.pipe_size = 65536;
+    return true;
+}
+
+//提交下一段响应：内存段合并成一次sendmsg；文件段是链接的两个splice，文件->管道成功后才执行管道->socket
+//上一轮管道里还有没写出去的数据时，先只把它写完
+void uring_reactor::start_send(int fd)
+{
+    conn_state &c = m_conns[fd];
+    http_conn &conn = m_users[fd];
+    c.state = ST_SEND;
+    if (conn.bytes_left() <= 0)
+    {
+        after_write(fd);
+        return;
+    }
+
+    struct io_uring_sqe *s;
+    if (c.pipe_bytes > 0)
+    {
+        s = sqe(OP_SPLICE_OUT, fd);
+        if (!s)
+        {
+            close_fd(fd);
+            return;
+        }
+        s->opcode = IORING_OP_SPLICE;
+        s->fd = fd;
+        s->off = (uint64_t)-1;
+        s->splice_fd_in = c.pipefd[0];
+        s->splice_off_in = (uint64_t)-1;
+        s->len = c.pipe_bytes;
+        return;
+    }
+
+    int count = conn.fill_iov();
+    if (count > 0)
+    {
+        s = sqe(OP_SEND, fd);
+        if (!s)
+        {
+            close_fd(fd);
+            return;
+        }
+        memset(&c.msg, 0, sizeof(c.msg));
+        c.msg.msg_iov = conn.iov();
+        c.msg.msg_iovlen = count;
+        s->opcode = IORING_OP_SENDMSG;
+        s->fd = fd;
+        s->addr = (unsigned long)&c.msg;
+        s->len = 1;
+        s->msg_flags = conn.more_after(count) ? MSG_MORE : 0;
+        return;
+    }
+
+    int file_fd;
+    off_t offset, len;
+    conn.file_seg(file_fd, offset, len);
+    if (!ensure_pipe(fd))
+    {
+        close_fd(fd);
+        return;
+    }
+    if (len > c.pipe_size)
+        len = c.pipe_size;
+    //两个SQE必须在同一次提交里，链接才成立；提交失败(例如CQ溢出时返回-EBUSY)腾不出两个位置时关闭连接
+    if (m_ring.sq_space() < 2)
+        m_ring.submit(0);
+    if (m_ring.sq_space() < 2)
+    {
+        LOG_ERROR("%s", "io_uring submission queue full");
+        close_fd(fd);
+        return;
+    }
+    struct io_uring_sqe *in = sqe(OP_SPLICE_IN, fd);
+    if (!in)
+    {
+        close_fd(fd);
+        return;
+    }
+    in->opcode = IORING_OP_SPLICE;
+    in->fd = c.pipefd[1];
+    in->off = (uint64_t)-1;
+    in->splice_fd_in = file_fd;
+    in->splice_off_in = offset;
+    in->len = len;
+    in->flags = IOSQE_IO_LINK;
+    s = sqe(OP_SPLICE_OUT, fd);
+    if (!s)
+    {
+        //还没提交，去掉链接标志，不让它链到下一个不相干的SQE上
+        in->flags = 0;
+        close_fd(fd);
+        return;
+    }
+    s->opcode = IORING_OP_SPLICE;
+    s->fd = fd;
+    s->off = (uint64_t)-1;
+    s->splice_fd_in = c.pipefd[0];
+    s->splice_off_in = (uint64_t)-1;
+    s->len = len;
+}
+
+void uring_reactor::adjust_timer(int fd)
+{
+    util_timer *timer = &m_users_timer[fd].timer;
+    timer->expire = time_wheel::now_ms() + reactor::m_idle_ms;
+    m_timer_lst.adjust_timer(timer);
+}
+
+//连接上的一个操作完成，返回false表示连接正在关闭，完成结果不用再处理
+bool uring_reactor::op_done(int fd)
+{
+    conn_state &c = m_conns[fd];
+    c.inflight--;
+    if (c.state != ST_CLOSING)
+        return true;
+    if (c.inflight == 0)
+        release_fd(fd);
+    return false;
+}
+
+//服务器端关闭连接，移除对应的定时器；还有在途操作时先shutdown，等它们都完成再close
+void uring_reactor::close_fd(int fd)
+{
+    conn_state &c = m_conns[fd];
+    if (c.state == ST_CLOSED || c.state == ST_CLOSING)
+        return;
+    m_timer_lst.del_timer(&m_users_timer[fd].timer);
+    http_conn::m_user_count--;
+    admission::GetInstance()->disconnect(m_users_timer[fd].address.sin_addr.s_addr);
+    LOG_INFO("close fd %d", fd);
+    Log::get_instance()->flush();
+    c.state = ST_CLOSING;
+    if (c.inflight > 0)
+    {
+        shutdown(fd, SHUT_RDWR);
+        return;
+    }
+    release_fd(fd);
+}
+
+void uring_reactor::release_fd(int fd)
+{
+    conn_state &c = m_conns[fd];
+    if (c.pipefd[0] != -1)
+    {
+        close(c.pipefd[0]);
+        close(c.pipefd[1]);
+        c.pipefd[0] = c.pipefd[1] = -1;
+    }
+    c.pipe_bytes = 0;
+    c.state = ST_CLOSED;
+    close(fd);
+}
+
+//超时的连接如果正在工作线程上处理，推迟一个周期，处理完交回来时再说
+void uring_reactor::expire(int fd)
+{
+    if (m_conns[fd].state == ST_BUSY)
+    {
+        util_timer *timer = &m_users_timer[fd].timer;
+        timer->expire = time_wheel::now_ms() + reactor::m_idle_ms;
+        m_timer_lst.add_timer(timer);
+        return;
+    }
+    close_fd(fd);
+}
+
+void uring_reactor::notify(int sockfd, int ev)
+{
+    if (pthread_equal(pthread_self(), m_tid))
+    {
+        apply(sockfd, ev);
+        return;
+    }
+    m_notify_lock.lock();
+    m_notify_queue.push_back(std::make_pair(sockfd, ev));
+    m_notify_lock.unlock();
+    if (!m_wake_pending.exchange(true))
+    {
+        uint64_t one = 1;
+        ::write(m_wakefd, &one, sizeof(one));
+    }
+}
+
+void uring_reactor::apply(int fd, int ev)
+{
+    char state = m_conns[fd].state;
+    if (state == ST_CLOSED || state == ST_CLOSING)
+        return;
+    if (ev == EPOLLIN)
+        post_recv(fd);
+    else if (ev == EPOLLOUT)
+        start_send(fd);
+    else
+        close_fd(fd);
+}
+
+//先清标志再取队列：清标志之后入队的通知一定会再写一次eventfd，不会漏
+void uring_reactor::on_wake()
+{
+    m_wake_pending = false;
+    m_notify_lock.lock();
+    m_notify_batch.swap(m_notify_queue);
+    m_notify_lock.unlock();
+    for (size_t i = 0; i < m_notify_batch.size(); ++i)
+        apply(m_notify_batch[i].first, m_notify_batch[i].second);
+    m_notify_batch.clear();
+
+    //握手线程交回的TLS连接，收发都已经在内核里加解密
+    m_inbox.take(m_tls_batch);
+    for (size_t i = 0; i < m_tls_batch.size(); ++i)
+        add_conn(m_tls_batch[i].first, m_tls_batch[i].second);
+    m_tls_batch.clear();
+}
+
+void uring_reactor::on_accept(bool tls, int res, unsigned flags)
+{
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+        (tls ? m_tls_accept_armed : m_accept_armed) = false;
+        if (!m_accept_paused)
+            post_accept(tls ? m_tls_listenfd : m_listenfd);
+    }
+    //交接期间两个进程accept同一个队列，监听socket是非阻塞的，连接被另一个进程先接走时是EAGAIN
+    if (res == -ECANCELED || res == -EAGAIN)
+        return;
+    if (res < 0)
+    {
+        LOG_ERROR("%s:errno is:%d", "accept error", -res);
+        return;
+    }
+    int connfd = res;
+    //TLS连接还没握手，拒绝时直接关闭
+    if (http_conn::m_user_count >= reactor::m_max_fd || connfd >= reactor::m_max_fd)
+    {
+        metrics::add(metrics::CONN_REJECTED);
+        if (tls)
+            close(connfd);
+        else
+            http_conn::reject(connfd, 503);
+        LOG_ERROR("%s", "Internal server busy");
+        return;
+    }
+    //multishot accept不带对端地址，另外取一次
+    struct sockaddr_in client_address;
+    socklen_t client_addrlength = sizeof(client_address);
+    memset(&client_address, 0, sizeof(client_address));
+    getpeername(connfd, (struct sockaddr *)&client_address, &client_addrlength);
+    if (!admission::GetInstance()->connect(client_address.sin_addr.s_addr))
+    {
+        metrics::add(metrics::CONN_REJECTED);
+        if (tls)
+            close(connfd);
+        else
+            http_conn::reject(connfd, 429);
+        return;
+    }
+    if (tls)
+    {
+        tls_server::GetInstance()->handshake(connfd, client_address, &m_inbox);
+        return;
+    }
+    add_conn(connfd, client_address);
+}
+
+void uring_reactor::add_conn(int connfd, const sockaddr_in &client_address)
+{
+    metrics::add(metrics::CONN_ACCEPTED);
+    m_users[connfd].init(connfd, client_address, -1, this);
+    if (connfd >= m_fd_end)
+        m_fd_end = connfd + 1;
+    conn_state &c = m_conns[connfd];
+    c.inflight = 0;
+    c.pipe_bytes = 0;
+
+    m_users_timer[connfd].address = client_address;
+    m_users_timer[connfd].sockfd = connfd;
+    m_users_timer[connfd].epollfd = -1;
+    util_timer *timer = &m_users_timer[connfd].timer;
+    timer->user_data = &m_users_timer[connfd];
+    timer->cb_func = uring_cb_func;
+    timer->expire = time_wheel::now_ms() + reactor::m_idle_ms;
+    m_timer_lst.add_timer(timer);
+
+    post_recv(connfd);
+    if (http_conn::m_user_count >= ACCEPT_PAUSE_CONN)
+        pause_accept();
+}
+
+//收到的数据拷进连接的读缓冲区，提供缓冲区马上还给内核，然后和epoll后端一样交给工作线程
+void uring_reactor::on_recv(int fd, int res, unsigned flags)
+{
+    bool live = op_done(fd);
+    bool ok = live && res > 0;
+    if (flags & IORING_CQE_F_BUFFER)
+    {
+        unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (ok)
+            ok = m_users[fd].append_read(m_ring.buf_addr(bid), res);
+        m_ring.add_buf(bid);
+        m_ring.commit_bufs();
+    }
+    if (!live)
+        return;
+    //提供缓冲区暂时用完了，本轮处理完的缓冲区都已还回，重新提交即可
+    if (res == -ENOBUFS)
+    {
+        post_recv(fd);
+        return;
+    }
+    if (!ok)
+    {
+        close_fd(fd);
+        return;
+    }
+    LOG_INFO("deal with the client(%s)", inet_ntoa(m_users[fd].get_address()->sin_addr));
+    Log::get_instance()->flush();
+    adjust_timer(fd);
+    m_conns[fd].state = ST_BUSY;
+    //超过该IP的请求速率回429，线程池队列满回503，notify在本线程上马上关闭连接
+    if (!admission::GetInstance()->request(m_users_timer[fd].address.sin_addr.s_addr))
+    {
+        m_users[fd].shed(429);
+        return;
+    }
+    //GET /metrics在事件循环上直接处理
+    if (m_users[fd].inline_request())
+    {
+        m_users[fd].process();
+        return;
+    }
+    m_users[fd].queued();
+    if (!m_pool->append(m_users + fd, fd))
+        shed(fd);
+}
+
+void uring_reactor::on_send(int fd, int res)
+{
+    if (!op_done(fd))
+        return;
+    if (res <= 0)
+    {
+        close_fd(fd);
+        return;
+    }
+    sent(fd, res);
+}
+
+//文件->管道这一步只记下管道里有多少数据，要不要继续由链上的管道->socket决定
+void uring_reactor::on_splice_in(int fd, int res)
+{
+    if (res > 0)
+        m_conns[fd].pipe_bytes += res;
+    op_done(fd);
+}
+
+//文件->管道读短了，链上的这一步会被取消，管道里已有的数据下一轮单独写出去
+void uring_reactor::on_splice_out(int fd, int res)
+{
+    if (!op_done(fd))
+        return;
+    conn_state &c = m_conns[fd];
+    if (res > 0)
+    {
+        c.pipe_bytes -= res;
+        sent(fd, res);
+    }
+    else if (res == -ECANCELED && c.pipe_bytes > 0)
+        start_send(fd);
+    else
+        close_fd(fd);
+}
+
+void uring_reactor::sent(int fd, int res)
+{
+    m_users[fd].sent(res);
+    adjust_timer(fd);
+    if (m_users[fd].bytes_left() > 0)
+        start_send(fd);
+    else
+        after_write(fd);
+}
+
+//整批响应发完：短连接关闭；流水线上还有已读入的请求直接交给工作线程；否则finish_write已经通知本reactor重新recv
+void uring_reactor::after_write(int fd)
+{
+    http_conn &conn = m_users[fd];
+    LOG_INFO("send data to the client(%s)", inet_ntoa(conn.get_address()->sin_addr));
+    Log::get_instance()->flush();
+    if (!conn.finish_write())
+    {
+        close_fd(fd);
+        return;
+    }
+    if (conn.pipelined())
+    {
+        m_conns[fd].state = ST_BUSY;
+        conn.queued();
+        if (!m_pool->append(m_users + fd, fd))
+            shed(fd);
+    }
+}
+
+void uring_reactor::handle(uint64_t user_data, int res, unsigned flags)
+{
+    int op = user_data >> 32;
+    int fd = (int)(uint32_t)user_data;
+    switch (op)
+    {
+    case OP_ACCEPT:
+    case OP_TLS_ACCEPT:
+        on_accept(op == OP_TLS_ACCEPT, res, flags);
+        break;
+    case OP_RECV:
+        on_recv(fd, res, flags);
+        break;
+    case OP_SEND:
+        on_send(fd, res);
+        break;
+    case OP_SPLICE_IN:
+        on_splice_in(fd, res);
+        break;
+    case OP_SPLICE_OUT:
+        on_splice_out(fd, res);
+        break;
+    case OP_SIGNAL:
+        for (int i = 0; i < res; ++i)
+            deal_signal(m_signals[i]);
+        post_read(OP_SIGNAL, m_pipefd[0], m_signals, sizeof(m_signals));
+        break;
+    case OP_TIMER:
+        //和epoll后端一样，定时任务放到本轮完成事件都处理完之后
+        if (res == sizeof(m_timer_buf))
+            m_timeout = true;
+        post_read(OP_TIMER, m_timerfd, &m_timer_buf, sizeof(m_timer_buf));
+        break;
+    case OP_WAKE:
+        on_wake();
+        post_read(OP_WAKE, m_wakefd, &m_wake_buf, sizeof(m_wake_buf));
+        break;
+    case OP_CANCEL:
+        break;
+    }
+}
+
+void uring_reactor::eventloop()
+{
+    m_tid = pthread_self();
+    t_reactor = this;
+
+    post_accept();
+    post_read(OP_SIGNAL, m_pipefd[0], m_signals, sizeof(m_signals));
+    post_read(OP_TIMER, m_timerfd, &m_timer_buf, sizeof(m_timer_buf));
+    post_read(OP_WAKE, m_wakefd, &m_wake_buf, sizeof(m_wake_buf));
+
+    while (!m_stop)
+    {
+        //提交上一轮攒下的所有SQE，同时等至少一个完成事件
+        int ret = m_ring.submit(1);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY)
+        {
+            LOG_ERROR("io_uring_enter failure, errno is:%d", -ret);
+            break;
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = m_ring.peek_cqe()) != NULL)
+        {
+            uint64_t user_data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            m_ring.cqe_seen();
+            handle(user_data, res, flags);
+        }
+        if (m_timeout)
+        {
+            m_timer_lst.tick();
+            try_resume_accept();
+            admission::GetInstance()->sweep();
+            m_timeout = false;
+            if (m_draining && drain_done())
+                m_stop = true;
+        }
+    }
+}
@@ -0,0 +1,155 @@
+#ifndef URING_REACTOR_H
+#define URING_REACTOR_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include "reactor.h"
+#include "uring.h"
+
+#define URING_ENTRIES 1024     //提交队列长度，完成队列是它的4倍
+#define URING_BUF_COUNT 256    //每个reactor提供给recv的缓冲区块数，必须是2的幂
+#define URING_BUF_SIZE 4096    //每块提供缓冲区的大小
+#define URING_BUF_GROUP 0
+
+// 基于io_uring的事件循环，和reactor的用法一样：init、eventloop、worker，可以多个实例各自SO_REUSEPORT监听
+// epoll是"就绪了再去读写"，这里是"提交读写，完成了再通知"：
+//   accept用multishot，一次提交持续接收新连接
+//   recv不预先给每个连接分配缓冲区，由内核从提供缓冲区环(provided buffer ring)里挑一块，收到后拷进连接的读缓冲区马上还回去
+//   响应的内存段用sendmsg一次提交；大文件段用两个链接起来的splice：文件->管道->socket，相当于异步的sendfile
+//   一轮循环里攒下的所有提交和等待完成合并成一次io_uring_enter
+// 工作线程不能直接往不属于它的io_uring提交，连接的下一步(等读、等写、关闭)通过notify放进队列，用eventfd唤醒本reactor
+// 每个连接同一时刻最多只有一组操作在途：等读、等写、或者在工作线程上处理，三者互斥
+// 关闭时先shutdown让在途操作尽快结束，等在途操作数归零再close，fd号在此之前不会被accept复用
+// SIGTERM排空、SIGUSR2交接、TLS监听和epoll后端一样，见reactor.h；两个监听socket各自一个multishot accept
+class uring_reactor : public conn_notifier
+{
+public:
+    uring_reactor();
+    ~uring_reactor();
+
+    bool init(int id, int port, bool reuseport, threadpool<http_conn> *pool, http_conn *users);
+
+    // 事件循环，直到收到SIGTERM并排空
+    void eventloop();
+
+    static void *worker(void *arg);
+
+    // 连接要等读(EPOLLIN)、等写(EPOLLOUT)或者关闭(0)，在本reactor线程上直接处理，其他线程上放进队列
+    void notify(int sockfd, int ev);
+
+    // 定时器回调，在本reactor线程上调用
+    void expire(int sockfd);
+
+private:
+    enum OP
+    {
+        OP_ACCEPT = 1,
+        OP_RECV,
+        OP_SEND,
+        OP_SPLICE_IN,
+        OP_SPLICE_OUT,
+        OP_SIGNAL,
+        OP_TIMER,
+        OP_WAKE,
+        OP_CANCEL,
+        OP_TLS_ACCEPT //TLS监听socket上的accept，排空时监听socket已经关掉，晚到的完成事件靠它区分
+    };
+    enum STATE
+    {
+        ST_CLOSED = 0,
+        ST_RECV,    //已提交recv，等客户数据
+        ST_BUSY,    //交给了工作线程
+        ST_SEND,    //已提交sendmsg或splice
+        ST_CLOSING  //等在途操作结束后close
+    };
+    struct conn_state
+    {
+        char state;
+        short inflight;    //已提交未完成的操作数
+        int pipefd[2];     //大文件splice用的管道，第一次用到时创建
+        int pipe_bytes;    //已从文件读进管道、还没写到socket的字节数
+        int pipe_size;
+        struct msghdr msg; //sendmsg在途时内核会读它，放在连接自己的状态里
+    };
+
+    static uint64_t pack(int op, int fd)
+    {
+        return ((uint64_t)op << 32) | (uint32_t)fd;
+    }
+    struct io_uring_sqe *sqe(int op, int fd);
+    bool &accept_armed(int listenfd)
+    {
+        return listenfd == m_tls_listenfd ? m_tls_accept_armed : m_accept_armed;
+    }
+    void post_accept();
+    void post_accept(int listenfd);
+    void cancel_accept();
+    void cancel_accept(int listenfd);
+    void pause_accept();
+    void try_resume_accept();
+    void start_drain();
+    bool drain_done();
+    void deal_signal(char sig);
+    void shed(int fd);
+    void post_recv(int fd);
+    void post_read(int op, int fd, void *buf, unsigned len);
+    void start_send(int fd);
+    bool ensure_pipe(int fd);
+    void handle(uint64_t user_data, int res, unsigned flags);
+    void on_accept(bool tls, int res, unsigned flags);
+    void add_conn(int connfd, const sockaddr_in &client_address);
+    void on_recv(int fd, int res, unsigned flags);
+    void on_send(int fd, int res);
+    void on_splice_in(int fd, int res);
+    void on_splice_out(int fd, int res);
+    void on_wake();
+    void sent(int fd, int res);
+    void after_write(int fd);
+    void apply(int fd, int ev);
+    void close_fd(int fd);
+    void release_fd(int fd);
+    bool op_done(int fd);
+    void adjust_timer(int fd);
+
+private:
+    int m_id;
+    int m_listenfd;
+    int m_tls_listenfd;   //TLS监听socket，不开TLS时为-1
+    int m_pipefd[2];
+    int m_timerfd;
+    int m_wakefd;
+    pthread_t m_tid;
+    bool m_stop;
+    bool m_timeout;
+    bool m_accept_armed;  //multishot accept还在内核中
+    bool m_tls_accept_armed;
+    bool m_accept_paused; //过载时取消了accept，定时周期中检查是否恢复
+    bool m_draining;      //收到SIGTERM，正在排空
+    time_t m_drain_deadline;
+    int m_fd_end; //服务过的最大fd+1，排空时只扫到这里
+    uring m_ring;
+    time_wheel m_timer_lst;
+    client_data *m_users_timer;
+    conn_state *m_conns;
+    http_conn *m_users;
+    threadpool<http_conn> *m_pool;
+    char m_signals[64];
+    uint64_t m_timer_buf;
+    uint64_t m_wake_buf;
+
+    // 工作线程发来的(fd, 事件)，m_wake_pending保证攒着的通知只写一次eventfd
+    locker m_notify_lock;
+    std::vector<std::pair<int, int> > m_notify_queue;
+    std::vector<std::pair<int, int> > m_notify_batch;
+    std::atomic<bool> m_wake_pending;
+
+    // 握手线程交回的TLS连接，和notify共用eventfd
+    tls_inbox m_inbox;
+    std::vector<std::pair<int, sockaddr_in> > m_tls_batch;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+// HDR风格的对数线性直方图，记录纳秒，三位有效数字
+// 值按最高位分桶，每个桶再线性分成SUB_HALF个子桶；记录是一次下标计算加一次自增，不分配内存
+// 相对误差不超过1/SUB_HALF，可以覆盖1ns到2^MAX_BITS ns(约4.9小时)
+class histogram
+{
+public:
+    static const int SUB_BITS = 11;
+    static const uint64_t SUB_COUNT = 1ULL << SUB_BITS; //2048
+    static const uint64_t SUB_HALF = SUB_COUNT / 2;
+    static const int MAX_BITS = 44;
+    static const int BUCKETS = MAX_BITS - SUB_BITS + 1;
+
+    histogram() : m_counts((BUCKETS + 1) * SUB_HALF, 0)
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        fill(m_counts.begin(), m_counts.end(), 0);
+        m_total = 0;
+        m_min = UINT64_MAX;
+        m_max = 0;
+        m_sum = 0;
+        m_sumsq = 0;
+    }
+
+    void record(uint64_t v)
+    {
+        if (v >= (1ULL << MAX_BITS))
+            v = (1ULL << MAX_BITS) - 1;
+        m_counts[index(v)]++;
+        m_total++;
+        if (v < m_min)
+            m_min = v;
+        if (v > m_max)
+            m_max = v;
+        m_sum += v;
+        m_sumsq += (double)v * v;
+    }
+
+    void merge(const histogram &other)
+    {
+        for (size_t i = 0; i < m_counts.size(); ++i)
+            m_counts[i] += other.m_counts[i];
+        m_total += other.m_total;
+        if (other.m_min < m_min)
+            m_min = other.m_min;
+        if (other.m_max > m_max)
+            m_max = other.m_max;
+        m_sum += other.m_sum;
+        m_sumsq += other.m_sumsq;
+    }
+
+    uint64_t count() const { return m_total; }
+    uint64_t min() const { return m_total ? m_min : 0; }
+    uint64_t max() const { return m_max; }
+    double mean() const { return m_total ? m_sum / m_total : 0; }
+    double stdev() const
+    {
+        if (!m_total)
+            return 0;
+        double m = mean();
+        double var = m_sumsq / m_total - m * m;
+        return var > 0 ? sqrt(var) : 0;
+    }
+
+    //返回不小于percentile%的记录落在的子桶的上界，和HdrHistogram的valueAtPercentile一致
+    uint64_t percentile(double percentile) const
+    {
+        if (!m_total)
+            return 0;
+        uint64_t want = (uint64_t)ceil(percentile / 100.0 * m_total);
+        if (want == 0)
+            want = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < m_counts.size(); ++i)
+        {
+            seen += m_counts[i];
+            if (seen >= want)
+            {
+                uint64_t v = highest_equivalent(i);
+                return v < m_max ? v : m_max;
+            }
+        }
+        return m_max;
+    }
+
+private:
+    //第0个桶是[0, SUB_COUNT)整段，之后每个桶只用上半段子桶，下半段和前一个桶重合
+    static size_t index(uint64_t v)
+    {
+        int bucket = 63 - __builtin_clzll(v | (SUB_COUNT - 1)) - (SUB_BITS - 1);
+        uint64_t sub = v >> bucket;
+        return (size_t)bucket * SUB_HALF + sub;
+    }
+
+    static uint64_t highest_equivalent(size_t i)
+    {
+        if (i < SUB_COUNT)
+            return i;
+        size_t bucket = i / SUB_HALF - 1;
+        uint64_t sub = i % SUB_HALF + SUB_HALF;
+        return ((sub + 1) << bucket) - 1;
+    }
+
+private:
+    vector<uint64_t> m_counts;
+    uint64_t m_total;
+    uint64_t m_min;
+    uint64_t m_max;
+    double m_sum;
+    double m_sumsq;
+};
+
+#endif
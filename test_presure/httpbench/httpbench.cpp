@@ -0,0 +1,856 @@
+/*
+ * httpbench：基于epoll的多线程HTTP压测工具
+ *
+ * 和webbench的区别：
+ *   长连接，每个连接可以流水线发送多个请求
+ *   可以压登录(/2CGISQL.cgi)、注册(/3CGISQL.cgi)的POST流程，注册时每个请求用不同的用户名
+ *   -R指定总速率时是开环模式：请求按固定间隔"应该发出"，延迟从应该发出的时刻算起，
+ *   服务器卡住时排队的时间也算进去，不会因为客户端跟着变慢而漏掉(coordinated omission)
+ *   延迟记在HDR直方图里，结果以JSON输出到标准输出，人看的摘要输出到标准错误
+ *
+ * 用法：
+ *   httpbench [选项] http://host:port/path
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "histogram.h"
+
+using namespace std;
+
+static const int MAX_EVENTS = 256;
+static const int READ_BUFFER_SIZE = 65536;
+static const size_t MAX_HEADER_SIZE = 65536;
+static const int MAX_PIPELINE = 1024;
+static const int MAX_STATUS = 600;
+
+struct options
+{
+    int connections;
+    int threads;
+    int duration;
+    int pipeline;
+    double rate;        //总速率(请求/秒)，0为闭环
+    bool keepalive;
+    string method;
+    string body;
+    vector<string> headers;
+    string register_prefix; //非空时每个请求注册一个新用户
+    string password;
+    string output;
+    string url;
+    string host;        //Host头
+    string path;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+};
+
+static options g_opt;
+static string g_request;   //固定的请求；注册时是请求行和除Content-Length外的头部
+static uint64_t g_start;
+static uint64_t g_end;
+
+struct stats
+{
+    uint64_t sent;
+    uint64_t responses;
+    uint64_t bytes;
+    uint64_t connects;
+    uint64_t connect_errors;
+    uint64_t read_errors;
+    uint64_t write_errors;
+    uint64_t parse_errors;
+    uint64_t lost;          //连接断开时还没收到响应的请求
+    uint64_t unfinished;    //压测结束时还在路上或者排队的请求
+    uint64_t status[MAX_STATUS];
+};
+
+struct conn
+{
+    int fd;
+    bool connecting;
+    string wbuf;
+    size_t woff;
+    //发出还没收到响应的请求的开始时刻，环形数组，容量为流水线深度
+    vector<uint64_t> inflight;
+    size_t head;
+    size_t count;
+    //响应解析状态
+    string hbuf;
+    bool in_body;
+    bool until_close;   //没有Content-Length，响应体读到连接关闭
+    long long body_left;
+    int status;
+    bool close_after;   //响应头里有Connection: close
+    bool closing;       //已经收完最后一个响应，等着重连
+};
+
+struct worker
+{
+    int id;
+    pthread_t tid;
+    int epfd;
+    int tfd;
+    vector<conn> conns;
+    histogram hist;
+    stats st;
+    deque<uint64_t> backlog;  //开环模式下时刻到了但没有空闲连接的请求
+    double interval;          //开环模式下本线程相邻两个请求的间隔(ns)
+    uint64_t seq;
+    uint64_t next_due;
+    size_t rr;
+    uint64_t user_seq;
+};
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "httpbench [选项] http://host:port/path\n"
+            "  -c, --connections N   连接数，默认10\n"
+            "  -t, --threads N       线程数，默认取连接数和CPU数中较小的\n"
+            "  -d, --duration S      压测秒数，默认10\n"
+            "  -p, --pipeline N      每个连接同时在路上的请求数，默认1\n"
+            "  -R, --rate N          开环模式，总速率(请求/秒)；不指定为闭环，收到响应立即发下一个\n"
+            "  -m, --method M        请求方法，默认GET，指定-b时默认POST\n"
+            "  -b, --body S          请求体\n"
+            "  -H, --header H        额外的请求头，可以多次指定\n"
+            "      --login U:P       POST /2CGISQL.cgi 登录\n"
+            "      --register PFX    POST /3CGISQL.cgi 注册，用户名为PFX加线程号和序号\n"
+            "      --close           短连接，每个请求新建连接\n"
+            "  -o, --output FILE     JSON写到文件，默认标准输出\n");
+    exit(2);
+}
+
+static bool parse_url(const char *url)
+{
+    if (strncasecmp(url, "http://", 7) != 0)
+        return false;
+    const char *p = url + 7;
+    const char *slash = strchr(p, '/');
+    string hostport = slash ? string(p, slash - p) : string(p);
+    g_opt.path = slash ? string(slash) : string("/");
+    g_opt.host = hostport;
+    string host = hostport, port = "80";
+    size_t colon = hostport.rfind(':');
+    if (colon != string::npos)
+    {
+        host = hostport.substr(0, colon);
+        port = hostport.substr(colon + 1);
+    }
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0)
+        return false;
+    memcpy(&g_opt.addr, res->ai_addr, res->ai_addrlen);
+    g_opt.addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+static void parse_options(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        {"connections", required_argument, NULL, 'c'},
+        {"threads", required_argument, NULL, 't'},
+        {"duration", required_argument, NULL, 'd'},
+        {"pipeline", required_argument, NULL, 'p'},
+        {"rate", required_argument, NULL, 'R'},
+        {"method", required_argument, NULL, 'm'},
+        {"body", required_argument, NULL, 'b'},
+        {"header", required_argument, NULL, 'H'},
+        {"output", required_argument, NULL, 'o'},
+        {"login", required_argument, NULL, 'L'},
+        {"register", required_argument, NULL, 'G'},
+        {"close", no_argument, NULL, 'C'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    g_opt.connections = 10;
+    g_opt.threads = 0;
+    g_opt.duration = 10;
+    g_opt.pipeline = 1;
+    g_opt.rate = 0;
+    g_opt.keepalive = true;
+    string route;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:t:d:p:R:m:b:H:o:h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            g_opt.connections = atoi(optarg);
+            break;
+        case 't':
+            g_opt.threads = atoi(optarg);
+            break;
+        case 'd':
+            g_opt.duration = atoi(optarg);
+            break;
+        case 'p':
+            g_opt.pipeline = atoi(optarg);
+            break;
+        case 'R':
+            g_opt.rate = atof(optarg);
+            break;
+        case 'm':
+            g_opt.method = optarg;
+            break;
+        case 'b':
+            g_opt.body = optarg;
+            break;
+        case 'H':
+            g_opt.headers.push_back(optarg);
+            break;
+        case 'o':
+            g_opt.output = optarg;
+            break;
+        case 'L':
+        {
+            const char *colon = strchr(optarg, ':');
+            if (!colon)
+                usage();
+            g_opt.body = "user=" + string(optarg, colon - optarg) + "&password=" + string(colon + 1);
+            route = "/2CGISQL.cgi";
+            break;
+        }
+        case 'G':
+            g_opt.register_prefix = optarg;
+            g_opt.password = "bench";
+            route = "/3CGISQL.cgi";
+            break;
+        case 'C':
+            g_opt.keepalive = false;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc - 1 || !parse_url(argv[optind]))
+        usage();
+    g_opt.url = argv[optind];
+    if (!route.empty())
+        g_opt.path = route;
+    if (g_opt.connections <= 0 || g_opt.duration <= 0 || g_opt.pipeline <= 0 || g_opt.pipeline > MAX_PIPELINE || g_opt.rate < 0)
+        usage();
+    //短连接上没有流水线
+    if (!g_opt.keepalive)
+        g_opt.pipeline = 1;
+    if (g_opt.method.empty())
+        g_opt.method = g_opt.body.empty() && g_opt.register_prefix.empty() ? "GET" : "POST";
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (g_opt.threads <= 0)
+        g_opt.threads = cpus > 0 ? cpus : 1;
+    if (g_opt.threads > g_opt.connections)
+        g_opt.threads = g_opt.connections;
+}
+
+static void build_request()
+{
+    g_request = g_opt.method + " " + g_opt.path + " HTTP/1.1\r\nHost: " + g_opt.host + "\r\n";
+    g_request += g_opt.keepalive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    for (size_t i = 0; i < g_opt.headers.size(); ++i)
+        g_request += g_opt.headers[i] + "\r\n";
+    if (!g_opt.register_prefix.empty())
+    {
+        g_request += "Content-Type: application/x-www-form-urlencoded\r\n";
+        return;
+    }
+    if (!g_opt.body.empty() || g_opt.method == "POST")
+    {
+        char len[64];
+        snprintf(len, sizeof(len), "Content-Length: %zu\r\n", g_opt.body.size());
+        g_request += "Content-Type: application/x-www-form-urlencoded\r\n";
+        g_request += len;
+    }
+    g_request += "\r\n";
+    g_request += g_opt.body;
+}
+
+//注册请求每次生成新的用户名，其余请求直接拷贝
+static void append_request(worker *w, conn &c)
+{
+    if (g_opt.register_prefix.empty())
+    {
+        c.wbuf += g_request;
+        return;
+    }
+    char body[256], len[64];
+    int n = snprintf(body, sizeof(body), "user=%s%d_%llu&password=%s", g_opt.register_prefix.c_str(), w->id,
+                     (unsigned long long)w->user_seq++, g_opt.password.c_str());
+    snprintf(len, sizeof(len), "Content-Length: %d\r\n\r\n", n);
+    c.wbuf += g_request;
+    c.wbuf += len;
+    c.wbuf.append(body, n);
+}
+
+static void reset_parser(conn &c)
+{
+    c.hbuf.clear();
+    c.in_body = false;
+    c.until_close = false;
+    c.body_left = 0;
+    c.status = 0;
+    c.close_after = false;
+}
+
+static void open_conn(worker *w, conn &c)
+{
+    c.fd = socket(g_opt.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    c.wbuf.clear();
+    c.woff = 0;
+    c.head = 0;
+    c.count = 0;
+    c.connecting = true;
+    c.closing = false;
+    reset_parser(c);
+    if (c.fd < 0)
+    {
+        w->st.connect_errors++;
+        return;
+    }
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    w->st.connects++;
+    if (connect(c.fd, (struct sockaddr *)&g_opt.addr, g_opt.addrlen) == 0)
+        c.connecting = false;
+    else if (errno != EINPROGRESS)
+    {
+        w->st.connect_errors++;
+        close(c.fd);
+        c.fd = -1;
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = &c;
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, c.fd, &ev);
+}
+
+//返回false表示连接出错，由调用者重连
+static bool flush(worker *w, conn &c)
+{
+    if (c.connecting || c.fd < 0)
+        return true;
+    while (c.woff < c.wbuf.size())
+    {
+        ssize_t n = write(c.fd, c.wbuf.data() + c.woff, c.wbuf.size() - c.woff);
+        if (n < 0)
+        {
+            if (errno == EAGAIN)
+                return true;
+            if (errno == EINTR)
+                continue;
+            w->st.write_errors++;
+            return false;
+        }
+        c.woff += n;
+    }
+    c.wbuf.clear();
+    c.woff = 0;
+    return true;
+}
+
+//start是请求的开始时刻：闭环为写入时刻，开环为按速率应该发出的时刻
+static bool send_request(worker *w, conn &c, uint64_t start)
+{
+    append_request(w, c);
+    c.inflight[(c.head + c.count) % c.inflight.size()] = start;
+    c.count++;
+    w->st.sent++;
+    return flush(w, c);
+}
+
+static void fill(worker *w, conn &c, uint64_t now);
+static void reconnect(worker *w, conn &c);
+
+//断开的连接上没收到响应的请求记为lost，开环模式下它们不会重发
+static void reconnect(worker *w, conn &c)
+{
+    w->st.lost += c.count;
+    if (c.fd >= 0)
+        close(c.fd);
+    open_conn(w, c);
+    if (c.fd >= 0)
+        fill(w, c, now_ns());
+}
+
+//给连接补满请求：闭环补到流水线深度，开环只从积压里取
+static void fill(worker *w, conn &c, uint64_t now)
+{
+    if (c.fd < 0 || now >= g_end)
+        return;
+    while (c.count < (size_t)g_opt.pipeline)
+    {
+        uint64_t start;
+        if (g_opt.rate > 0)
+        {
+            //开环的请求只交给已经建立的连接，还在握手的连接上排队会把握手重传的时间算到某几个请求头上
+            if (w->backlog.empty() || c.connecting)
+                return;
+            start = w->backlog.front();
+            w->backlog.pop_front();
+        }
+        else
+            start = now;
+        if (!send_request(w, c, start))
+        {
+            reconnect(w, c);
+            return;
+        }
+    }
+}
+
+static void complete(worker *w, conn &c, uint64_t now)
+{
+    uint64_t start = c.inflight[c.head];
+    c.head = (c.head + 1) % c.inflight.size();
+    c.count--;
+    w->hist.record(now - start);
+    w->st.responses++;
+    if (c.status > 0 && c.status < MAX_STATUS)
+        w->st.status[c.status]++;
+}
+
+static bool header_is(const char *line, const char *name, const char **value)
+{
+    size_t len = strlen(name);
+    if (strncasecmp(line, name, len) != 0 || line[len] != ':')
+        return false;
+    const char *v = line + len + 1;
+    while (*v == ' ' || *v == '\t')
+        v++;
+    *value = v;
+    return true;
+}
+
+//hbuf中是完整的响应头，以\r\n\r\n结尾
+static bool parse_header(conn &c)
+{
+    char *p = &c.hbuf[0];
+    if (strncmp(p, "HTTP/1.", 7) != 0)
+        return false;
+    char *sp = strchr(p, ' ');
+    if (!sp)
+        return false;
+    c.status = atoi(sp + 1);
+    bool has_length = false;
+    bool chunked = false;
+    char *line = strstr(p, "\r\n");
+    while (line)
+    {
+        *line = '\0';
+        line += 2;
+        if (*line == '\r')
+            break;
+        char *next = strstr(line, "\r\n");
+        if (next)
+            *next = '\0';
+        const char *value;
+        if (header_is(line, "Content-Length", &value))
+        {
+            c.body_left = atoll(value);
+            has_length = true;
+        }
+        else if (header_is(line, "Connection", &value))
+            c.close_after = strcasestr(value, "close") != NULL;
+        else if (header_is(line, "Transfer-Encoding", &value))
+            chunked = strcasestr(value, "chunked") != NULL;
+        if (next)
+            *next = '\r';
+        line = next;
+    }
+    if (chunked)
+        return false;
+    bool no_body = c.status / 100 == 1 || c.status == 204 || c.status == 304 || g_opt.method == "HEAD";
+    if (no_body)
+        c.body_left = 0;
+    else if (!has_length)
+        c.until_close = true;
+    c.in_body = true;
+    return true;
+}
+
+//处理读到的一段数据，可能跨越多个流水线响应；大文件的响应体只计数不拷贝
+static bool on_data(worker *w, conn &c, const char *data, size_t len, uint64_t now)
+{
+    size_t off = 0;
+    while (off < len)
+    {
+        if (!c.in_body)
+        {
+            size_t old = c.hbuf.size();
+            c.hbuf.append(data + off, len - off);
+            size_t pos = c.hbuf.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+            if (pos == string::npos)
+            {
+                if (c.hbuf.size() > MAX_HEADER_SIZE)
+                    return false;
+                return true;
+            }
+            off += pos + 4 - old;
+            c.hbuf.resize(pos + 4);
+            if (c.count == 0 || !parse_header(c))
+                return false;
+        }
+        if (c.until_close)
+            return true;
+        size_t take = len - off;
+        if ((long long)take > c.body_left)
+            take = c.body_left;
+        off += take;
+        c.body_left -= take;
+        if (c.body_left > 0)
+            return true;
+        bool close_after = c.close_after || !g_opt.keepalive;
+        complete(w, c, now);
+        reset_parser(c);
+        if (close_after)
+        {
+            c.closing = true;
+            return true;
+        }
+    }
+    return true;
+}
+
+static void on_readable(worker *w, conn &c)
+{
+    static __thread char buf[READ_BUFFER_SIZE];
+    while (true)
+    {
+        ssize_t n = read(c.fd, buf, sizeof(buf));
+        if (n > 0)
+        {
+            w->st.bytes += n;
+            uint64_t now = now_ns();
+            if (!on_data(w, c, buf, n, now))
+            {
+                w->st.parse_errors++;
+                reconnect(w, c);
+                return;
+            }
+            if (c.closing)
+            {
+                reconnect(w, c);
+                return;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN)
+            break;
+        if (n < 0 && errno == EINTR)
+            continue;
+        //对端关闭：读到关闭为止的响应在这里完成；短连接正常结束
+        if (n == 0 && c.in_body && c.until_close)
+            complete(w, c, now_ns());
+        else if (n < 0 || c.count > 0)
+            w->st.read_errors++;
+        reconnect(w, c);
+        return;
+    }
+    fill(w, c, now_ns());
+}
+
+static void on_writable(worker *w, conn &c)
+{
+    if (c.connecting)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err)
+        {
+            w->st.connect_errors++;
+            reconnect(w, c);
+            return;
+        }
+        c.connecting = false;
+        //闭环的延迟不算建立连接的时间；开环保持应该发出的时刻，连接慢也是服务器慢
+        if (g_opt.rate == 0)
+        {
+            uint64_t now = now_ns();
+            for (size_t i = 0; i < c.count; ++i)
+                c.inflight[(c.head + i) % c.inflight.size()] = now;
+        }
+        else
+            fill(w, c, now_ns());
+    }
+    if (!flush(w, c))
+        reconnect(w, c);
+}
+
+//开环：把本线程已经到时刻的请求分给有空位的连接，分不出去的进积压队列，延迟照样从应该发出的时刻算
+static void dispatch_due(worker *w, uint64_t now)
+{
+    while (w->next_due <= now && w->next_due < g_end)
+    {
+        w->backlog.push_back(w->next_due);
+        w->seq++;
+        w->next_due = g_start + (uint64_t)(w->seq * w->interval) + (uint64_t)(w->id * w->interval / g_opt.threads);
+    }
+    size_t n = w->conns.size();
+    for (size_t i = 0; i < n && !w->backlog.empty(); ++i)
+    {
+        conn &c = w->conns[(w->rr + i) % n];
+        if (c.fd >= 0 && !c.connecting && c.count < (size_t)g_opt.pipeline)
+            fill(w, c, now);
+    }
+    w->rr = (w->rr + 1) % n;
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    uint64_t due = w->next_due < g_end ? w->next_due : g_end;
+    its.it_value.tv_sec = due / 1000000000ULL;
+    its.it_value.tv_nsec = due % 1000000000ULL;
+    timerfd_settime(w->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void *run_worker(void *arg)
+{
+    worker *w = (worker *)arg;
+    w->epfd = epoll_create1(0);
+    w->tfd = -1;
+    if (g_opt.rate > 0)
+    {
+        w->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->tfd, &ev);
+        w->interval = 1e9 / (g_opt.rate / g_opt.threads);
+        w->next_due = g_start + (uint64_t)(w->id * w->interval / g_opt.threads);
+    }
+    for (size_t i = 0; i < w->conns.size(); ++i)
+    {
+        w->conns[i].inflight.assign(g_opt.pipeline, 0);
+        open_conn(w, w->conns[i]);
+        if (g_opt.rate == 0)
+            fill(w, w->conns[i], now_ns());
+    }
+    if (g_opt.rate > 0)
+        dispatch_due(w, now_ns());
+
+    struct epoll_event events[MAX_EVENTS];
+    while (true)
+    {
+        uint64_t now = now_ns();
+        if (now >= g_end)
+            break;
+        int timeout = (g_end - now) / 1000000 + 1;
+        if (timeout > 100)
+            timeout = 100;
+        int n = epoll_wait(w->epfd, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < n; ++i)
+        {
+            if (!events[i].data.ptr)
+            {
+                uint64_t expirations;
+                if (read(w->tfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+                    break;
+                dispatch_due(w, now_ns());
+                continue;
+            }
+            conn &c = *(conn *)events[i].data.ptr;
+            if (c.fd < 0)
+                continue;
+            if (events[i].events & EPOLLOUT)
+                on_writable(w, c);
+            if (c.fd >= 0 && !c.connecting && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+                on_readable(w, c);
+        }
+        //失败的连接(socket或connect直接出错)在这里重试
+        for (size_t i = 0; i < w->conns.size(); ++i)
+            if (w->conns[i].fd < 0 && now_ns() < g_end)
+                reconnect(w, w->conns[i]);
+    }
+
+    for (size_t i = 0; i < w->conns.size(); ++i)
+    {
+        w->st.unfinished += w->conns[i].count;
+        if (w->conns[i].fd >= 0)
+            close(w->conns[i].fd);
+    }
+    w->st.unfinished += w->backlog.size();
+    close(w->epfd);
+    if (w->tfd >= 0)
+        close(w->tfd);
+    return NULL;
+}
+
+static void json_string(FILE *f, const string &s)
+{
+    fputc('"', f);
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        unsigned char ch = s[i];
+        if (ch == '"' || ch == '\\')
+            fprintf(f, "\\%c", ch);
+        else if (ch < 0x20)
+            fprintf(f, "\\u%04x", ch);
+        else
+            fputc(ch, f);
+    }
+    fputc('"', f);
+}
+
+static void report(FILE *f, const histogram &h, const stats &st, double seconds)
+{
+    static const double pcts[] = {50, 75, 90, 99, 99.9, 99.99, 100};
+    static const char *names[] = {"p50", "p75", "p90", "p99", "p999", "p9999", "p100"};
+    const int npct = sizeof(pcts) / sizeof(pcts[0]);
+
+    fprintf(f, "{\n  \"url\": ");
+    json_string(f, g_opt.url);
+    fprintf(f, ",\n  \"method\": ");
+    json_string(f, g_opt.method);
+    fprintf(f, ",\n  \"path\": ");
+    json_string(f, g_opt.path);
+    fprintf(f, ",\n  \"mode\": \"%s\",\n", g_opt.rate > 0 ? "open" : "closed");
+    fprintf(f, "  \"connections\": %d,\n  \"threads\": %d,\n  \"pipeline\": %d,\n  \"keepalive\": %s,\n",
+            g_opt.connections, g_opt.threads, g_opt.pipeline, g_opt.keepalive ? "true" : "false");
+    fprintf(f, "  \"target_rate\": %.1f,\n  \"duration_s\": %.3f,\n", g_opt.rate, seconds);
+    fprintf(f, "  \"requests\": %llu,\n  \"responses\": %llu,\n  \"bytes\": %llu,\n",
+            (unsigned long long)st.sent, (unsigned long long)st.responses, (unsigned long long)st.bytes);
+    fprintf(f, "  \"rps\": %.1f,\n  \"bytes_per_s\": %.1f,\n", st.responses / seconds, st.bytes / seconds);
+    fprintf(f, "  \"connects\": %llu,\n", (unsigned long long)st.connects);
+    fprintf(f, "  \"errors\": {\"connect\": %llu, \"read\": %llu, \"write\": %llu, \"parse\": %llu, \"lost\": %llu, \"unfinished\": %llu},\n",
+            (unsigned long long)st.connect_errors, (unsigned long long)st.read_errors, (unsigned long long)st.write_errors,
+            (unsigned long long)st.parse_errors, (unsigned long long)st.lost, (unsigned long long)st.unfinished);
+    fprintf(f, "  \"status\": {");
+    bool first = true;
+    for (int i = 0; i < MAX_STATUS; ++i)
+    {
+        if (!st.status[i])
+            continue;
+        fprintf(f, "%s\"%d\": %llu", first ? "" : ", ", i, (unsigned long long)st.status[i]);
+        first = false;
+    }
+    fprintf(f, "},\n");
+    fprintf(f, "  \"latency_us\": {\"min\": %.1f, \"mean\": %.1f, \"stdev\": %.1f, \"max\": %.1f",
+            h.min() / 1e3, h.mean() / 1e3, h.stdev() / 1e3, h.max() / 1e3);
+    for (int i = 0; i < npct; ++i)
+        fprintf(f, ", \"%s\": %.1f", names[i], h.percentile(pcts[i]) / 1e3);
+    fprintf(f, "}\n}\n");
+}
+
+static void summary(const histogram &h, const stats &st, double seconds)
+{
+    fprintf(stderr, "%s %s  %d connections, %d threads, pipeline %d, %s",
+            g_opt.method.c_str(), g_opt.path.c_str(), g_opt.connections, g_opt.threads, g_opt.pipeline,
+            g_opt.keepalive ? "keep-alive" : "close");
+    if (g_opt.rate > 0)
+        fprintf(stderr, ", open loop %.0f req/s\n", g_opt.rate);
+    else
+        fprintf(stderr, ", closed loop\n");
+    fprintf(stderr, "  %llu responses in %.2fs, %.0f req/s, %.2f MB/s\n", (unsigned long long)st.responses, seconds,
+            st.responses / seconds, st.bytes / seconds / 1048576);
+    fprintf(stderr, "  latency(us) p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n", h.percentile(50) / 1e3,
+            h.percentile(90) / 1e3, h.percentile(99) / 1e3, h.percentile(99.9) / 1e3, h.max() / 1e3);
+    uint64_t errors = st.connect_errors + st.read_errors + st.write_errors + st.parse_errors + st.lost;
+    if (errors)
+        fprintf(stderr, "  errors: connect %llu read %llu write %llu parse %llu lost %llu\n",
+                (unsigned long long)st.connect_errors, (unsigned long long)st.read_errors,
+                (unsigned long long)st.write_errors, (unsigned long long)st.parse_errors, (unsigned long long)st.lost);
+}
+
+int main(int argc, char *argv[])
+{
+    parse_options(argc, argv);
+    build_request();
+    signal(SIGPIPE, SIG_IGN);
+
+    //连接数多时放开文件描述符限制
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)g_opt.connections + 64)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    vector<worker> workers(g_opt.threads);
+    g_start = now_ns();
+    g_end = g_start + (uint64_t)g_opt.duration * 1000000000ULL;
+    for (int i = 0; i < g_opt.threads; ++i)
+    {
+        worker &w = workers[i];
+        w.id = i;
+        memset(&w.st, 0, sizeof(w.st));
+        w.seq = 0;
+        w.rr = 0;
+        w.user_seq = 0;
+        int n = g_opt.connections / g_opt.threads + (i < g_opt.connections % g_opt.threads);
+        w.conns.resize(n);
+        for (int j = 0; j < n; ++j)
+            w.conns[j].fd = -1;
+    }
+    for (int i = 0; i < g_opt.threads; ++i)
+    {
+        if (pthread_create(&workers[i].tid, NULL, run_worker, &workers[i]) != 0)
+        {
+            perror("pthread_create");
+            return 3;
+        }
+    }
+
+    histogram total;
+    stats st;
+    memset(&st, 0, sizeof(st));
+    for (int i = 0; i < g_opt.threads; ++i)
+    {
+        pthread_join(workers[i].tid, NULL);
+        worker &w = workers[i];
+        total.merge(w.hist);
+        st.sent += w.st.sent;
+        st.responses += w.st.responses;
+        st.bytes += w.st.bytes;
+        st.connects += w.st.connects;
+        st.connect_errors += w.st.connect_errors;
+        st.read_errors += w.st.read_errors;
+        st.write_errors += w.st.write_errors;
+        st.parse_errors += w.st.parse_errors;
+        st.lost += w.st.lost;
+        st.unfinished += w.st.unfinished;
+        for (int j = 0; j < MAX_STATUS; ++j)
+            st.status[j] += w.st.status[j];
+    }
+    double seconds = (now_ns() - g_start) / 1e9;
+
+    summary(total, st, seconds);
+    FILE *f = stdout;
+    if (!g_opt.output.empty() && !(f = fopen(g_opt.output.c_str(), "w")))
+    {
+        perror(g_opt.output.c_str());
+        return 3;
+    }
+    report(f, total, st, seconds);
+    if (f != stdout)
+        fclose(f);
+    return st.responses ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// 线程绑核的几个小工具
+// NUMA节点的CPU列表从/sys/devices/system/node/nodeN/cpulist读取，格式形如"0-7,16-23"
+// 不依赖libnuma，读不到节点信息时认为只有一个节点
+
+//把cpulist字符串解析到cpu_set_t中
+inline void parse_cpulist(const char *list, cpu_set_t *set)
+{
+    const char *p = list;
+    while (*p)
+    {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        long hi = lo;
+        p = end;
+        if (*p == '-')
+        {
+            hi = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, set);
+        if (*p == ',')
+            ++p;
+        else
+            break;
+    }
+}
+
+//NUMA节点数
+inline int numa_node_count()
+{
+    int count = 0;
+    char path[64];
+    while (true)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", count);
+        if (access(path, F_OK) != 0)
+            break;
+        ++count;
+    }
+    return count > 0 ? count : 1;
+}
+
+//把当前线程绑定到第cpu个在线CPU上
+inline bool bind_self_to_cpu(int cpu)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu <= 0)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % ncpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+//把当前线程绑定到第node个NUMA节点的所有CPU上，内存按首次访问分配，自然落在本节点
+inline bool bind_self_to_node(int node)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node % numa_node_count());
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return false;
+    char list[1024] = {0};
+    bool ok = fgets(list, sizeof(list), fp) != NULL;
+    fclose(fp);
+    if (!ok)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    parse_cpulist(list, &set);
+    if (CPU_COUNT(&set) == 0)
+        return false;
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+#endif
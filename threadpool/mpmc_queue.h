@@ -0,0 +1,119 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+
+// 有界无锁多生产者多消费者环形队列(Dmitry Vyukov的算法)
+// 每个槽带一个序号sequence：
+//   sequence == pos          表示该槽空闲，可以被写入位置pos的生产者占用
+//   sequence == pos + 1      表示该槽已写入，可以被读取位置pos的消费者取走
+// 生产者和消费者各自用CAS推进m_enqueue_pos和m_dequeue_pos，不需要互斥锁
+// 入队出队都不分配内存，队列满时push返回false，队列空时pop返回false
+template <typename T>
+class mpmc_queue
+{
+public:
+    // 容量向上取整为2的幂，便于用位与代替取模
+    mpmc_queue(size_t max_size)
+    {
+        if (max_size == 0)
+            throw std::exception();
+        size_t size = 2;
+        while (size < max_size)
+            size <<= 1;
+        m_mask = size - 1;
+        m_buffer = new cell[size];
+        for (size_t i = 0; i < size; ++i)
+            m_buffer[i].sequence.store(i, std::memory_order_relaxed);
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+    ~mpmc_queue()
+    {
+        delete[] m_buffer;
+    }
+
+    bool push(const T &data)
+    {
+        cell *c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            c = &m_buffer[pos & m_mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0)
+            {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+                return false; //队列满
+            else
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+        c->data = data;
+        c->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &data)
+    {
+        cell *c;
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            c = &m_buffer[pos & m_mask];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0)
+            {
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+                return false; //队列空
+            else
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+        data = c->data;
+        c->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 近似的元素个数，只用于统计
+    size_t size() const
+    {
+        size_t head = m_dequeue_pos.load(std::memory_order_relaxed);
+        size_t tail = m_enqueue_pos.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+private:
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    // 生产者和消费者的位置放在不同的cache line，避免伪共享
+    static const size_t CACHELINE = 64;
+    char m_pad0[CACHELINE];
+    cell *m_buffer;
+    size_t m_mask;
+    char m_pad1[CACHELINE - sizeof(cell *) - sizeof(size_t)];
+    std::atomic<size_t> m_enqueue_pos;
+    char m_pad2[CACHELINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_dequeue_pos;
+    char m_pad3[CACHELINE - sizeof(std::atomic<size_t>)];
+};
+
+#endif
@@ -5,8 +5,11 @@
 #include <cstdio>
 #include <exception>
 #include <pthread.h>
+#include <unistd.h>
+#include <atomic>
 #include "../lock/locker.h"
-#include "../CGImysql/sql_connection_pool.h"
+#include "mpmc_queue.h"
+#include "affinity.h"
 
 
 
@@ -25,12 +28,54 @@ template <typename T>
 class threadpool
 {
 public:
+    // 请求队列的实现方式
+    // LIST_QUEUE：互斥锁 + 链表 + 信号量，每个请求一次加锁，链表节点取走后留着复用
+    // LOCKFREE_QUEUE：有界无锁环形队列，容量由max_request决定，只在有空闲线程时才唤醒
+    // WORKSTEAL_QUEUE：每个线程一个本地无锁队列，请求按home投递给固定的线程，空闲线程从别的线程的队列中窃取
+    enum QUEUE_MODE
+    {
+        LIST_QUEUE = 0,
+        LOCKFREE_QUEUE,
+        WORKSTEAL_QUEUE
+    };
+
+    // 工作线程绑核方式
+    // AFFINITY_NONE：不绑定
+    // AFFINITY_CPU：第i个线程绑定到第i个CPU
+    // AFFINITY_NUMA：第i个线程绑定到第i个NUMA节点的全部CPU，避免跨socket访问
+    enum AFFINITY_MODE
+    {
+        AFFINITY_NONE = 0,
+        AFFINITY_CPU,
+        AFFINITY_NUMA
+    };
+
     /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许的、等待处理的请求的数量*/
-    threadpool(connection_pool *connPool, int thread_number = 8, int max_request = 10000);
+    // 工作线程不再为每个请求占用数据库连接，需要访问数据库的请求交给sql_executor
+    // max_thread_number大于thread_number时线程数自适应：队列持续积压时加线程，直到max_thread_number，
+    // 持续空闲时退出多出来的线程，回到thread_number；WORKSTEAL_QUEUE的本地队列按线程数创建，不支持自适应
+    threadpool(int thread_number = 8, int max_request = 10000, int queue_mode = LIST_QUEUE, int affinity_mode = AFFINITY_NONE,
+               int max_thread_number = 0);
     ~threadpool();
 
     // 向请求队列中插入任务请求，T是表征任务的数据结构类型，实际实现时让T  = http_conn
-    bool append(T *request);
+    // home为请求的亲和键(例如连接的fd)，WORKSTEAL_QUEUE模式下同一个home总是投递给同一个线程，
+    // 让该连接的http_conn留在同一个核的cache中；小于0时轮流投递。其他模式忽略home
+    bool append(T *request, int home = -1);
+
+    // 还在队列中等待处理的请求数，读时计算，append和工作线程上不多做任何事；无锁队列下是近似值
+    int queue_depth();
+
+    // 当前的工作线程数
+    int thread_count() { return m_live.load(); }
+
+    // 停止线程池：睡着的线程马上退出，正在处理请求的线程做完手上这个再退出，队列里剩下的请求不再处理
+    // 最多等timeout_ms毫秒，全部退出返回true；析构时也会调用
+    bool stop(int timeout_ms);
+
+    static const int ADAPT_INTERVAL_MS = 100; //自适应时每隔多久看一次队列深度
+    static const int ADAPT_GROW_TICKS = 3;    //连续这么多次积压的请求多于线程数，开始每次加一个线程
+    static const int ADAPT_SHRINK_TICKS = 50; //连续这么多次队列为空，退出一个线程
 
 
 
@@ -54,15 +99,50 @@ private:
     // 如果设置成静态成员函数，就无法访问非静态成员变量和非静态成员函数了
     void run();
 
+    // 无锁队列模式下的工作循环和唤醒
+    void run_lockfree();
+    void wake_idle();
+
+    // 工作窃取模式下的工作循环、取任务和唤醒
+    void run_worksteal(int id);
+    bool take(int id, T *&request);
+    void wake_worker(int home);
+    bool claim(int id);
+
+    // 自适应线程数：监视线程、加一个线程、空闲的线程认领一次退出
+    static void *monitor(void *arg);
+    bool add_thread();
+    bool retire();
+
 private:
     int m_thread_number;        //线程池中的线程数
     int m_max_requests;         //请求队列中允许的最大请求数
     pthread_t *m_threads;       //描述线程池的数组，其大小为m_thread_number
     std::list<T *> m_workqueue; //请求队列，使用链表实现
+    std::list<T *> m_freenodes; //取走任务后留下的节点，append时splice回m_workqueue
     locker m_queuelocker;       //保护请求队列的互斥锁
     sem m_queuestat;            //是否有任务需要处理
-    bool m_stop;                //是否结束线程
-    connection_pool *m_connPool;  //数据库
+    std::atomic<bool> m_stop;   //是否结束线程
+    int m_queue_mode;             //请求队列的实现方式
+    mpmc_queue<T *> *m_ringqueue; //无锁请求队列，只在LOCKFREE_QUEUE模式下创建
+    std::atomic<int> m_idle;      //睡在m_queuestat上、还没有被唤醒的线程数
+
+    // 工作窃取模式下每个线程一份，按cache line对齐，互不干扰
+    struct worker_slot
+    {
+        mpmc_queue<T *> *queue;        //本地请求队列，只有本线程和窃取者消费
+        sem wakeup;                    //本线程睡在这里
+        std::atomic<bool> sleeping;    //是否正在睡眠、等待被唤醒
+    } __attribute__((aligned(64)));
+    worker_slot *m_slots;
+    std::atomic<unsigned> m_next_home; //home小于0时轮流投递
+    std::atomic<int> m_next_id;        //给工作线程分配编号
+    int m_affinity_mode;
+    int m_max_threads;               //自适应时线程数的上限，不自适应时等于m_thread_number
+    std::atomic<int> m_live;         //正在运行的工作线程数
+    std::atomic<int> m_retire;       //等着被空闲线程认领的退出次数
+    bool m_adaptive;
+    pthread_t m_monitor;
 };
 
 
@@ -70,10 +150,30 @@ private:
 // 线程池类的构造函数的具体实现
 template <typename T>
 // 下面这行，使用初始化列表来对类中的成员进行初始化，即将参数列表承接到的数值赋给冒号后的各个成员变量
-threadpool<T>::threadpool( connection_pool *connPool, int thread_number, int max_requests) : m_thread_number(thread_number), m_max_requests(max_requests), m_stop(false), m_threads(NULL),m_connPool(connPool)
+threadpool<T>::threadpool(int thread_number, int max_requests, int queue_mode, int affinity_mode, int max_thread_number) : m_thread_number(thread_number), m_max_requests(max_requests), m_stop(false), m_threads(NULL), m_queue_mode(queue_mode), m_ringqueue(NULL), m_idle(0), m_slots(NULL), m_next_home(0), m_next_id(0), m_affinity_mode(affinity_mode), m_max_threads(thread_number), m_live(0), m_retire(0), m_adaptive(false)
 {
     if (thread_number <= 0 || max_requests <= 0)
         throw std::exception();
+    if (max_thread_number > thread_number && m_queue_mode != WORKSTEAL_QUEUE)
+    {
+        m_max_threads = max_thread_number;
+        m_adaptive = true;
+    }
+    if (m_queue_mode == LOCKFREE_QUEUE)
+        m_ringqueue = new mpmc_queue<T *>(max_requests);
+    if (m_queue_mode == WORKSTEAL_QUEUE)
+    {
+        // 总容量仍由max_requests决定，平均分给每个线程
+        int local_size = max_requests / thread_number;
+        if (local_size < 16)
+            local_size = 16;
+        m_slots = new worker_slot[thread_number];
+        for (int i = 0; i < thread_number; ++i)
+        {
+            m_slots[i].queue = new mpmc_queue<T *>(local_size);
+            m_slots[i].sleeping.store(false);
+        }
+    }
     // 这个数组中存储了m_thread_number个pthread_t型变量，一个pthread_t就是一个线程对应的id
     m_threads = new pthread_t[m_thread_number];
 
@@ -107,7 +207,11 @@ threadpool<T>::threadpool( connection_pool *connPool, int thread_number, int max
             delete[] m_threads;     // 释放m_threads所指向的   pthread_t类型数组    所占用的堆空间
             throw std::exception();
         }
+        m_live++;
     }
+
+    if (m_adaptive && pthread_create(&m_monitor, NULL, monitor, this) != 0)
+        throw std::exception();
 }
 
 
@@ -115,23 +219,91 @@ threadpool<T>::threadpool( connection_pool *connPool, int thread_number, int max
 template <typename T>
 threadpool<T>::~threadpool()
 {
+    // 还有线程没有退出时不释放队列，它们醒来还会访问
+    if (!stop(1000))
+        return;
     delete[] m_threads;
-    m_stop = true;
+    delete m_ringqueue;
+    if (m_slots)
+    {
+        for (int i = 0; i < m_thread_number; ++i)
+            delete m_slots[i].queue;
+        delete[] m_slots;
+    }
+}
+
+
+template <typename T>
+bool threadpool<T>::stop(int timeout_ms)
+{
+    if (!m_stop.exchange(true))
+    {
+        if (m_adaptive)
+            pthread_join(m_monitor, NULL);
+        // 每个线程最多睡在一个信号量上，各post一次就都能醒来看到m_stop
+        int live = m_live.load();
+        if (m_queue_mode == WORKSTEAL_QUEUE)
+        {
+            for (int i = 0; i < m_thread_number; ++i)
+                m_slots[i].wakeup.post();
+        }
+        else
+        {
+            for (int i = 0; i < live; ++i)
+                m_queuestat.post();
+        }
+    }
+    for (int waited = 0; m_live.load() > 0 && waited < timeout_ms; ++waited)
+        usleep(1000);
+    return m_live.load() == 0;
 }
 
 
 // 当有新的客户请求到来时，线程池对象收到主线程的通知后
 // 会把新的任务插入到list<T*>中，然后使用m_queuestat信号量来通知池子里的线程过来领取任务
 template <typename T>
-bool threadpool<T>::append(T *request)
+bool threadpool<T>::append(T *request, int home)
 {
+    if (m_queue_mode == WORKSTEAL_QUEUE)
+    {
+        if (home < 0)
+            home = m_next_home.fetch_add(1);
+        home %= m_thread_number;
+        // home线程的队列满了就放到别的线程的队列中，都满了才拒绝
+        int i = 0;
+        for (; i < m_thread_number; ++i)
+        {
+            if (m_slots[(home + i) % m_thread_number].queue->push(request))
+                break;
+        }
+        if (i == m_thread_number)
+            return false;
+        wake_worker((home + i) % m_thread_number);
+        return true;
+    }
+
+    if (m_queue_mode == LOCKFREE_QUEUE)
+    {
+        if (!m_ringqueue->push(request))
+            return false;
+        wake_idle();
+        return true;
+    }
+
     m_queuelocker.lock();
     if (m_workqueue.size() > m_max_requests)
     {
         m_queuelocker.unlock();
         return false;
     }
-    m_workqueue.push_back(request);
+    //复用已取走任务的链表节点，稳定后append不再分配内存
+    if (m_freenodes.empty())
+        m_workqueue.push_back(request);
+    else
+    {
+        m_freenodes.front() = request;
+        m_workqueue.splice(m_workqueue.end(), m_freenodes, m_freenodes.begin());
+    }
     m_queuelocker.unlock();
 
     // post()函数是让信号量加1，这样其他阻塞在m_queuestat.wait();语句的线程才能向下执行，否则在池子里sleep
@@ -141,6 +313,26 @@ bool threadpool<T>::append(T *request)
 
 
 
+template <typename T>
+int threadpool<T>::queue_depth()
+{
+    if (m_queue_mode == WORKSTEAL_QUEUE)
+    {
+        size_t depth = 0;
+        for (int i = 0; i < m_thread_number; ++i)
+            depth += m_slots[i].queue->size();
+        return depth;
+    }
+    if (m_queue_mode == LOCKFREE_QUEUE)
+        return m_ringqueue->size();
+    m_queuelocker.lock();
+    int depth = m_workqueue.size();
+    m_queuelocker.unlock();
+    return depth;
+}
+
+
+
 // 这个函数只是实现从静态回调函数worker来启动真正的工作处理函数run的目的
 // 解释：之所以需要这个函数是因为不能直接给C库里的pthread_create（屎山）函数传入非静态成员函数的函数指针
 template <typename T>
@@ -153,15 +345,217 @@ void *threadpool<T>::worker(void *arg)
 
     // 此处的pool就是在主函数中创建的threadpool类的对象的this指针
     pool->run();
+    // 之后不能再访问pool，stop看到m_live归零就会释放它
+    pool->m_live--;
     return pool;
 }
 
 
 
+// 监视线程：积压的请求持续多于线程数就每次加一个线程，队列持续为空就请一个线程退出
+// 退出通过m_retire交给工作线程：唤醒一个睡着的线程，它发现队列为空时认领退出；没有睡着的线程时由下一个取空队列的线程认领
+template <typename T>
+void *threadpool<T>::monitor(void *arg)
+{
+    threadpool *pool = (threadpool *)arg;
+    int busy = 0, quiet = 0;
+    while (!pool->m_stop)
+    {
+        usleep(ADAPT_INTERVAL_MS * 1000);
+        int depth = pool->queue_depth();
+        int threads = pool->m_live.load() - pool->m_retire.load();
+        busy = depth > threads ? busy + 1 : 0;
+        quiet = depth == 0 ? quiet + 1 : 0;
+        if (busy >= ADAPT_GROW_TICKS && threads < pool->m_max_threads)
+            pool->add_thread();
+        else if (quiet >= ADAPT_SHRINK_TICKS && threads > pool->m_thread_number)
+        {
+            quiet = 0;
+            pool->m_retire.fetch_add(1);
+            if (pool->m_queue_mode == LOCKFREE_QUEUE)
+                pool->wake_idle();
+            else
+                pool->m_queuestat.post();
+        }
+    }
+    return pool;
+}
+
+// 加出来的线程也是分离的，退出后自行回收，不记在m_threads里
+template <typename T>
+bool threadpool<T>::add_thread()
+{
+    pthread_t tid;
+    m_live++;
+    if (pthread_create(&tid, NULL, worker, this) != 0)
+    {
+        m_live--;
+        return false;
+    }
+    pthread_detach(tid);
+    return true;
+}
+
+// 取到空队列的线程调用，认领到一次退出就返回true，线程随即结束，m_live在worker中减
+template <typename T>
+bool threadpool<T>::retire()
+{
+    int n = m_retire.load();
+    while (n > 0)
+    {
+        if (m_retire.compare_exchange_weak(n, n - 1))
+            return true;
+    }
+    return false;
+}
+
+// 无锁队列模式下的唤醒：只有确实有线程在睡时才post，并且每个睡着的线程只被认领一次
+// 一批请求连续到来时，最多唤醒空闲线程数那么多次，已经醒着的线程会一直取到队列为空再去睡
+template <typename T>
+void threadpool<T>::wake_idle()
+{
+    // 入队时对槽序号的写是release语义，这里需要一个全屏障，保证先入队后读m_idle
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int idle = m_idle.load();
+    while (idle > 0)
+    {
+        if (m_idle.compare_exchange_weak(idle, idle - 1))
+        {
+            m_queuestat.post();
+            return;
+        }
+    }
+}
+
+template <typename T>
+void threadpool<T>::run_lockfree()
+{
+    while (!m_stop)
+    {
+        T *request = NULL;
+        if (!m_ringqueue->pop(request))
+        {
+            if (retire())
+                return;
+            // 先登记为空闲再检查一次队列，和append中先入队再检查m_idle相对应
+            // 两边都是顺序一致的原子操作，不会出现请求入队了却没有线程被唤醒的情况
+            m_idle.fetch_add(1);
+            if (!m_ringqueue->pop(request))
+            {
+                m_queuestat.wait();
+                continue;
+            }
+            // 取到了任务，撤销空闲登记；如果已经被生产者认领，多出来的一次post只会造成一次空转
+            int idle = m_idle.load();
+            while (idle > 0 && !m_idle.compare_exchange_weak(idle, idle - 1))
+                ;
+        }
+        if (!request)
+            continue;
+
+        request->process();
+    }
+}
+
+// 把睡着的id号线程标记为醒来，成功的一方负责post或者消耗对应的post
+template <typename T>
+bool threadpool<T>::claim(int id)
+{
+    bool expected = true;
+    if (m_slots[id].sleeping.compare_exchange_strong(expected, false))
+    {
+        m_idle.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
+
+// 优先唤醒home线程，保持cache亲和；home在忙时再唤醒任意一个睡着的线程过来窃取
+template <typename T>
+void threadpool<T>::wake_worker(int home)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (claim(home))
+    {
+        m_slots[home].wakeup.post();
+        return;
+    }
+    if (m_idle.load() <= 0)
+        return;
+    for (int i = 1; i < m_thread_number; ++i)
+    {
+        int id = (home + i) % m_thread_number;
+        if (claim(id))
+        {
+            m_slots[id].wakeup.post();
+            return;
+        }
+    }
+}
+
+// 先取自己的队列，取不到再从后面的线程依次窃取
+template <typename T>
+bool threadpool<T>::take(int id, T *&request)
+{
+    if (m_slots[id].queue->pop(request))
+        return true;
+    for (int i = 1; i < m_thread_number; ++i)
+    {
+        if (m_slots[(id + i) % m_thread_number].queue->pop(request))
+            return true;
+    }
+    return false;
+}
+
+template <typename T>
+void threadpool<T>::run_worksteal(int id)
+{
+    while (!m_stop)
+    {
+        T *request = NULL;
+        if (!take(id, request))
+        {
+            // 先登记为睡眠再把所有队列检查一遍，和append中先入队再检查sleeping相对应
+            m_slots[id].sleeping.store(true);
+            m_idle.fetch_add(1);
+            if (!take(id, request))
+            {
+                m_slots[id].wakeup.wait();
+                continue;
+            }
+            // 已经取到任务；如果生产者抢先认领了本线程，它一定会post，把这次post消耗掉
+            if (!claim(id))
+                m_slots[id].wakeup.wait();
+        }
+        if (!request)
+            continue;
+
+        request->process();
+    }
+}
+
 // 这个run函数是每个工作线程真正执行的内容
 template <typename T>
 void threadpool<T>::run()
 {
+    // 每个线程领取一个编号，按编号绑核
+    int id = m_next_id.fetch_add(1);
+    if (m_affinity_mode == AFFINITY_CPU)
+        bind_self_to_cpu(id);
+    else if (m_affinity_mode == AFFINITY_NUMA)
+        bind_self_to_node(id);
+
+    if (m_queue_mode == WORKSTEAL_QUEUE)
+    {
+        run_worksteal(id);
+        return;
+    }
+    if (m_queue_mode == LOCKFREE_QUEUE)
+    {
+        run_lockfree();
+        return;
+    }
+
     // create了之后，每个线程就会一直处于while循环状态，只不过没有任务时，
     // 会睡在m_queuestat.wait();语句处，等待新任务到来并被唤醒
     while (!m_stop)
@@ -174,20 +568,19 @@ void threadpool<T>::run()
         if (m_workqueue.empty())
         {
             m_queuelocker.unlock();
+            if (retire())
+                return;
             continue;
         }
 
         // 如果任务队列中有任务，就取出第一个任务，然后解锁，解锁后，其他的线程才能访问任务队列这一公共资源
         // 一个T就是任务队列中的一个任务   T*是任务数据结构的地址
         T *request = m_workqueue.front();
-        m_workqueue.pop_front();
+        m_freenodes.splice(m_freenodes.begin(), m_workqueue, m_workqueue.begin());
         m_queuelocker.unlock();
         if (!request)
             continue;
 
-        // 从连接池中取出一个数据库连接
-        connectionRAII mysqlcon(&request->mysql, m_connPool);
-        
         // 启动process函数来完成http请求报文的解析和请求的响应
         request->process();
     }
@@ -4,27 +4,36 @@
 #include <time.h>
 #include "../log/log.h"
 
-class util_timer;
-struct client_data
-{
-    sockaddr_in address;
-    int sockfd;
-    util_timer *timer;
-};
+struct client_data;
 
+//expire的单位由所在的容器决定：sort_timer_lst按秒，time_wheel按毫秒
+//rotation和slot只有time_wheel使用
+//sort_timer_lst中的节点是new出来的，由链表负责delete；time_wheel不拥有节点，只负责挂上和摘下
 class util_timer
 {
 public:
-    util_timer() : prev(NULL), next(NULL) {}
+    util_timer() : rotation(0), slot(-1), prev(NULL), next(NULL) {}
 
 public:
     time_t expire;
     void (*cb_func)(client_data *);
     client_data *user_data;
+    int rotation;
+    int slot;
     util_timer *prev;
     util_timer *next;
 };
 
+//定时器节点直接嵌在client_data中，client_data数组按max_fd预先分配
+//建立和关闭连接都不需要在堆上分配定时器，遍历时间轮时节点也在一块连续内存里
+struct client_data
+{
+    sockaddr_in address;
+    int sockfd;
+    int epollfd;
+    util_timer timer;
+};
+
 class sort_timer_lst
 {
 public:
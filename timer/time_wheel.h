@@ -0,0 +1,130 @@
+#ifndef TIME_WHEEL
+#define TIME_WHEEL
+
+#include <time.h>
+#include <string.h>
+#include "lst_timer.h"
+
+// 哈希时间轮：N个槽，每个槽是一条无序的双向链表，相邻两个槽之间相隔m_tick毫秒
+// 定时器按到期时间哈希到槽中，超过一圈的用rotation记录还要转几圈
+// 添加、调整、删除都只是链表的插入和摘除，O(1)；tick时只遍历当前槽
+// tick由timerfd驱动，时间使用CLOCK_MONOTONIC毫秒，不受系统时间调整影响
+// 时间轮不拥有定时器节点，节点嵌在client_data中，删除和到期都只把节点从槽上摘下，不delete
+class time_wheel
+{
+public:
+    time_wheel(int tick_ms = 100) : m_cur_slot(0), m_tick(tick_ms)
+    {
+        memset(m_slots, 0, sizeof(m_slots));
+        m_cur_time = now_ms();
+    }
+    ~time_wheel() {}
+
+    static time_t now_ms()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    int get_tick() const
+    {
+        return m_tick;
+    }
+
+    //timer->expire为绝对到期时间(毫秒)
+    //fd被复用时节点可能还挂在轮上(连接由工作线程关闭时没有删除定时器)，先摘下再挂
+    void add_timer(util_timer *timer)
+    {
+        if (!timer)
+        {
+            return;
+        }
+        unlink(timer);
+        link(timer);
+    }
+    //到期时间被修改后，从原槽摘下放入新槽
+    void adjust_timer(util_timer *timer)
+    {
+        if (!timer)
+        {
+            return;
+        }
+        unlink(timer);
+        link(timer);
+    }
+    void del_timer(util_timer *timer)
+    {
+        if (!timer)
+        {
+            return;
+        }
+        unlink(timer);
+    }
+    //把时间轮推进到当前时间，依次处理经过的槽
+    void tick()
+    {
+        time_t cur = now_ms();
+        while (m_cur_time + m_tick <= cur)
+        {
+            util_timer *tmp = m_slots[m_cur_slot];
+            while (tmp)
+            {
+                util_timer *next = tmp->next;
+                if (tmp->rotation > 0)
+                {
+                    tmp->rotation--;
+                }
+                else
+                {
+                    unlink(tmp);
+                    tmp->cb_func(tmp->user_data);
+                }
+                tmp = next;
+            }
+            m_cur_slot = (m_cur_slot + 1) % N;
+            m_cur_time += m_tick;
+        }
+    }
+
+private:
+    //下一次tick处理的是m_cur_slot，它在m_cur_time + m_tick时刻被处理
+    //放在往后第ticks个槽的定时器在m_cur_time + (ticks + 1) * m_tick时刻被处理，取满足不早于expire的最小ticks
+    void link(util_timer *timer)
+    {
+        time_t diff = timer->expire - m_cur_time;
+        int ticks = 0;
+        if (diff > m_tick)
+            ticks = (diff + m_tick - 1) / m_tick - 1;
+        timer->rotation = ticks / N;
+        timer->slot = (m_cur_slot + ticks % N) % N;
+
+        timer->prev = NULL;
+        timer->next = m_slots[timer->slot];
+        if (m_slots[timer->slot])
+            m_slots[timer->slot]->prev = timer;
+        m_slots[timer->slot] = timer;
+    }
+    void unlink(util_timer *timer)
+    {
+        if (timer->slot < 0)
+            return;
+        if (timer->prev)
+            timer->prev->next = timer->next;
+        else
+            m_slots[timer->slot] = timer->next;
+        if (timer->next)
+            timer->next->prev = timer->prev;
+        timer->prev = timer->next = NULL;
+        timer->slot = -1;
+    }
+
+private:
+    static const int N = 512; //槽数，512 * 100ms约51秒一圈，连接超时一般不需要转圈
+    util_timer *m_slots[N];
+    int m_cur_slot;
+    int m_tick;        //槽间隔，毫秒
+    time_t m_cur_time; //当前槽的起始时间
+};
+
+#endif
@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/err.h>
+#include "tls_server.h"
+#include "../log/log.h"
+#include "../metrics/metrics.h"
+#include "../admission/admission.h"
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+//在http_conn.cpp中定义
+extern int setnonblocking(int fd);
+
+//内核kTLS支持的只有AES-GCM和CHACHA20-POLY1305，协商出别的套件就没法卸载；TLS 1.3的默认套件都在其中
+static const char TLS12_CIPHERS[] = "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+                                    "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:"
+                                    "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305";
+static const char TLS13_CIPHERS[] = "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256";
+
+tls_inbox::tls_inbox() : m_wakefd(-1), m_wake_pending(false)
+{
+}
+
+tls_inbox::~tls_inbox()
+{
+    for (size_t i = 0; i < m_ready.size(); ++i)
+    {
+        close(m_ready[i].first);
+        admission::GetInstance()->disconnect(m_ready[i].second.sin_addr.s_addr);
+    }
+}
+
+void tls_inbox::init(int wakefd)
+{
+    m_wakefd = wakefd;
+}
+
+void tls_inbox::push(int sockfd, const sockaddr_in &addr)
+{
+    m_lock.lock();
+    m_ready.push_back(make_pair(sockfd, addr));
+    m_lock.unlock();
+    if (!m_wake_pending.exchange(true))
+    {
+        uint64_t one = 1;
+        ::write(m_wakefd, &one, sizeof(one));
+    }
+}
+
+void tls_inbox::take(vector<pair<int, sockaddr_in> > &out)
+{
+    m_wake_pending = false;
+    m_lock.lock();
+    out.swap(m_ready);
+    m_lock.unlock();
+}
+
+tls_server::tls_server() : m_ctx(NULL), m_workers(NULL), m_worker_count(0), m_next(0), m_stop(false)
+{
+}
+
+tls_server::~tls_server()
+{
+    stop();
+    if (m_ctx)
+        SSL_CTX_free(m_ctx);
+}
+
+tls_server *tls_server::GetInstance()
+{
+    static tls_server instance;
+    return &instance;
+}
+
+static void log_ssl_error(const char *what)
+{
+    char buf[256];
+    ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+    LOG_ERROR("%s failure: %s", what, buf);
+}
+
+bool tls_server::init(const string &cert, const string &key, int threads)
+{
+    if (!ktls_supported())
+    {
+        LOG_ERROR("%s", "kernel TLS not available, load the tls module (modprobe tls)");
+        return false;
+    }
+    m_ctx = SSL_CTX_new(TLS_server_method());
+    if (!m_ctx)
+    {
+        log_ssl_error("SSL_CTX_new");
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(m_ctx, TLS1_2_VERSION);
+#if OPENSSL_VERSION_NUMBER < 0x30200000L
+    //3.2之前TLS 1.3只能卸载发送方向
+    SSL_CTX_set_max_proto_version(m_ctx, TLS1_2_VERSION);
+#endif
+    //read_ahead保持关闭：OpenSSL多读进来的记录在用户态缓冲区里，接收方向就不能交给内核了
+    SSL_CTX_set_options(m_ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+    SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_OFF);
+    if (!SSL_CTX_set_cipher_list(m_ctx, TLS12_CIPHERS) || !SSL_CTX_set_ciphersuites(m_ctx, TLS13_CIPHERS))
+    {
+        log_ssl_error("set ciphers");
+        return false;
+    }
+    if (SSL_CTX_use_certificate_chain_file(m_ctx, cert.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(m_ctx, key.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(m_ctx) != 1)
+    {
+        log_ssl_error("load certificate");
+        return false;
+    }
+
+    m_worker_count = threads > 0 ? threads : 1;
+    m_workers = new handshaker[m_worker_count];
+    for (int i = 0; i < m_worker_count; ++i)
+    {
+        handshaker &h = m_workers[i];
+        h.server = this;
+        h.epollfd = epoll_create1(EPOLL_CLOEXEC);
+        h.wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (h.epollfd == -1 || h.wakefd == -1)
+            return false;
+        //data.ptr为NULL的是wakefd，其余的是握手中的session
+        epoll_event event;
+        event.data.ptr = NULL;
+        event.events = EPOLLIN;
+        epoll_ctl(h.epollfd, EPOLL_CTL_ADD, h.wakefd, &event);
+    }
+    for (int i = 0; i < m_worker_count; ++i)
+    {
+        if (pthread_create(&m_workers[i].tid, NULL, worker, m_workers + i) != 0)
+        {
+            m_worker_count = i;
+            return false;
+        }
+    }
+    LOG_INFO("tls enabled, %d handshake threads", m_worker_count);
+    return true;
+}
+
+//挂载ULP要求连接已经建立；回环上connect返回时连接已经在监听队列里建立好了，不用accept
+bool tls_server::ktls_supported()
+{
+    int listenfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int connfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool ok = false;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (listenfd >= 0 && connfd >= 0 && bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(listenfd, 1) == 0 &&
+        getsockname(listenfd, (struct sockaddr *)&addr, &len) == 0 && connect(connfd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        ok = setsockopt(connfd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0;
+    if (connfd >= 0)
+        close(connfd);
+    if (listenfd >= 0)
+        close(listenfd);
+    return ok;
+}
+
+void tls_server::handshake(int sockfd, const sockaddr_in &addr, tls_inbox *inbox)
+{
+    session *s = new session;
+    s->ssl = NULL;
+    s->fd = sockfd;
+    s->addr = addr;
+    s->inbox = inbox;
+    s->flags = 0;
+    s->start_ns = metrics::now_ns();
+    s->index = -1;
+
+    handshaker &h = m_workers[m_next.fetch_add(1, std::memory_order_relaxed) % m_worker_count];
+    h.lock.lock();
+    h.incoming.push_back(s);
+    h.lock.unlock();
+    uint64_t one = 1;
+    ::write(h.wakefd, &one, sizeof(one));
+}
+
+void tls_server::stop()
+{
+    if (!m_workers || m_stop.exchange(true))
+        return;
+    for (int i = 0; i < m_worker_count; ++i)
+        pthread_join(m_workers[i].tid, NULL);
+    for (int i = 0; i < m_worker_count; ++i)
+    {
+        close(m_workers[i].epollfd);
+        close(m_workers[i].wakefd);
+    }
+    delete[] m_workers;
+    m_workers = NULL;
+}
+
+void *tls_server::worker(void *arg)
+{
+    handshaker *h = (handshaker *)arg;
+    h->server->run(*h);
+    return h;
+}
+
+void tls_server::run(handshaker &h)
+{
+    epoll_event events[64];
+    vector<session *> batch;
+    uint64_t next_sweep = 0;
+    while (!m_stop.load())
+    {
+        int number = epoll_wait(h.epollfd, events, 64, TICK_MS);
+        if (number < 0 && errno != EINTR)
+        {
+            LOG_ERROR("%s", "tls epoll failure");
+            break;
+        }
+        for (int i = 0; i < number; ++i)
+        {
+            session *s = (session *)events[i].data.ptr;
+            if (s)
+            {
+                step(h, s);
+                continue;
+            }
+            uint64_t count;
+            read(h.wakefd, &count, sizeof(count));
+            h.lock.lock();
+            batch.swap(h.incoming);
+            h.lock.unlock();
+            for (size_t j = 0; j < batch.size(); ++j)
+                start(h, batch[j]);
+            batch.clear();
+        }
+        uint64_t now = metrics::now_ns();
+        if (now >= next_sweep)
+        {
+            sweep(h);
+            next_sweep = now + TICK_MS * 1000000ULL;
+        }
+    }
+
+    while (!h.sessions.empty())
+        fail(h, h.sessions.back(), "server stopping");
+    h.lock.lock();
+    batch.swap(h.incoming);
+    h.lock.unlock();
+    for (size_t j = 0; j < batch.size(); ++j)
+        fail(h, batch[j], "server stopping");
+}
+
+void tls_server::start(handshaker &h, session *s)
+{
+    if ((int)h.sessions.size() >= MAX_HANDSHAKES)
+    {
+        fail(h, s, "too many handshakes");
+        return;
+    }
+    s->ssl = SSL_new(m_ctx);
+    if (!s->ssl || !SSL_set_fd(s->ssl, s->fd))
+    {
+        fail(h, s, "SSL_new failure");
+        return;
+    }
+    SSL_set_accept_state(s->ssl);
+    s->flags = setnonblocking(s->fd);
+
+    epoll_event event;
+    event.data.ptr = s;
+    event.events = EPOLLIN;
+    epoll_ctl(h.epollfd, EPOLL_CTL_ADD, s->fd, &event);
+    s->index = h.sessions.size();
+    h.sessions.push_back(s);
+    //ClientHello通常已经到了，不等epoll先推进一步
+    step(h, s);
+}
+
+//推进握手，需要等数据或者等发送缓冲区时按OpenSSL的要求改注册的事件
+void tls_server::step(handshaker &h, session *s)
+{
+    ERR_clear_error();
+    int ret = SSL_do_handshake(s->ssl);
+    if (ret == 1)
+    {
+        finish(h, s);
+        return;
+    }
+    int err = SSL_get_error(s->ssl, ret);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+    {
+        epoll_event event;
+        event.data.ptr = s;
+        event.events = err == SSL_ERROR_WANT_READ ? EPOLLIN : EPOLLOUT;
+        epoll_ctl(h.epollfd, EPOLL_CTL_MOD, s->fd, &event);
+        return;
+    }
+    char reason[256];
+    if (ERR_peek_error())
+        ERR_error_string_n(ERR_get_error(), reason, sizeof(reason));
+    else
+        snprintf(reason, sizeof(reason), "%s", err == SSL_ERROR_ZERO_RETURN || ret == 0 ? "peer closed" : strerror(errno));
+    fail(h, s, reason);
+}
+
+//握手完成时OpenSSL已经在socket上设置好了TLS_TX和TLS_RX，两个方向都在内核里才能交回reactor：
+//只卸载了发送方向时，收到的还是密文，reactor的recv读不了
+void tls_server::finish(handshaker &h, session *s)
+{
+    if (!BIO_get_ktls_send(SSL_get_wbio(s->ssl)) || !BIO_get_ktls_recv(SSL_get_rbio(s->ssl)) || SSL_has_pending(s->ssl))
+    {
+        char reason[128];
+        snprintf(reason, sizeof(reason), "%s %s not offloaded to kernel", SSL_get_version(s->ssl), SSL_get_cipher_name(s->ssl));
+        fail(h, s, reason);
+        return;
+    }
+    metrics::add(metrics::TLS_HANDSHAKES);
+    if (SSL_session_reused(s->ssl))
+        metrics::add(metrics::TLS_RESUMED);
+    metrics::observe(metrics::STAGE_TLS_HANDSHAKE, metrics::now_ns() - s->start_ns);
+
+    int fd = s->fd;
+    sockaddr_in addr = s->addr;
+    tls_inbox *inbox = s->inbox;
+    remove(h, s);
+    //SSL_set_fd建的socket BIO不拥有fd，释放SSL不会关闭连接，也不发close_notify
+    SSL_free(s->ssl);
+    //恢复成accept出来时的阻塞模式，io_uring后端要求阻塞的fd
+    fcntl(fd, F_SETFL, s->flags);
+    delete s;
+    inbox->push(fd, addr);
+}
+
+void tls_server::fail(handshaker &h, session *s, const char *reason)
+{
+    metrics::add(metrics::TLS_FAILED);
+    LOG_WARN("tls handshake with %s failed: %s", inet_ntoa(s->addr.sin_addr), reason);
+    remove(h, s);
+    if (s->ssl)
+        SSL_free(s->ssl);
+    close(s->fd);
+    admission::GetInstance()->disconnect(s->addr.sin_addr.s_addr);
+    delete s;
+}
+
+//从epoll和sessions中摘下，最后一个换到它的位置
+void tls_server::remove(handshaker &h, session *s)
+{
+    if (s->index < 0)
+        return;
+    epoll_ctl(h.epollfd, EPOLL_CTL_DEL, s->fd, 0);
+    session *last = h.sessions.back();
+    h.sessions[s->index] = last;
+    last->index = s->index;
+    h.sessions.pop_back();
+    s->index = -1;
+}
+
+//从后往前扫，fail换过来的都是已经扫过的
+void tls_server::sweep(handshaker &h)
+{
+    uint64_t now = metrics::now_ns();
+    for (int i = (int)h.sessions.size() - 1; i >= 0; --i)
+    {
+        if (i < (int)h.sessions.size() && now - h.sessions[i]->start_ns > HANDSHAKE_TIMEOUT_MS * 1000000ULL)
+            fail(h, h.sessions[i], "handshake timeout");
+    }
+}
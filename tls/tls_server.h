@@ -0,0 +1,109 @@
+#ifndef TLS_SERVER_H
+#define TLS_SERVER_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <utility>
+#include <openssl/ssl.h>
+#include "../lock/locker.h"
+
+using namespace std;
+
+// 握手完成、已经交给kTLS的连接，交回accept它的事件循环
+// 握手线程上push，写一次事件循环的eventfd；事件循环被唤醒后take，之后和刚accept的明文连接一样处理
+class tls_inbox
+{
+public:
+    tls_inbox();
+    // 没来得及取走的连接在这里关闭
+    ~tls_inbox();
+
+    // wakefd为事件循环的eventfd，有连接交回时写它
+    void init(int wakefd);
+    void push(int sockfd, const sockaddr_in &addr);
+    // 事件循环上调用：取走所有交回的连接；先清标志再取，之后push的一定会再写一次eventfd
+    void take(vector<pair<int, sockaddr_in> > &out);
+
+private:
+    locker m_lock;
+    vector<pair<int, sockaddr_in> > m_ready;
+    int m_wakefd;
+    std::atomic<bool> m_wake_pending;
+};
+
+// TLS终结，单例
+// reactor在TLS监听socket上accept后，把连接交给握手线程，握手不占用事件循环
+// 握手线程各自一个epoll，非阻塞地推进SSL_accept；握手完成时OpenSSL已经把会话密钥设置到socket上(SOL_TLS，收发两个方向)
+// 之后加解密都在内核里，SSL对象直接释放，连接交回reactor，原来的recv、writev、sendfile、io_uring的splice都不用改
+// 只保留内核能接手的套件：AES-GCM和CHACHA20-POLY1305；OpenSSL 3.2之前不支持TLS 1.3的接收方向卸载，最高协商到TLS 1.2
+// 会话恢复只用无状态的ticket，服务端不保存会话，所有握手线程共用一个SSL_CTX，ticket密钥相同
+class tls_server
+{
+public:
+    static tls_server *GetInstance();
+
+    // 加载证书链和私钥，启动threads个握手线程；内核不支持kTLS时失败，不启动TLS监听
+    bool init(const string &cert, const string &key, int threads);
+
+    // reactor线程上调用：接受到的TLS连接交给一个握手线程，成功后放进inbox，失败或超时时关闭
+    void handshake(int sockfd, const sockaddr_in &addr, tls_inbox *inbox);
+
+    // reactor都退出后调用：停止握手线程，没完成的握手直接关闭
+    void stop();
+
+    // 在一条本地回环连接上试着挂载tls ULP，内核没有加载tls模块时返回false
+    static bool ktls_supported();
+
+public:
+    static const int HANDSHAKE_TIMEOUT_MS = 10000; //握手超过该时间还没完成就关闭
+    static const int MAX_HANDSHAKES = 4096;        //每个握手线程同时进行的握手数，超过时新连接直接关闭
+    static const int TICK_MS = 100;                //握手线程检查超时的周期
+
+private:
+    // 一个进行中的握手
+    struct session
+    {
+        SSL *ssl;
+        int fd;
+        sockaddr_in addr;
+        tls_inbox *inbox;
+        int flags;         //交给握手线程之前的文件状态标志，握手时改成非阻塞，交回时恢复
+        uint64_t start_ns; //超时和握手耗时都从这里算
+        int index; //在handshaker::sessions中的下标
+    };
+    // 一个握手线程：reactor把新连接放进incoming，写wakefd唤醒
+    struct handshaker
+    {
+        tls_server *server;
+        pthread_t tid;
+        int epollfd;
+        int wakefd;
+        locker lock;
+        vector<session *> incoming;
+        vector<session *> sessions;
+    };
+
+    tls_server();
+    ~tls_server();
+    static void *worker(void *arg);
+    void run(handshaker &h);
+    void start(handshaker &h, session *s);
+    void step(handshaker &h, session *s);
+    void finish(handshaker &h, session *s);
+    void fail(handshaker &h, session *s, const char *reason);
+    void remove(handshaker &h, session *s);
+    void sweep(handshaker &h);
+
+private:
+    SSL_CTX *m_ctx;
+    handshaker *m_workers;
+    int m_worker_count;
+    std::atomic<unsigned> m_next; //轮流分给各握手线程
+    std::atomic<bool> m_stop;
+};
+
+#endif